@@ -42,12 +42,70 @@
 
 /* nla header files. */
 #include <nla_fpm.h>
+#include <nla_shm.h>
 #include <nla_defs.h>
 #include <nla_externs.h>
 
 
 #define NODE_VAL(node) ((const char *)(node)->data.scalar.value)
 
+#define NLA_OPT(opts, offset) ((int *)((char *)(opts) + (offset)))
+
+#define NLA_OPTS_COUNT(opts) (sizeof(opts) / sizeof((opts)[0]))
+
+
+/* Integer or boolean option key, stored at offset in an options struct */
+typedef struct nla_yaml_opt_s {
+    const char *key;
+    size_t      offset;
+    bool        is_bool;
+} nla_yaml_opt_t;
+
+
+/* Socket option keys */
+static const nla_yaml_opt_t nla_yaml_sockopts[] = {
+    { "tcp-nodelay",        offsetof(nla_sockopt_t, nlaso_nodelay),       true  },
+    { "tcp-cork",           offsetof(nla_sockopt_t, nlaso_cork),          true  },
+    { "sndbuf",             offsetof(nla_sockopt_t, nlaso_sndbuf),        false },
+    { "rcvbuf",             offsetof(nla_sockopt_t, nlaso_rcvbuf),        false },
+    { "busy-poll",          offsetof(nla_sockopt_t, nlaso_busy_poll),     false },
+    { "notsent-lowat",      offsetof(nla_sockopt_t, nlaso_notsent_lowat), false },
+    { "keepalive",          offsetof(nla_sockopt_t, nlaso_keepalive),     true  },
+    { "keepalive-idle",     offsetof(nla_sockopt_t, nlaso_keepidle),      false },
+    { "keepalive-interval", offsetof(nla_sockopt_t, nlaso_keepintvl),     false },
+    { "keepalive-count",    offsetof(nla_sockopt_t, nlaso_keepcnt),       false },
+};
+
+
+/* gRPC channel argument keys */
+static const nla_yaml_opt_t nla_yaml_grpcopts[] = {
+    { "grpc-max-message-size",     offsetof(nla_grpcopt_t, nlago_max_msg_size),      false },
+    { "grpc-window-size",          offsetof(nla_grpcopt_t, nlago_window_size),       false },
+    { "grpc-bdp-probe",            offsetof(nla_grpcopt_t, nlago_bdp_probe),         true  },
+    { "grpc-write-buffer-size",    offsetof(nla_grpcopt_t, nlago_write_buffer_size), false },
+    { "grpc-keepalive-time",       offsetof(nla_grpcopt_t, nlago_keepalive_time),    false },
+    { "grpc-keepalive-timeout",    offsetof(nla_grpcopt_t, nlago_keepalive_timeout), false },
+    { "grpc-keepalive-when-idle",  offsetof(nla_grpcopt_t, nlago_keepalive_idle),    true  },
+    { "grpc-idle-timeout",         offsetof(nla_grpcopt_t, nlago_idle_timeout),      false },
+};
+
+
+/*
+ * socket-profile presets, only filling in the options which aren't set
+ * explicitly.
+ *  low-latency : send every msg right away and busy poll for the replies.
+ *  bulk-sync   : full segments and large buffers for table dumps.
+ */
+static const struct {
+    const char    *name;
+    nla_sockopt_t  sockopt;
+} nla_yaml_socket_profiles[] = {
+    { "low-latency",
+      { 1, 0, NLA_INVALID, NLA_INVALID, 50, 16 << 10, 1, 10, 5, 3 } },
+    { "bulk-sync",
+      { 0, 1, 4 << 20, 4 << 20, NLA_INVALID, NLA_INVALID, 1, 30, 10, 3 } },
+};
+
 
 static int
 nla_yaml_get_module_id (yaml_document_t *document, int i)
@@ -72,6 +130,27 @@ nla_yaml_module_init (int module)
     nla_infa_modules[module].nlam_config.nlamc_enable = true;
     nla_infa_modules[module].nlam_config.nlamc_addr   = NULL;
     nla_infa_modules[module].nlam_config.nlamc_port   = NLA_INVALID;
+    nla_infa_modules[module].nlam_config.nlamc_max_msg_len = NLA_INVALID;
+    nla_infa_modules[module].nlam_config.nlamc_fpm_msg_type = NLA_INVALID;
+    nla_infa_modules[module].nlam_config.nlamc_ring_size = NLA_INVALID;
+    nla_infa_modules[module].nlam_config.nlamc_replay_cache = false;
+    nla_infa_modules[module].nlam_config.nlamc_compression = NLA_INVALID;
+    nla_infa_modules[module].nlam_config.nlamc_max_outstanding_rpcs = NLA_INVALID;
+    nla_infa_modules[module].nlam_config.nlamc_monitor_tables = 0;
+    nla_infa_modules[module].nlam_config.nlamc_retry_spill_file = NULL;
+    nla_infa_modules[module].nlam_config.nlamc_channels = NLA_INVALID;
+    nla_infa_modules[module].nlam_config.nlamc_table_maps = 0;
+    nla_infa_modules[module].nlam_config.nlamc_channel_shard = NLA_INVALID;
+
+    for (i = 0; i < (int)NLA_OPTS_COUNT(nla_yaml_sockopts); i++) {
+        *NLA_OPT(&nla_infa_modules[module].nlam_config.nlamc_sockopt,
+                 nla_yaml_sockopts[i].offset) = NLA_INVALID;
+    }
+
+    for (i = 0; i < (int)NLA_OPTS_COUNT(nla_yaml_grpcopts); i++) {
+        *NLA_OPT(&nla_infa_modules[module].nlam_config.nlamc_grpcopt,
+                 nla_yaml_grpcopts[i].offset) = NLA_INVALID;
+    }
 
     for (i = 0; i < NLA_MODULE_ALL; i++) {
         nla_infa_modules[module].nlam_config.nlamc_notify_me[i] = false;
@@ -146,6 +225,472 @@ nla_yaml_set_port (yaml_document_t *document, int i, int module)
 }
 
 
+static int
+nla_yaml_set_max_msg_len (yaml_document_t *document, int i, int module)
+{
+    yaml_node_t *node;
+    long max_msg_len;
+    char *end;
+
+    node = yaml_document_get_node(document, i);
+    if (!node) {
+        nla_log(LOG_INFO, "Failed to get node [%d]", i);
+        return -1;
+    }
+
+    errno = 0;
+    max_msg_len = strtol(NODE_VAL(node), &end, 10);
+    if (errno || *end || end == NODE_VAL(node) ||
+        max_msg_len <= (long)FPM_MSG_HDR_LARGE_LEN || max_msg_len > FPM_MAX_MSG_LEN_LARGE) {
+        nla_log0(LOG_ERR, "invalid max-msg-len %s", NODE_VAL(node));
+        return -1;
+    }
+
+    nla_infa_modules[module].nlam_config.nlamc_max_msg_len = max_msg_len;
+
+    return 0;
+}
+
+
+/*
+ * A seqpacket link carries a message in a single packet, so max-msg-len
+ * can't be above NLA_SEQPACKET_MAX_LEN there. Checked once the config is
+ * read, server-address may come after max-msg-len.
+ */
+static int
+nla_yaml_check_max_msg_len (void)
+{
+    nla_module_config_t *config;
+    int i;
+
+    for (i = 0; i < NLA_MODULE_ALL; i++) {
+        config = &nla_infa_modules[i].nlam_config;
+
+        if (!config->nlamc_enable || !config->nlamc_addr ||
+            config->nlamc_max_msg_len == NLA_INVALID) {
+            continue;
+        }
+
+        if (strncmp(config->nlamc_addr, NLA_UNIX_SEQPACKET_PREFIX,
+                    strlen(NLA_UNIX_SEQPACKET_PREFIX))) {
+            continue;
+        }
+
+        if (config->nlamc_max_msg_len > NLA_SEQPACKET_MAX_LEN) {
+            nla_log0(LOG_ERR, "invalid max-msg-len %d, %s carries at most %d bytes",
+                     config->nlamc_max_msg_len, config->nlamc_addr, NLA_SEQPACKET_MAX_LEN);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+static int
+nla_yaml_set_fpm_msg_type (yaml_document_t *document, int i, int module)
+{
+    yaml_node_t *node;
+    int msg_type;
+
+    node = yaml_document_get_node(document, i);
+    if (!node) {
+        nla_log(LOG_INFO, "Failed to get node [%d]", i);
+        return -1;
+    }
+
+    if (!strcmp("netlink", NODE_VAL(node))) {
+        msg_type = FPM_MSG_TYPE_NETLINK;
+    } else if (!strcmp("protobuf", NODE_VAL(node))) {
+        msg_type = FPM_MSG_TYPE_PROTOBUF;
+    } else {
+        nla_log0(LOG_ERR, "invalid fpm-msg-type %s", NODE_VAL(node));
+        return -1;
+    }
+
+    nla_infa_modules[module].nlam_config.nlamc_fpm_msg_type = msg_type;
+
+    return 0;
+}
+
+
+static int
+nla_yaml_set_ring_size (yaml_document_t *document, int i, int module)
+{
+    yaml_node_t *node;
+    long ring_size;
+    char *end;
+
+    node = yaml_document_get_node(document, i);
+    if (!node) {
+        nla_log(LOG_INFO, "Failed to get node [%d]", i);
+        return -1;
+    }
+
+    errno = 0;
+    ring_size = strtol(NODE_VAL(node), &end, 10);
+    if (errno || *end || end == NODE_VAL(node) ||
+        ring_size < NLA_SHM_RING_SIZE_MIN || ring_size > INT_MAX ||
+        (ring_size & (ring_size - 1))) {
+        nla_log0(LOG_ERR, "invalid ring-size %s, must be a power of 2 of at least %d",
+                 NODE_VAL(node), NLA_SHM_RING_SIZE_MIN);
+        return -1;
+    }
+
+    nla_infa_modules[module].nlam_config.nlamc_ring_size = ring_size;
+
+    return 0;
+}
+
+
+static int
+nla_yaml_set_replay_cache (yaml_document_t *document, int i, int module)
+{
+    yaml_node_t *node;
+
+    node = yaml_document_get_node(document, i);
+    if (!node) {
+        nla_log(LOG_INFO, "Failed to get node [%d]", i);
+        return -1;
+    }
+
+    if (!strcmp("true", NODE_VAL(node))) {
+        nla_infa_modules[module].nlam_config.nlamc_replay_cache = true;
+    } else if (!strcmp("false", NODE_VAL(node))) {
+        nla_infa_modules[module].nlam_config.nlamc_replay_cache = false;
+    } else {
+        nla_log0(LOG_ERR, "invalid replay-cache %s, must be true or false", NODE_VAL(node));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+nla_yaml_set_compression (yaml_document_t *document, int i, int module)
+{
+    yaml_node_t *node;
+    int compression;
+
+    node = yaml_document_get_node(document, i);
+    if (!node) {
+        nla_log(LOG_INFO, "Failed to get node [%d]", i);
+        return -1;
+    }
+
+    if (!strcmp("none", NODE_VAL(node))) {
+        compression = NLA_COMPRESSION_NONE;
+    } else if (!strcmp("zlib", NODE_VAL(node))) {
+        compression = NLA_COMPRESSION_ZLIB;
+    } else {
+        nla_log0(LOG_ERR, "invalid compression %s, must be none or zlib", NODE_VAL(node));
+        return -1;
+    }
+
+    nla_infa_modules[module].nlam_config.nlamc_compression = compression;
+
+    return 0;
+}
+
+
+static int
+nla_yaml_set_max_outstanding_rpcs (yaml_document_t *document, int i, int module)
+{
+    yaml_node_t *node;
+    long max_outstanding_rpcs;
+    char *end;
+
+    node = yaml_document_get_node(document, i);
+    if (!node) {
+        nla_log(LOG_INFO, "Failed to get node [%d]", i);
+        return -1;
+    }
+
+    errno = 0;
+    max_outstanding_rpcs = strtol(NODE_VAL(node), &end, 10);
+    if (errno || *end || end == NODE_VAL(node) ||
+        max_outstanding_rpcs <= 0 || max_outstanding_rpcs > INT_MAX) {
+        nla_log0(LOG_ERR, "invalid max-outstanding-rpcs %s", NODE_VAL(node));
+        return -1;
+    }
+
+    nla_infa_modules[module].nlam_config.nlamc_max_outstanding_rpcs = max_outstanding_rpcs;
+
+    return 0;
+}
+
+
+/*
+ * Only the inet and inet6 tables map to netlink routes.
+ */
+static int
+nla_yaml_set_monitor_table (yaml_document_t *document, int i, int module)
+{
+    yaml_node_t *node;
+    nla_module_config_t *config;
+
+    node = yaml_document_get_node(document, i);
+    if (!node) {
+        nla_log(LOG_INFO, "Failed to get node [%d]", i);
+        return -1;
+    }
+
+    if (nla_table_family(NODE_VAL(node)) == AF_UNSPEC) {
+        nla_log0(LOG_ERR, "invalid monitor-table %s, not an inet or inet6 table",
+                 NODE_VAL(node));
+        return -1;
+    }
+
+    config = &nla_infa_modules[module].nlam_config;
+    if (config->nlamc_monitor_tables >= NLA_MONITOR_TABLES_MAX) {
+        nla_log0(LOG_ERR, "more than %d monitor-table", NLA_MONITOR_TABLES_MAX);
+        return -1;
+    }
+
+    config->nlamc_monitor_table[config->nlamc_monitor_tables++] = strdup(NODE_VAL(node));
+
+    return 0;
+}
+
+
+static int
+nla_yaml_set_retry_spill_file (yaml_document_t *document, int i, int module)
+{
+    yaml_node_t *node;
+    nla_module_config_t *config;
+
+    node = yaml_document_get_node(document, i);
+    if (!node) {
+        nla_log(LOG_INFO, "Failed to get node [%d]", i);
+        return -1;
+    }
+
+    config = &nla_infa_modules[module].nlam_config;
+    free(config->nlamc_retry_spill_file);
+    config->nlamc_retry_spill_file = strdup(NODE_VAL(node));
+
+    return 0;
+}
+
+
+/*
+ * A table-map is a kernel table id and the inet or inet6 RIB table it
+ * maps to, e.g. "10 vrf.inet.0".
+ */
+static int
+nla_yaml_set_table_map (yaml_document_t *document, int i, int module)
+{
+    yaml_node_t *node;
+    nla_module_config_t *config;
+    unsigned long id;
+    char *table;
+
+    node = yaml_document_get_node(document, i);
+    if (!node) {
+        nla_log(LOG_INFO, "Failed to get node [%d]", i);
+        return -1;
+    }
+
+    id = strtoul(NODE_VAL(node), &table, 10);
+    while (isspace((unsigned char)*table)) {
+        table++;
+    }
+
+    if (table == NODE_VAL(node) || id == 0 || id > UINT32_MAX ||
+        nla_table_family(table) == AF_UNSPEC) {
+        nla_log0(LOG_ERR, "invalid table-map %s, must be a kernel table id and an inet or "
+                 "inet6 table", NODE_VAL(node));
+        return -1;
+    }
+
+    config = &nla_infa_modules[module].nlam_config;
+    if (config->nlamc_table_maps >= NLA_TABLE_MAPS_MAX) {
+        nla_log0(LOG_ERR, "more than %d table-map", NLA_TABLE_MAPS_MAX);
+        return -1;
+    }
+
+    config->nlamc_table_map_id[config->nlamc_table_maps] = id;
+    config->nlamc_table_map[config->nlamc_table_maps++] = strdup(table);
+
+    return 0;
+}
+
+
+static int
+nla_yaml_set_channels (yaml_document_t *document, int i, int module)
+{
+    yaml_node_t *node;
+    long channels;
+    char *end;
+
+    node = yaml_document_get_node(document, i);
+    if (!node) {
+        nla_log(LOG_INFO, "Failed to get node [%d]", i);
+        return -1;
+    }
+
+    errno = 0;
+    channels = strtol(NODE_VAL(node), &end, 10);
+    if (errno || *end || end == NODE_VAL(node) ||
+        channels <= 0 || channels > NLA_CHANNELS_MAX) {
+        nla_log0(LOG_ERR, "invalid channels %s, must be 1 to %d", NODE_VAL(node),
+                 NLA_CHANNELS_MAX);
+        return -1;
+    }
+
+    nla_infa_modules[module].nlam_config.nlamc_channels = channels;
+
+    return 0;
+}
+
+
+static int
+nla_yaml_set_channel_shard (yaml_document_t *document, int i, int module)
+{
+    yaml_node_t *node;
+    int shard;
+
+    node = yaml_document_get_node(document, i);
+    if (!node) {
+        nla_log(LOG_INFO, "Failed to get node [%d]", i);
+        return -1;
+    }
+
+    if (!strcmp("prefix", NODE_VAL(node))) {
+        shard = NLA_CHANNEL_SHARD_PREFIX;
+    } else if (!strcmp("table", NODE_VAL(node))) {
+        shard = NLA_CHANNEL_SHARD_TABLE;
+    } else {
+        nla_log0(LOG_ERR, "invalid channel-shard %s, must be prefix or table", NODE_VAL(node));
+        return -1;
+    }
+
+    nla_infa_modules[module].nlam_config.nlamc_channel_shard = shard;
+
+    return 0;
+}
+
+
+/*
+ * Set the option key of the count keys in opts, if it is one, in the
+ * options struct values.
+ *
+ * @return 1 if the key at node i is one of opts, and it is set, 0 if it
+ *         isn't, -1 on invalid values.
+ */
+static int
+nla_yaml_set_opt (yaml_document_t *document, int i, const char *key,
+                  const nla_yaml_opt_t *opts, unsigned int count, void *values)
+{
+    yaml_node_t *node;
+    unsigned int j;
+    long value;
+    char *end;
+
+    for (j = 0; j < count; j++) {
+        if (!strcmp(opts[j].key, key)) {
+            break;
+        }
+    }
+
+    if (j == count) {
+        return 0;
+    }
+
+    node = yaml_document_get_node(document, i);
+    if (!node) {
+        nla_log(LOG_INFO, "Failed to get node [%d]", i);
+        return -1;
+    }
+
+    if (opts[j].is_bool) {
+        if (!strcmp("true", NODE_VAL(node))) {
+            value = 1;
+        } else if (!strcmp("false", NODE_VAL(node))) {
+            value = 0;
+        } else {
+            nla_log0(LOG_ERR, "invalid %s %s, must be true or false", key, NODE_VAL(node));
+            return -1;
+        }
+    } else {
+        value = strtol(NODE_VAL(node), &end, 10);
+        if (*end || end == NODE_VAL(node) || value < 0 || value > INT_MAX) {
+            nla_log0(LOG_ERR, "invalid %s %s", key, NODE_VAL(node));
+            return -1;
+        }
+    }
+
+    *NLA_OPT(values, opts[j].offset) = value;
+
+    return 1;
+}
+
+
+/*
+ * @return 1 if the key at node i is a socket option, and it is set, 0 if
+ *         it isn't a socket option, -1 on invalid values.
+ */
+static int
+nla_yaml_set_sockopt (yaml_document_t *document, int i, int module, const char *key)
+{
+    return nla_yaml_set_opt(document, i, key, nla_yaml_sockopts,
+                            NLA_OPTS_COUNT(nla_yaml_sockopts),
+                            &nla_infa_modules[module].nlam_config.nlamc_sockopt);
+}
+
+
+/*
+ * @return 1 if the key at node i is a gRPC channel argument, and it is set,
+ *         0 if it isn't one, -1 on invalid values.
+ */
+static int
+nla_yaml_set_grpcopt (yaml_document_t *document, int i, int module, const char *key)
+{
+    return nla_yaml_set_opt(document, i, key, nla_yaml_grpcopts,
+                            NLA_OPTS_COUNT(nla_yaml_grpcopts),
+                            &nla_infa_modules[module].nlam_config.nlamc_grpcopt);
+}
+
+
+static int
+nla_yaml_set_socket_profile (yaml_document_t *document, int i, int module)
+{
+    yaml_node_t *node;
+    unsigned int j, k;
+    int *opt;
+
+    node = yaml_document_get_node(document, i);
+    if (!node) {
+        nla_log(LOG_INFO, "Failed to get node [%d]", i);
+        return -1;
+    }
+
+    for (j = 0; j < sizeof(nla_yaml_socket_profiles) / sizeof(nla_yaml_socket_profiles[0]); j++) {
+        if (!strcmp(nla_yaml_socket_profiles[j].name, NODE_VAL(node))) {
+            break;
+        }
+    }
+
+    if (j == sizeof(nla_yaml_socket_profiles) / sizeof(nla_yaml_socket_profiles[0])) {
+        nla_log0(LOG_ERR, "invalid socket-profile %s, must be low-latency or bulk-sync",
+                 NODE_VAL(node));
+        return -1;
+    }
+
+    for (k = 0; k < NLA_OPTS_COUNT(nla_yaml_sockopts); k++) {
+        opt = NLA_OPT(&nla_infa_modules[module].nlam_config.nlamc_sockopt,
+                      nla_yaml_sockopts[k].offset);
+        if (*opt == NLA_INVALID) {
+            *opt = *NLA_OPT(&nla_yaml_socket_profiles[j].sockopt,
+                            nla_yaml_sockopts[k].offset);
+        }
+    }
+
+    return 0;
+}
+
+
 static int
 nla_yaml_set_notify_events_from (yaml_document_t *document, int i, int module)
 {
@@ -173,7 +718,7 @@ nla_yaml_set_notify_events_from (yaml_document_t *document, int i, int module)
 void
 nla_cleanup_config ()
 {
-    int i;
+    int i, j;
 
     nla_log(LOG_INFO, " ");
 
@@ -184,11 +729,51 @@ nla_cleanup_config ()
             nla_infa_modules[i].nlam_config.nlamc_addr = NULL;
         }
 
+        for (j = 0; j < nla_infa_modules[i].nlam_config.nlamc_monitor_tables; j++) {
+            free(nla_infa_modules[i].nlam_config.nlamc_monitor_table[j]);
+        }
+
+        if (nla_infa_modules[i].nlam_config.nlamc_retry_spill_file) {
+            free(nla_infa_modules[i].nlam_config.nlamc_retry_spill_file);
+        }
+
+        for (j = 0; j < nla_infa_modules[i].nlam_config.nlamc_table_maps; j++) {
+            free(nla_infa_modules[i].nlam_config.nlamc_table_map[j]);
+        }
+
         memset(&nla_infa_modules[i].nlam_config, 0, sizeof(nla_module_config_t));
     }
 }
 
 
+static void
+nla_dump_opts (const nla_yaml_opt_t *opts, unsigned int count, const void *values)
+{
+    unsigned int j;
+    int width = strlen("server-address");
+    int value;
+
+    /* Wide enough for the longest key of opts */
+    for (j = 0; j < count; j++) {
+        if ((int)strlen(opts[j].key) > width) {
+            width = strlen(opts[j].key);
+        }
+    }
+
+    for (j = 0; j < count; j++) {
+        value = *NLA_OPT(values, opts[j].offset);
+        if (value == NLA_INVALID) {
+            continue;
+        }
+        if (opts[j].is_bool) {
+            nla_log0(LOG_NOTICE, "     %-*s : %s", width, opts[j].key, value ? "true" : "false");
+        } else {
+            nla_log0(LOG_NOTICE, "     %-*s : %d", width, opts[j].key, value);
+        }
+    }
+}
+
+
 static void
 nla_dump_config ()
 {
@@ -215,6 +800,76 @@ nla_dump_config ()
                     nla_infa_modules[i].nlam_config.nlamc_port);
         }
 
+        if (nla_infa_modules[i].nlam_config.nlamc_max_msg_len != NLA_INVALID) {
+            nla_log0(LOG_NOTICE, "     max-msg-len    : %d",
+                    nla_infa_modules[i].nlam_config.nlamc_max_msg_len);
+        }
+
+        if (nla_infa_modules[i].nlam_config.nlamc_fpm_msg_type != NLA_INVALID) {
+            nla_log0(LOG_NOTICE, "     fpm-msg-type   : %s",
+                    (nla_infa_modules[i].nlam_config.nlamc_fpm_msg_type ==
+                     FPM_MSG_TYPE_PROTOBUF) ? "protobuf" : "netlink");
+        }
+
+        if (nla_infa_modules[i].nlam_config.nlamc_ring_size != NLA_INVALID) {
+            nla_log0(LOG_NOTICE, "     ring-size      : %d",
+                    nla_infa_modules[i].nlam_config.nlamc_ring_size);
+        }
+
+        if (nla_infa_modules[i].nlam_config.nlamc_replay_cache) {
+            nla_log0(LOG_NOTICE, "     replay-cache   : true");
+        }
+
+        if (nla_infa_modules[i].nlam_config.nlamc_compression != NLA_INVALID) {
+            nla_log0(LOG_NOTICE, "     compression    : %s",
+                    (nla_infa_modules[i].nlam_config.nlamc_compression ==
+                     NLA_COMPRESSION_ZLIB) ? "zlib" : "none");
+        }
+
+        if (nla_infa_modules[i].nlam_config.nlamc_max_outstanding_rpcs != NLA_INVALID) {
+            nla_log0(LOG_NOTICE, "     max-outstanding-rpcs : %d",
+                    nla_infa_modules[i].nlam_config.nlamc_max_outstanding_rpcs);
+        }
+
+        if (nla_infa_modules[i].nlam_config.nlamc_monitor_tables) {
+            nla_log0(LOG_NOTICE, "     monitor-tables :");
+        }
+        for (j = 0; j < nla_infa_modules[i].nlam_config.nlamc_monitor_tables; j++) {
+            nla_log0(LOG_NOTICE, "         monitor-table      : %s",
+                    nla_infa_modules[i].nlam_config.nlamc_monitor_table[j]);
+        }
+
+        if (nla_infa_modules[i].nlam_config.nlamc_retry_spill_file) {
+            nla_log0(LOG_NOTICE, "     retry-spill-file : %s",
+                    nla_infa_modules[i].nlam_config.nlamc_retry_spill_file);
+        }
+
+        if (nla_infa_modules[i].nlam_config.nlamc_channels != NLA_INVALID) {
+            nla_log0(LOG_NOTICE, "     channels       : %d",
+                    nla_infa_modules[i].nlam_config.nlamc_channels);
+        }
+
+        if (nla_infa_modules[i].nlam_config.nlamc_table_maps) {
+            nla_log0(LOG_NOTICE, "     table-maps     :");
+        }
+        for (j = 0; j < nla_infa_modules[i].nlam_config.nlamc_table_maps; j++) {
+            nla_log0(LOG_NOTICE, "         table-map          : %u %s",
+                    nla_infa_modules[i].nlam_config.nlamc_table_map_id[j],
+                    nla_infa_modules[i].nlam_config.nlamc_table_map[j]);
+        }
+
+        if (nla_infa_modules[i].nlam_config.nlamc_channel_shard != NLA_INVALID) {
+            nla_log0(LOG_NOTICE, "     channel-shard  : %s",
+                    (nla_infa_modules[i].nlam_config.nlamc_channel_shard ==
+                     NLA_CHANNEL_SHARD_TABLE) ? "table" : "prefix");
+        }
+
+        nla_dump_opts(nla_yaml_sockopts, NLA_OPTS_COUNT(nla_yaml_sockopts),
+                      &nla_infa_modules[i].nlam_config.nlamc_sockopt);
+
+        nla_dump_opts(nla_yaml_grpcopts, NLA_OPTS_COUNT(nla_yaml_grpcopts),
+                      &nla_infa_modules[i].nlam_config.nlamc_grpcopt);
+
         policy = nla_infa_modules[i].nlam_config.nlamc_policy;
         nla_log0(LOG_NOTICE, "     policy :");
         /* filter */
@@ -375,6 +1030,86 @@ nla_read_config ()
                  nla_yaml_set_port(&document, i, module_id);
              }
 
+             if (!strcmp("max-msg-len", NODE_VAL(node))) {
+                 if (nla_yaml_set_max_msg_len(&document, i, module_id) < 0) {
+                     goto failed;
+                 }
+             }
+
+             if (!strcmp("fpm-msg-type", NODE_VAL(node))) {
+                 if (nla_yaml_set_fpm_msg_type(&document, i, module_id) < 0) {
+                     goto failed;
+                 }
+             }
+
+             if (!strcmp("ring-size", NODE_VAL(node))) {
+                 if (nla_yaml_set_ring_size(&document, i, module_id) < 0) {
+                     goto failed;
+                 }
+             }
+
+             if (!strcmp("replay-cache", NODE_VAL(node))) {
+                 if (nla_yaml_set_replay_cache(&document, i, module_id) < 0) {
+                     goto failed;
+                 }
+             }
+
+             if (!strcmp("compression", NODE_VAL(node))) {
+                 if (nla_yaml_set_compression(&document, i, module_id) < 0) {
+                     goto failed;
+                 }
+             }
+
+             if (!strcmp("max-outstanding-rpcs", NODE_VAL(node))) {
+                 if (nla_yaml_set_max_outstanding_rpcs(&document, i, module_id) < 0) {
+                     goto failed;
+                 }
+             }
+
+             if (!strcmp("monitor-table", NODE_VAL(node))) {
+                 if (nla_yaml_set_monitor_table(&document, i, module_id) < 0) {
+                     goto failed;
+                 }
+             }
+
+             if (!strcmp("retry-spill-file", NODE_VAL(node))) {
+                 if (nla_yaml_set_retry_spill_file(&document, i, module_id) < 0) {
+                     goto failed;
+                 }
+             }
+
+             if (!strcmp("table-map", NODE_VAL(node))) {
+                 if (nla_yaml_set_table_map(&document, i, module_id) < 0) {
+                     goto failed;
+                 }
+             }
+
+             if (!strcmp("channels", NODE_VAL(node))) {
+                 if (nla_yaml_set_channels(&document, i, module_id) < 0) {
+                     goto failed;
+                 }
+             }
+
+             if (!strcmp("channel-shard", NODE_VAL(node))) {
+                 if (nla_yaml_set_channel_shard(&document, i, module_id) < 0) {
+                     goto failed;
+                 }
+             }
+
+             if (!strcmp("socket-profile", NODE_VAL(node))) {
+                 if (nla_yaml_set_socket_profile(&document, i, module_id) < 0) {
+                     goto failed;
+                 }
+             }
+
+             if (nla_yaml_set_sockopt(&document, i, module_id, NODE_VAL(node)) < 0) {
+                 goto failed;
+             }
+
+             if (nla_yaml_set_grpcopt(&document, i, module_id, NODE_VAL(node)) < 0) {
+                 goto failed;
+             }
+
              if (!strcmp("notify-events-from", NODE_VAL(node))) {
                  if (nla_yaml_set_notify_events_from(&document, i, module_id) < 0) {
                      nla_log(LOG_INFO, "Failed to set %s", NODE_VAL(node));
@@ -418,6 +1153,10 @@ nla_read_config ()
         }
     }
 
+    if (nla_yaml_check_max_msg_len() < 0) {
+        goto failed;
+    }
+
     ret = 0;
 
     nla_dump_config();
@@ -42,6 +42,7 @@ typedef enum nla_event_e {
     NLA_CONNECTION_UP,
     NLA_WRITE,
     NLA_GET_ALL,
+    NLA_END_OF_DUMP,     /* initial table replay done, msg is a NLMSG_DONE */
     NLA_EVENT_MAX,
 } nla_event_t;
 
@@ -53,6 +54,7 @@ typedef enum nla_module_e {
     NLA_FPM_CLIENT,  /* TCP Client for FIB Push/pull Manager : send/receive FPM msgs */
     NLA_NLM_SERVER,  /* TCP Server for Netlink Manager : send/receive Netlink msgs */
     NLA_NLM_CLIENT,  /* TCP Client for Netlink Manager : send/receive Netlink msgs */
+    NLA_SHM_SERVER,  /* Shared memory ring for Netlink Manager : publish Netlink msgs */
     NLA_MODULE_ALL,
 } nla_module_id_t;
 
@@ -61,6 +63,7 @@ typedef struct nla_event_info_s {
     int         nlaei_type;
     int         nlaei_msglen;
     const void *nlaei_msg;
+    uint64_t    nlaei_time;    /* ingress, nla_clock_ns(), 0 if unknown */
 } nla_event_info_t;
 
 
@@ -84,11 +87,123 @@ typedef struct nla_policy_s {
 } nla_policy_t;
 
 
+/* Transport address of a module, see server-address. */
+typedef struct nla_sockaddr_s {
+    struct sockaddr_storage nlasa_addr;
+    socklen_t               nlasa_len;
+    int                     nlasa_socktype;  /* SOCK_STREAM or SOCK_SEQPACKET */
+} nla_sockaddr_t;
+
+
+/* server-address prefixes selecting a unix domain socket */
+#define NLA_UNIX_STREAM_PREFIX    "unix:"
+#define NLA_UNIX_SEQPACKET_PREFIX "unix-seqpacket:"
+
+/*
+ * Largest packet exchanged over a SOCK_SEQPACKET connection. libevent
+ * never reads more than 4096 bytes at once, whatever the read max.
+ */
+#define NLA_SEQPACKET_MAX_LEN     4096
+
+/* Largest netlink message accepted from a NLM peer */
+#define NLA_NLMSG_MAX_LEN         (1 << 20)
+
+
+/* compression */
+#define NLA_COMPRESSION_NONE      0
+#define NLA_COMPRESSION_ZLIB      1
+
+
+/* RIB RPCs in flight at once, the others wait for a free slot */
+#define NLA_MAX_OUTSTANDING_RPCS  64
+
+/* RIB tables the prpd client monitors, see monitor-table */
+#define NLA_MONITOR_TABLES_MAX    16
+
+/* Where the prpd client spills the RIB retries not fitting in memory, see retry-spill-file */
+#define NLA_RETRY_SPILL_FILE      "/var/tmp/nlagent-prpd.retry"
+
+/* Kernel tables the prpd client maps to RIB tables, see table-map */
+#define NLA_TABLE_MAPS_MAX        64
+
+/* Where the counters are published, see -s stats-file and nla_stats.h */
+#define NLA_STATS_FILE            "/var/tmp/nlagent.stats"
+
+/* Largest ifindex whose interface name is cached, see nla_ifname() */
+#define NLA_IFINDEX_MAX           (1 << 20)
+
+/* gRPC channels of the prpd client, see channels */
+#define NLA_CHANNELS_MAX          16
+
+/* How the routes are sharded across the channels, see channel-shard */
+#define NLA_CHANNEL_SHARD_PREFIX  0
+#define NLA_CHANNEL_SHARD_TABLE   1
+
+/*
+ * Payload of the NLMSG_NOOP message negotiating the compression of a NLM
+ * connection: the client offers nlnh_compression, the server answers with
+ * the compression the client must use from then on.
+ */
+#define NLA_NLM_HELLO_MAGIC       0x4e4c415a  /* "NLAZ" */
+
+typedef struct nla_nlm_hello_s {
+    uint32_t nlnh_magic;
+    uint32_t nlnh_compression;
+} nla_nlm_hello_t;
+
+
+/*
+ * Socket options of a module connection, NLA_INVALID leaves the system
+ * default. The TCP ones only apply to TCP connections.
+ */
+typedef struct nla_sockopt_s {
+    int nlaso_nodelay;        /* TCP_NODELAY */
+    int nlaso_cork;           /* TCP_CORK, lifted whenever the output drains */
+    int nlaso_sndbuf;         /* SO_SNDBUF */
+    int nlaso_rcvbuf;         /* SO_RCVBUF */
+    int nlaso_busy_poll;      /* SO_BUSY_POLL, usecs */
+    int nlaso_notsent_lowat;  /* TCP_NOTSENT_LOWAT */
+    int nlaso_keepalive;      /* SO_KEEPALIVE */
+    int nlaso_keepidle;       /* TCP_KEEPIDLE, secs */
+    int nlaso_keepintvl;      /* TCP_KEEPINTVL, secs */
+    int nlaso_keepcnt;        /* TCP_KEEPCNT */
+} nla_sockopt_t;
+
+
+/*
+ * gRPC channel arguments of the prpd client, NLA_INVALID leaves the gRPC
+ * default.
+ */
+typedef struct nla_grpcopt_s {
+    int nlago_max_msg_size;       /* GRPC_ARG_MAX_{SEND,RECEIVE}_MESSAGE_LENGTH */
+    int nlago_window_size;        /* GRPC_ARG_HTTP2_STREAM_LOOKAHEAD_BYTES */
+    int nlago_bdp_probe;          /* GRPC_ARG_HTTP2_BDP_PROBE, window autotuning */
+    int nlago_write_buffer_size;  /* GRPC_ARG_HTTP2_WRITE_BUFFER_SIZE */
+    int nlago_keepalive_time;     /* GRPC_ARG_KEEPALIVE_TIME_MS */
+    int nlago_keepalive_timeout;  /* GRPC_ARG_KEEPALIVE_TIMEOUT_MS */
+    int nlago_keepalive_idle;     /* GRPC_ARG_KEEPALIVE_PERMIT_WITHOUT_CALLS */
+    int nlago_idle_timeout;       /* GRPC_ARG_CLIENT_IDLE_TIMEOUT_MS */
+} nla_grpcopt_t;
+
+
 typedef struct nla_infra_vector_s {
     void  (*nlaiv_notify_cb)(nla_module_id_t, nla_event_info_t *);
-    void  (*nlaiv_get_sockaddr)(nla_module_id_t module, struct sockaddr_un *un_addr);
+    int   (*nlaiv_get_sockaddr)(nla_module_id_t module, nla_sockaddr_t *addr);
     char *(*nlaiv_get_addr_str)(nla_module_id_t);
     int   (*nlaiv_get_port)(nla_module_id_t);
+    size_t (*nlaiv_get_max_msg_len)(nla_module_id_t);
+    int   (*nlaiv_get_fpm_msg_type)(nla_module_id_t);
+    size_t (*nlaiv_get_ring_size)(nla_module_id_t);
+    bool  (*nlaiv_get_replay_cache)(nla_module_id_t);
+    const nla_sockopt_t *(*nlaiv_get_sockopt)(nla_module_id_t);
+    const nla_grpcopt_t *(*nlaiv_get_grpcopt)(nla_module_id_t);
+    int   (*nlaiv_get_compression)(nla_module_id_t);
+    int   (*nlaiv_get_max_outstanding_rpcs)(nla_module_id_t);
+    char *(*nlaiv_get_monitor_table)(nla_module_id_t, int);
+    char *(*nlaiv_get_retry_spill_file)(nla_module_id_t);
+    int   (*nlaiv_get_channels)(nla_module_id_t);
+    char *(*nlaiv_get_table_map)(nla_module_id_t, int, uint32_t *);
+    int   (*nlaiv_get_channel_shard)(nla_module_id_t);
 } nla_infra_vector_t;
 
 
@@ -105,6 +220,22 @@ typedef struct nla_module_config_s {
     bool         nlamc_enable;
     char        *nlamc_addr;
     int          nlamc_port;
+    int          nlamc_max_msg_len;
+    int          nlamc_fpm_msg_type;
+    int          nlamc_ring_size;
+    bool         nlamc_replay_cache;
+    nla_sockopt_t nlamc_sockopt;
+    nla_grpcopt_t nlamc_grpcopt;
+    int          nlamc_compression;
+    int          nlamc_max_outstanding_rpcs;
+    int          nlamc_monitor_tables;
+    char        *nlamc_monitor_table[NLA_MONITOR_TABLES_MAX];
+    char        *nlamc_retry_spill_file;
+    int          nlamc_channels;
+    int          nlamc_table_maps;
+    uint32_t     nlamc_table_map_id[NLA_TABLE_MAPS_MAX];
+    char        *nlamc_table_map[NLA_TABLE_MAPS_MAX];
+    int          nlamc_channel_shard;
     nla_policy_t nlamc_policy[NLAP_MAX];
     bool         nlamc_notify_me[NLA_MODULE_ALL];
 } nla_module_config_t;
@@ -117,6 +248,14 @@ typedef struct nla_module_s {
 } nla_module_t;
 
 
+/* Routes last sent to a peer, see nla_rtcache.c */
+typedef struct nla_rtcache_s nla_rtcache_t;
+
+
+/* Compressed NLM stream, see nla_zstream.c */
+typedef struct nla_zstream_s nla_zstream_t;
+
+
 /* A client or server connection. */
 typedef struct nla_context_s {
     struct event          *nlac_start_timer;     /* connect timer */
@@ -134,6 +273,8 @@ typedef struct nla_globals_s {
     int                nlag_trace_level;
     char              *nlag_trace_file;
     FILE              *nlag_trace_fd;
+    bool               nlag_trace_bin;   /* binary traces to nlag_trace_file */
+    char              *nlag_stats_file;
     int                nlag_version;
     bool               nlag_dont_daemonize;
 } nla_globals_t;
@@ -155,7 +296,7 @@ extern nla_module_t nla_infa_modules[];
 #define NL_MSG_HDR_LEN (sizeof(struct nlmsghdr))
 
 
-#define NLA_RTMGRP_ALL  (RTMGRP_IPV4_ROUTE  | RTMGRP_IPV6_ROUTE)
+#define NLA_RTMGRP_ALL  (RTMGRP_LINK | RTMGRP_IPV4_ROUTE  | RTMGRP_IPV6_ROUTE)
 #define NLA_RTNLGRP_ALL (RTNLGRP_IPV4_ROUTE | RTNLGRP_IPV6_ROUTE)
 
 
@@ -176,7 +317,16 @@ typedef enum nla_log_e {
     LOG_DEBUG   = 4,
 } nla_log_t;
 
-#define nla_log_enabled(trace_level) (nla_gl.nlag_trace_fd && (trace_level <= nla_gl.nlag_trace_level))
+/*
+ * Most verbose trace level built in. The nla_log() call sites above it
+ * fold to nothing, release builds set it from the Makefile.
+ */
+#ifndef NLA_MIN_LOG_LEVEL
+#define NLA_MIN_LOG_LEVEL LOG_DEBUG
+#endif
+
+#define nla_log_enabled(trace_level) ((trace_level) <= NLA_MIN_LOG_LEVEL &&\
+                                      nla_gl.nlag_trace_fd && (trace_level <= nla_gl.nlag_trace_level))
 
 #define nla_log0(trace_level, ...) nla_log_(false, trace_level, __VA_ARGS__)
 #define nla_log(trace_level,  ...) nla_log_(true,  trace_level, __VA_ARGS__)
@@ -184,11 +334,15 @@ typedef enum nla_log_e {
 #define nla_log_(more_info, trace_level, ...)\
 {\
     if (nla_log_enabled(trace_level)) {\
-        if (more_info) {\
-            fprintf(nla_gl.nlag_trace_fd, "%-50s-%3d-  ", __FUNCTION__, __LINE__);\
+        static nla_trace_fmt_t nla_trace_fmt = { __FUNCTION__, __LINE__, trace_level,\
+                                                 more_info, {0} };\
+        if (!nla_gl.nlag_trace_bin || !nla_trace(&nla_trace_fmt, __VA_ARGS__)) {\
+            if (more_info) {\
+                fprintf(nla_gl.nlag_trace_fd, "%-50s-%3d-  ", __FUNCTION__, __LINE__);\
+            }\
+            fprintf(nla_gl.nlag_trace_fd, __VA_ARGS__);\
+            fprintf(nla_gl.nlag_trace_fd, "\n");\
         }\
-        fprintf(nla_gl.nlag_trace_fd, __VA_ARGS__);\
-        fprintf(nla_gl.nlag_trace_fd, "\n");\
     }\
 }
 
@@ -197,4 +351,6 @@ typedef enum nla_log_e {
 }
 #endif
 
+#include <nla_trace.h>
+
 #endif /* _NLA_DEFS_H */
@@ -42,16 +42,65 @@ nla_module_vector_t* nla_fpm_server_get_vec();
 nla_module_vector_t* nla_fpm_client_get_vec();
 
 
+/*
+ * nla_fpm_pb.c
+ */
+const void *nla_fpm_pb_encode(const void *nlmsg, size_t *len);
+
+int nla_fpm_pb_decode(const void *data, size_t len,
+                      void (*nlmsg_cb)(const void *msg, unsigned int msg_len));
+
+
+/*
+ * nla_rtcache.c
+ */
+nla_rtcache_t *nla_rtcache_new(void);
+
+void nla_rtcache_flush(nla_rtcache_t *cache);
+
+void nla_rtcache_free(nla_rtcache_t *cache);
+
+size_t nla_rtcache_count(nla_rtcache_t *cache);
+
+void nla_rtcache_update(nla_rtcache_t *cache, const void *msg, int msg_len);
+
+void nla_rtcache_replay_start(nla_rtcache_t *cache);
+
+bool nla_rtcache_replay_pending(nla_rtcache_t *cache);
+
+int nla_rtcache_replay_next(nla_rtcache_t *cache, struct evbuffer *outevb, int max_routes);
+
+
+/*
+ * nla_zstream.c
+ */
+nla_zstream_t *nla_zstream_new(bool deflate, void (*out_cb)(const void *data, size_t len));
+
+void nla_zstream_free(nla_zstream_t *zstream);
+
+void nla_zstream_push(nla_zstream_t *zstream, const void *data, size_t len);
+
+
 /*
  * nla_grpc.cc
  */
-int RibClientInit(char *ribServerAddr);
+int RibClientInit(char *ribServerAddr, int maxOutstandingRpcs, char *retrySpillFile,
+                  int channels, bool shardByTable, const nla_grpcopt_t *grpcopt,
+                  bool compress);
 
 void RibClientReset();
 
-int RibClientAddRoute(struct rtnl_route *route);
+void RibClientTableMap(uint32_t *kernelTables, char **tables, int count);
+
+int RibClientAddRoute(struct rtnl_route *route, int from, uint64_t ingress);
+
+int RibClientRemoveRoute(struct rtnl_route *route, int from, uint64_t ingress);
 
-int RibClientRemoveRoute(struct rtnl_route *route);
+void RibClientFlush();
+
+int RibClientMonitor(char **tables, int count);
+
+int RibClientRetryDepth();
 
 
 /*
@@ -81,7 +130,7 @@ nla_module_vector_t* nla_nlm_client_get_vec();
 /*
  * nla_policy.c
  */
-nla_event_info_t* nla_policy_evaluate(int module, nla_event_info_t *in_evinfo);
+nla_event_info_t* nla_policy_evaluate(int from, int module, nla_event_info_t *in_evinfo);
 
 
 /*
@@ -90,15 +139,65 @@ nla_event_info_t* nla_policy_evaluate(int module, nla_event_info_t *in_evinfo);
 nla_module_vector_t* nla_prpdc_get_vec();
 
 
+/*
+ * nla_shm_server.c
+ */
+nla_module_vector_t* nla_shm_server_get_vec();
+
+
+/*
+ * nla_stats.c
+ */
+void nla_stats_start(const char *path);
+
+void nla_stats_stop(void);
+
+void nla_stats_module_in(nla_module_id_t module, int len);
+
+void nla_stats_module_out(nla_module_id_t module, int len);
+
+void nla_stats_write_failure(nla_module_id_t module, int count);
+
+void nla_stats_reconnect(nla_module_id_t module);
+
+void nla_stats_queue(nla_module_id_t module, uint64_t depth);
+
+void nla_stats_edge(nla_module_id_t from, nla_module_id_t to, int len);
+
+void nla_stats_edge_strip(nla_module_id_t from, nla_module_id_t to);
+
+void nla_stats_edge_drop(nla_module_id_t from, nla_module_id_t to, int reason);
+
+void nla_stats_latency(nla_module_id_t from, nla_module_id_t to, uint64_t ingress);
+
+
 /*
  * nla_util.c
  */
-fpm_msg_hdr_t* nla_build_fpm_hdr(size_t data_len);
+size_t nla_build_fpm_hdr(fpm_msg_hdr_large_t *hdr, int msg_type, size_t data_len);
+
+int nla_fpm_msg_write(struct bufferevent *bev, int msg_type,
+                      const void *msg, int msg_len, size_t max_msg_len);
+
+int nla_fpm_msg_read(struct evbuffer *inevb, size_t max_msg_len,
+                     void (*nlmsg_cb)(const void *msg, unsigned int msg_len));
 
 void nla_fpmmsg_dump(const void *msg, unsigned int msg_len);
 
 void nla_nlmsg_dump(const void *msg, unsigned int msg_len);
 
+nla_event_t nla_nlmsg_event(const void *msg);
+
+int nla_table_family(const char *table);
+
+void nla_ifname_update(const struct nlmsghdr *nlmsghdr);
+
+const char *nla_ifname(int ifindex);
+
+unsigned int nla_ifname_generation(void);
+
+void nla_ifname_flush(void);
+
 void nla_nlmsg_walk(const void *msg, int msg_len,
                     void (*nlmsg_cb)(const void *msg, unsigned int msg_len));
 
@@ -106,12 +205,35 @@ void nla_fpm_msg_walk(const void *msg, int msg_len,
                      void (*fpmmsg_cb)(const void *msg, unsigned int msg_len),
                      void (*nlmsg_cb)(const void *msg, unsigned int msg_len));
 
+void nla_nlm_hello_write(struct bufferevent *bev, int compression);
+
+bool nla_nlm_hello_parse(const void *msg, unsigned int msg_len, int *compression);
+
+int nla_nlmsg_read(struct evbuffer *inevb,
+                   void (*nlmsg_cb)(const void *msg, unsigned int msg_len));
+
+struct evconnlistener *nla_listener_new(const nla_sockaddr_t *addr,
+                                        void (*cb)(struct evconnlistener *listener,
+                                                   evutil_socket_t fd,
+                                                   struct sockaddr *sa,
+                                                   int socklen, void *arg));
+
+struct bufferevent *nla_bufferevent_new(evutil_socket_t fd,
+                                        const nla_sockaddr_t *addr,
+                                        const nla_sockopt_t *opts);
+
+void nla_bufferevent_uncork(struct bufferevent *bev, const nla_sockopt_t *opts);
+
+bool nla_bufferevent_msg_fits(struct bufferevent *bev, size_t len);
+
 const char *nla_trace_bits(const bits *bp, unsigned int bit);
 
 const char *nla_trace_state(const bits *bp, unsigned int bit);
 
 unsigned int nla_trace_bit(const bits * types, const char * name);
 
+uint64_t nla_clock_ns(void);
+
 nla_event_info_t* nla_event_info_clone(nla_event_info_t *evinfo);
 
 void nla_event_info_free(nla_event_info_t *evinfo);
@@ -106,6 +106,18 @@ extern "C" {
  */
 #define FPM_MAX_MSG_LEN 4096
 
+/*
+ * Largest message that fits in the 16-bit msg_len of a version 1 header.
+ * Bigger frames need the large header (FPM_PROTO_VERSION_LARGE).
+ */
+#define FPM_MAX_MSG_LEN_V1 0xfffc
+
+/*
+ * Largest message sent with the large header. Its msg_len is 32-bit, but
+ * the agent keeps lengths in an int.
+ */
+#define FPM_MAX_MSG_LEN_LARGE 0x7ffffffc
+
 #ifdef __SUNPRO_C
 #pragma pack(1)
 #endif
@@ -132,6 +144,35 @@ typedef struct fpm_msg_hdr_t_
   uint16_t msg_len;
 } __attribute__ ((packed)) fpm_msg_hdr_t;
 
+/*
+ * Header that precedes fpm messages too large for fpm_msg_hdr_t. The
+ * first two fields are laid out exactly as in fpm_msg_hdr_t, so a
+ * receiver can look at the version to find out which header follows.
+ */
+typedef struct fpm_msg_hdr_large_t_
+{
+  /*
+   * Protocol version, always FPM_PROTO_VERSION_LARGE.
+   */
+  uint8_t version;
+
+  /*
+   * Type of message, see below.
+   */
+  uint8_t msg_type;
+
+  /*
+   * Must be zero.
+   */
+  uint16_t reserved;
+
+  /*
+   * Length of entire message, including the header, in network byte
+   * order.
+   */
+  uint32_t msg_len;
+} __attribute__ ((packed)) fpm_msg_hdr_large_t;
+
 #ifdef __SUNPRO_C
 #pragma pack()
 #endif
@@ -141,6 +182,13 @@ typedef struct fpm_msg_hdr_t_
  */
 #define FPM_PROTO_VERSION 1
 
+/*
+ * Version 2 frames carry a fpm_msg_hdr_large_t. They are only sent when
+ * both ends are configured with a maximum message length above
+ * FPM_MAX_MSG_LEN_V1.
+ */
+#define FPM_PROTO_VERSION_LARGE 2
+
 typedef enum fpm_msg_type_e_ {
   FPM_MSG_TYPE_NONE = 0,
 
@@ -183,11 +231,31 @@ fpm_msg_align (size_t len)
  */
 #define FPM_MSG_HDR_LEN (sizeof (fpm_msg_hdr_t))
 
+/*
+ * The size of the large FPM message header.
+ */
+#define FPM_MSG_HDR_LARGE_LEN (sizeof (fpm_msg_hdr_large_t))
+
 #ifndef COMPILE_ASSERT
 #define COMPILE_ASSERT(x) extern int __dummy[2 * !!(x) - 1]
 #endif
 
 COMPILE_ASSERT(FPM_MSG_ALIGNTO == FPM_MSG_HDR_LEN);
+COMPILE_ASSERT(FPM_MSG_HDR_LARGE_LEN % FPM_MSG_ALIGNTO == 0);
+
+/*
+ * fpm_msg_hdr_len
+ *
+ * Length of the header of the given message, which depends on its version.
+ */
+static inline size_t
+fpm_msg_hdr_len (const fpm_msg_hdr_t *hdr)
+{
+  if (hdr->version == FPM_PROTO_VERSION_LARGE)
+    return FPM_MSG_HDR_LARGE_LEN;
+
+  return FPM_MSG_HDR_LEN;
+}
 
 /*
  * fpm_data_len_to_msg_len
@@ -209,15 +277,21 @@ fpm_data_len_to_msg_len (size_t data_len)
 static inline void *
 fpm_msg_data (fpm_msg_hdr_t *hdr)
 {
-  return ((char*) hdr) + FPM_MSG_HDR_LEN;
+  return ((char*) hdr) + fpm_msg_hdr_len (hdr);
 }
 
 /*
  * fpm_msg_len
+ *
+ * **NB**: For large messages the full fpm_msg_hdr_large_t must be
+ * readable at 'hdr'.
  */
 static inline size_t
 fpm_msg_len (const fpm_msg_hdr_t *hdr)
 {
+  if (hdr->version == FPM_PROTO_VERSION_LARGE)
+    return ntohl (((const fpm_msg_hdr_large_t *) hdr)->msg_len);
+
   return ntohs (hdr->msg_len);
 }
 
@@ -227,7 +301,7 @@ fpm_msg_len (const fpm_msg_hdr_t *hdr)
 static inline size_t
 fpm_msg_data_len (const fpm_msg_hdr_t *hdr)
 {
-  return (fpm_msg_len (hdr) - FPM_MSG_HDR_LEN);
+  return (fpm_msg_len (hdr) - fpm_msg_hdr_len (hdr));
 }
 
 /*
@@ -255,21 +329,26 @@ fpm_msg_next (fpm_msg_hdr_t *hdr, size_t *len)
 }
 
 /*
- * fpm_msg_hdr_ok
+ * fpm_msg_hdr_max_ok
  *
- * Returns TRUE if a message header looks well-formed.
+ * Returns TRUE if a message header looks well-formed and the message is
+ * not longer than 'max_msg_len'.
  */
 static inline int
-fpm_msg_hdr_ok (const fpm_msg_hdr_t *hdr)
+fpm_msg_hdr_max_ok (const fpm_msg_hdr_t *hdr, size_t max_msg_len)
 {
   size_t msg_len;
 
   if (hdr->msg_type == FPM_MSG_TYPE_NONE)
     return 0;
 
+  if (hdr->version != FPM_PROTO_VERSION &&
+      hdr->version != FPM_PROTO_VERSION_LARGE)
+    return 0;
+
   msg_len = fpm_msg_len (hdr);
 
-  if (msg_len < FPM_MSG_HDR_LEN || msg_len > FPM_MAX_MSG_LEN)
+  if (msg_len < fpm_msg_hdr_len (hdr) || msg_len > max_msg_len)
     return 0;
 
   /*
@@ -282,6 +361,40 @@ fpm_msg_hdr_ok (const fpm_msg_hdr_t *hdr)
   return 1;
 }
 
+/*
+ * fpm_msg_hdr_ok
+ *
+ * Returns TRUE if a message header looks well-formed.
+ */
+static inline int
+fpm_msg_hdr_ok (const fpm_msg_hdr_t *hdr)
+{
+  return fpm_msg_hdr_max_ok (hdr, FPM_MAX_MSG_LEN);
+}
+
+/*
+ * fpm_msg_max_ok
+ *
+ * Returns TRUE if a message looks well-formed and is not longer than
+ * 'max_msg_len'.
+ *
+ * @param len The length in bytes from 'hdr' to the end of the buffer.
+ */
+static inline int
+fpm_msg_max_ok (const fpm_msg_hdr_t *hdr, size_t len, size_t max_msg_len)
+{
+  if (len < FPM_MSG_HDR_LEN || len < fpm_msg_hdr_len (hdr))
+    return 0;
+
+  if (!fpm_msg_hdr_max_ok (hdr, max_msg_len))
+    return 0;
+
+  if (fpm_msg_len (hdr) > len)
+    return 0;
+
+  return 1;
+}
+
 /*
  * fpm_msg_ok
  *
@@ -292,7 +405,7 @@ fpm_msg_hdr_ok (const fpm_msg_hdr_t *hdr)
 static inline int
 fpm_msg_ok (const fpm_msg_hdr_t *hdr, size_t len)
 {
-  if (len < FPM_MSG_HDR_LEN)
+  if (len < FPM_MSG_HDR_LEN || len < fpm_msg_hdr_len (hdr))
     return 0;
 
   if (!fpm_msg_hdr_ok (hdr))
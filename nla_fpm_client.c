@@ -55,6 +55,25 @@
 nla_context_t   nla_fpm_client_ctx;
 nla_module_vector_t    nla_fpm_client_vector;
 
+
+/* Routes replayed per run of the replay event */
+#define NLA_RTCACHE_REPLAY_CHUNK  256
+
+/* Replay pauses while more than this is queued to the fpm server */
+#define NLA_RTCACHE_REPLAY_HIWAT  (1 << 20)
+
+
+/*
+ * With replay-cache, the last msg sent for every route is kept, so that
+ * a reconnect to the fpm server is served from the cache, instead of
+ * restarting all the modules to get a fresh dump from the kernel.
+ */
+static nla_rtcache_t *nla_fpm_client_rtcache;
+static struct event  *nla_fpm_client_replay_ev;
+static bool           nla_fpm_client_connected;
+static bool           nla_fpm_client_was_up;
+
+
 static void nla_fpm_client_server_connect_timer_start ();
 
 
@@ -66,6 +85,7 @@ nla_fpm_client_trigger_event (nla_event_t event, const void *msg, unsigned int m
     evinfo.nlaei_type = event;
     evinfo.nlaei_msglen = msglen;
     evinfo.nlaei_msg = msg;
+    evinfo.nlaei_time = msg ? nla_clock_ns() : 0;
 
     nla_log(LOG_INFO, "from %s trigger event %s ", MODULE(NLA_FPM_CLIENT), EVENT(event));
     nla_log(LOG_INFO, "msg %p, len %d", msg, msglen);
@@ -76,59 +96,154 @@ nla_fpm_client_trigger_event (nla_event_t event, const void *msg, unsigned int m
 static void
 nla_fpm_client_trigger_write (const void *msg, unsigned int msg_len)
 {
-    nla_fpm_client_trigger_event(NLA_WRITE, msg, msg_len);
+    nla_fpm_client_trigger_event(nla_nlmsg_event(msg), msg, msg_len);
+}
+
+
+/*
+ * @return -1 if the write failed, 0 otherwise.
+ */
+static int
+nla_fpm_client_write (const void *msg, int msg_len)
+{
+    int dropped;
+
+    dropped = nla_fpm_msg_write(nla_fpm_client_ctx.nlac_bev,
+                                nla_fpm_client_ctx.nlac_infravec->nlaiv_get_fpm_msg_type(NLA_FPM_CLIENT),
+                                msg,
+                                msg_len,
+                                nla_fpm_client_ctx.nlac_infravec->nlaiv_get_max_msg_len(NLA_FPM_CLIENT));
+    if (dropped < 0) {
+        nla_log(LOG_WARN, "bufferevent_write_buffer failed");
+        nla_stats_write_failure(NLA_FPM_CLIENT, 1);
+        return -1;
+    }
+
+    if (dropped > 0) {
+        nla_log(LOG_WARN, "%d oversized msgs not sent to fpm server", dropped);
+        nla_stats_write_failure(NLA_FPM_CLIENT, dropped);
+    }
+
+    nla_stats_module_out(NLA_FPM_CLIENT, msg_len);
+    nla_stats_queue(NLA_FPM_CLIENT,
+                    evbuffer_get_length(bufferevent_get_output(nla_fpm_client_ctx.nlac_bev)));
+
+    return 0;
 }
 
 
 static void
-nla_fpm_client_write_cb (struct bufferevent *bev UNUSED, void *ctx UNUSED)
+nla_fpm_client_replay_schedule (void)
 {
-    nla_log(LOG_INFO, "sent msg");
+    struct timeval now = {0,0};
+
+    if (nla_fpm_client_replay_ev &&
+        !evtimer_pending(nla_fpm_client_replay_ev, NULL)) {
+        evtimer_add(nla_fpm_client_replay_ev, &now);
+    }
 }
 
 
+/*
+ * Replay the next chunk of cached routes, and yield to the event loop so
+ * that live updates are sent in between. The replay ends with an end of
+ * dump marker, like a kernel dump.
+ */
 static void
-nla_fpm_client_read_cb (struct bufferevent *bev, void *ctx UNUSED)
+nla_fpm_client_replay (evutil_socket_t fd UNUSED, short what UNUSED, void *arg UNUSED)
 {
-    struct evbuffer *inevb;
-    fpm_msg_hdr_t fpm_msg_hdr;
-    uint8_t data[8192];
-    size_t n;
-
-    for (;;) {
-        /* Read one fpm message at a time. */
-        inevb = bufferevent_get_input(bev);
-        n = evbuffer_get_length(inevb);
-        if (n <= 0) {
-            /* Done. */
-            break;
-        }
+    struct evbuffer *evb;
+    struct nlmsghdr done;
+    int n;
 
-        if (n < FPM_MSG_HDR_LEN) {
-            nla_log(LOG_INFO, "[read bytes %zu] We should never come here", n);
-            break;
-        }
+    if (!nla_fpm_client_connected ||
+        !nla_rtcache_replay_pending(nla_fpm_client_rtcache)) {
+        return;
+    }
 
-        /* Take a look at the fpm header to find out the msg length */
-        evbuffer_copyout(inevb, &fpm_msg_hdr, FPM_MSG_HDR_LEN);
+    if (evbuffer_get_length(bufferevent_get_output(nla_fpm_client_ctx.nlac_bev)) >
+        NLA_RTCACHE_REPLAY_HIWAT) {
+        /* resumed from nla_fpm_client_write_cb */
+        return;
+    }
 
-        if (!fpm_msg_hdr_ok(&fpm_msg_hdr)) {
-            nla_log(LOG_INFO, "fpm_msg_hdr_ok check failed");
-            assert(false);
-        }
+    evb = evbuffer_new();
+    if (!evb) {
+        nla_fpm_client_replay_schedule();
+        return;
+    }
 
-        if (n < fpm_msg_len(&fpm_msg_hdr)) {
-            nla_log(LOG_INFO, "[read bytes %zu, fpm msg len %zu] Not enough data to proceed",
-                    n, fpm_msg_len(&fpm_msg_hdr));
-            break;
-        }
+    n = nla_rtcache_replay_next(nla_fpm_client_rtcache, evb, NLA_RTCACHE_REPLAY_CHUNK);
+    if (n) {
+        nla_log(LOG_INFO, "replay %d routes to fpm server", n);
+        nla_fpm_client_write(evbuffer_pullup(evb, -1), evbuffer_get_length(evb));
+    }
+    evbuffer_free(evb);
 
-        n = bufferevent_read(bev, data, fpm_msg_len(&fpm_msg_hdr));
+    if (nla_rtcache_replay_pending(nla_fpm_client_rtcache)) {
+        nla_fpm_client_replay_schedule();
+        return;
+    }
 
-        nla_log(LOG_INFO, "read bytes, msg %p len %zu", data, n);
+    nla_log(LOG_NOTICE, "replayed %zu routes to fpm server",
+            nla_rtcache_count(nla_fpm_client_rtcache));
 
-        nla_fpm_msg_walk(data, n, nla_fpmmsg_dump, nla_nlmsg_dump);
-        nla_fpm_msg_walk(data, n, NULL, nla_fpm_client_trigger_write);
+    memset(&done, 0, sizeof(done));
+    done.nlmsg_len = NLMSG_HDRLEN;
+    done.nlmsg_type = NLMSG_DONE;
+    nla_fpm_client_write(&done, done.nlmsg_len);
+}
+
+
+static void
+nla_fpm_client_write_cb (struct bufferevent *bev, void *ctx UNUSED)
+{
+    nla_log(LOG_INFO, "sent msg");
+
+    nla_bufferevent_uncork(bev, nla_fpm_client_ctx.nlac_infravec->nlaiv_get_sockopt(NLA_FPM_CLIENT));
+
+    nla_stats_queue(NLA_FPM_CLIENT, evbuffer_get_length(bufferevent_get_output(bev)));
+
+    if (nla_fpm_client_rtcache &&
+        nla_rtcache_replay_pending(nla_fpm_client_rtcache)) {
+        nla_fpm_client_replay_schedule();
+    }
+}
+
+
+/*
+ * Close the connection to the fpm server. Once the module has been up,
+ * the replay cache lets us reconnect on our own; otherwise all the modules
+ * are restarted.
+ */
+static void
+nla_fpm_client_connection_down (void)
+{
+    nla_fpm_client_connected = false;
+
+    if (nla_fpm_client_rtcache && nla_fpm_client_was_up) {
+        nla_log(LOG_NOTICE, "fpm server connection lost, %zu routes cached for replay",
+                nla_rtcache_count(nla_fpm_client_rtcache));
+        nla_stats_reconnect(NLA_FPM_CLIENT);
+    } else {
+        nla_fpm_client_trigger_event(NLA_CONNECTION_DOWN, NULL, 0);
+    }
+
+    nla_fpm_client_server_connect_timer_start();
+}
+
+
+static void
+nla_fpm_client_read_cb (struct bufferevent *bev, void *ctx UNUSED)
+{
+    size_t max_msg_len;
+
+    max_msg_len = nla_fpm_client_ctx.nlac_infravec->nlaiv_get_max_msg_len(NLA_FPM_CLIENT);
+
+    if (nla_fpm_msg_read(bufferevent_get_input(bev), max_msg_len,
+                         nla_fpm_client_trigger_write) < 0) {
+        nla_log(LOG_WARN, "malformed msg from fpm server, reset the connection");
+        nla_fpm_client_connection_down();
     }
 }
 
@@ -144,6 +259,16 @@ nla_fpm_client_event_cb (struct bufferevent *bev, short what, void *ctx UNUSED)
         /* We are good */
         nla_log(LOG_INFO, "[event 0x%x] connection with fpm server established", what);
         bufferevent_enable(bev, EV_READ | EV_WRITE);
+        nla_fpm_client_connected = true;
+
+        if (nla_fpm_client_rtcache && nla_fpm_client_was_up) {
+            /* Still up for the other modules, replay what they sent us */
+            nla_rtcache_replay_start(nla_fpm_client_rtcache);
+            nla_fpm_client_replay_schedule();
+            return;
+        }
+
+        nla_fpm_client_was_up = true;
         nla_fpm_client_trigger_event(NLA_CONNECTION_UP, NULL, 0);
     } else {
         if (what & BEV_EVENT_EOF) {
@@ -156,9 +281,8 @@ nla_fpm_client_event_cb (struct bufferevent *bev, short what, void *ctx UNUSED)
             return;
         }
 
-        nla_fpm_client_trigger_event(NLA_CONNECTION_DOWN, NULL, 0);
         nla_log(LOG_INFO, "[event 0x%x] retry connection", what);
-        nla_fpm_client_server_connect_timer_start();
+        nla_fpm_client_connection_down();
     }
 }
 
@@ -168,15 +292,16 @@ nla_fpm_client_server_connect (evutil_socket_t fd UNUSED,
                                short what UNUSED,
                                void *arg UNUSED)
 {
-    struct sockaddr_un addr;
+    nla_sockaddr_t addr;
 
     nla_log(LOG_INFO, " ");
 
-    nla_fpm_client_ctx.nlac_infravec->nlaiv_get_sockaddr(NLA_FPM_CLIENT, &addr);
+    if (nla_fpm_client_ctx.nlac_infravec->nlaiv_get_sockaddr(NLA_FPM_CLIENT, &addr) < 0) {
+        goto retry;
+    }
 
-    nla_fpm_client_ctx.nlac_bev = bufferevent_socket_new(nla_gl.nlag_base,
-                                                         -1,
-                                                         BEV_OPT_CLOSE_ON_FREE);
+    nla_fpm_client_ctx.nlac_bev = nla_bufferevent_new(-1, &addr,
+                                                      nla_fpm_client_ctx.nlac_infravec->nlaiv_get_sockopt(NLA_FPM_CLIENT));
     if (!nla_fpm_client_ctx.nlac_bev) {
         nla_log(LOG_INFO, "bufferevent_socket_new failure");
         goto retry;
@@ -188,9 +313,12 @@ nla_fpm_client_server_connect (evutil_socket_t fd UNUSED,
                       nla_fpm_client_event_cb, NULL);
 
     if (bufferevent_socket_connect(nla_fpm_client_ctx.nlac_bev,
-                                  (struct sockaddr *)&addr,
-                                   sizeof(addr)) < 0) {
+                                   (struct sockaddr *)&addr.nlasa_addr,
+                                   addr.nlasa_len) < 0) {
         nla_log(LOG_INFO, "bufferevent_socket_connect failure");
+        /* e.g. the unix socket path doesn't exist yet */
+        bufferevent_free(nla_fpm_client_ctx.nlac_bev);
+        nla_fpm_client_ctx.nlac_bev = NULL;
         goto retry;
     }
 
@@ -202,11 +330,30 @@ retry:
 }
 
 
+static void
+nla_fpm_client_connection_cleanup (void)
+{
+    nla_fpm_client_connected = false;
+
+    if (nla_fpm_client_replay_ev) {
+        event_free(nla_fpm_client_replay_ev);
+        nla_fpm_client_replay_ev = NULL;
+    }
+
+    nla_context_cleanup(&nla_fpm_client_ctx);
+}
+
+
 static void
 nla_fpm_client_reset (void)
 {
     nla_log(LOG_INFO, " ");
-    nla_context_cleanup(&nla_fpm_client_ctx);
+
+    nla_fpm_client_connection_cleanup();
+
+    nla_rtcache_free(nla_fpm_client_rtcache);
+    nla_fpm_client_rtcache = NULL;
+    nla_fpm_client_was_up = false;
 }
 
 
@@ -217,14 +364,20 @@ nla_fpm_client_server_connect_timer_start ()
 
     nla_log(LOG_INFO, " ");
 
-    /* Always start from fresh */
-    nla_fpm_client_reset();
+    /* Always start from a fresh connection, the route cache is kept */
+    nla_fpm_client_connection_cleanup();
 
     if (!nla_gl.nlag_base) {
         nla_log(LOG_INFO, "nla_fpm_client_server_connect_timer_start failure");
         return;
     }
 
+    if (nla_fpm_client_rtcache) {
+        nla_fpm_client_replay_ev = evtimer_new(nla_gl.nlag_base,
+                                               nla_fpm_client_replay,
+                                               NULL);
+    }
+
     /* Create a dispatcher event */
     assert(!nla_fpm_client_ctx.nlac_start_timer);
     nla_fpm_client_ctx.nlac_start_timer = evtimer_new(nla_gl.nlag_base,
@@ -242,6 +395,13 @@ nla_fpm_client_init ()
 
     nla_fpm_client_ctx.nlac_infravec = nla_infra_get_vec();
 
+    if (nla_fpm_client_ctx.nlac_infravec->nlaiv_get_replay_cache(NLA_FPM_CLIENT)) {
+        nla_fpm_client_rtcache = nla_rtcache_new();
+        if (!nla_fpm_client_rtcache) {
+            nla_log(LOG_WARN, "failed to allocate the route cache, replay disabled");
+        }
+    }
+
     nla_fpm_client_server_connect_timer_start();
 }
 
@@ -254,32 +414,28 @@ nla_fpm_client_init_flash (void)
 
 
 static void
-nla_fpm_client_notify (nla_module_id_t from UNUSED, nla_event_info_t *evinfo)
+nla_fpm_client_notify (nla_module_id_t from, nla_event_info_t *evinfo)
 {
-    struct evbuffer *outevb;
-
     switch(evinfo->nlaei_type) {
     case NLA_WRITE:
-        outevb = evbuffer_new();
-
+    case NLA_END_OF_DUMP:
         nla_log(LOG_INFO, "%s : write to fpm server, msg %p len %d",
                 EVENT(evinfo->nlaei_type), evinfo->nlaei_msg, evinfo->nlaei_msglen);
 
-        evbuffer_add(outevb, nla_build_fpm_hdr(evinfo->nlaei_msglen), FPM_MSG_HDR_LEN);
-
-        evbuffer_add(outevb, evinfo->nlaei_msg, evinfo->nlaei_msglen);
-
-        if (bufferevent_write_buffer(nla_fpm_client_ctx.nlac_bev, outevb) < 0) {
-            nla_log(LOG_INFO, "bufferevent_write_buffer failed");
-            /*
-             * If we hit this core, we might need to create evbuffer queue
-             * which gets processed in the background.
-             */
-            assert(false);
+        if (nla_fpm_client_rtcache) {
+            nla_rtcache_update(nla_fpm_client_rtcache, evinfo->nlaei_msg,
+                               evinfo->nlaei_msglen);
         }
 
-        evbuffer_free(outevb);
+        if (!nla_fpm_client_connected) {
+            /* Sent by the replay once reconnected */
+            nla_log(LOG_INFO, "fpm server not connected, msg cached");
+            break;
+        }
 
+        if (nla_fpm_client_write(evinfo->nlaei_msg, evinfo->nlaei_msglen) == 0) {
+            nla_stats_latency(from, NLA_FPM_CLIENT, evinfo->nlaei_time);
+        }
         break;
 
     default:
@@ -0,0 +1,318 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * shivakumar channalli
+ *
+ * This SOFTWARE is licensed to you under the Apache License 2.0 .
+ * You may not use this code except in compliance with the License.
+ * This code is not an official Juniper product.
+ * You can obtain a copy of the License at http://spdx.org/licenses/Apache-2.0.html
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/*
+ * Translation between netlink route messages and the fpm.Message protobuf
+ * carried by FPM_MSG_TYPE_PROTOBUF fpm messages.
+ */
+
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+
+#include <google/protobuf/arena.h>
+#include "fpm.pb.h"
+
+/* Libevent. */
+#include <event.h>
+
+/* Netlink */
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <netlink/netlink.h>
+#include <netlink/msg.h>
+#include <netlink/addr.h>
+#include <netlink/route/route.h>
+#include <netlink/route/nexthop.h>
+
+/* nla header files. */
+#include <nla_fpm.h>
+#include <nla_defs.h>
+#include <nla_externs.h>
+
+
+#define NLA_FPM_PB_ARENA_BLOCK 8192
+
+
+/*
+ * All the messages are built on one arena which is reset once the message
+ * has been translated, so the blocks are recycled between messages.
+ */
+static char                       nla_fpm_pb_arena_block[NLA_FPM_PB_ARENA_BLOCK];
+static google::protobuf::Arena   *nla_fpm_pb_arena;
+static std::vector<unsigned char> nla_fpm_pb_buf;
+
+
+static google::protobuf::Arena *
+nla_fpm_pb_get_arena (void)
+{
+    google::protobuf::ArenaOptions options;
+
+    if (!nla_fpm_pb_arena) {
+        options.initial_block = nla_fpm_pb_arena_block;
+        options.initial_block_size = sizeof(nla_fpm_pb_arena_block);
+        nla_fpm_pb_arena = new google::protobuf::Arena(options);
+    }
+
+    return nla_fpm_pb_arena;
+}
+
+
+static void
+nla_fpm_pb_set_prefix (fpm::Prefix *prefix, struct nl_addr *addr)
+{
+    prefix->set_length(nl_addr_get_prefixlen(addr));
+    prefix->set_bytes(nl_addr_get_binary_addr(addr), nl_addr_get_len(addr));
+}
+
+
+static void
+nla_fpm_pb_add_nexthop (struct rtnl_nexthop *rtnh, void *arg)
+{
+    fpm::AddRoute *add = (fpm::AddRoute *)arg;
+    fpm::Nexthop *nh;
+    struct nl_addr *gw;
+
+    nh = add->add_nexthops();
+    nh->set_if_index(rtnl_route_nh_get_ifindex(rtnh));
+    nh->set_weight(rtnl_route_nh_get_weight(rtnh));
+
+    gw = rtnl_route_nh_get_gateway(rtnh);
+    if (gw) {
+        nh->set_address(nl_addr_get_binary_addr(gw), nl_addr_get_len(gw));
+    }
+}
+
+
+/*
+ * Translate the netlink route message nlmsg into a serialized fpm.Message.
+ *
+ * @return the serialized message, valid until the next call, or NULL if
+ *         nlmsg isn't a route add/delete or an end of dump marker. Its
+ *         length is returned in len.
+ */
+const void *
+nla_fpm_pb_encode (const void *nlmsg, size_t *len)
+{
+    struct nlmsghdr *nlmsghdr = (struct nlmsghdr *)nlmsg;
+    struct rtnl_route *route = NULL;
+    fpm::Message *msg;
+    fpm::AddRoute *add;
+    fpm::DeleteRoute *del;
+    const void *data = NULL;
+    int err;
+
+    if (nlmsghdr->nlmsg_type != RTM_NEWROUTE &&
+        nlmsghdr->nlmsg_type != RTM_DELROUTE &&
+        nlmsghdr->nlmsg_type != NLMSG_DONE) {
+        return NULL;
+    }
+
+    if (nlmsghdr->nlmsg_type != NLMSG_DONE) {
+        err = rtnl_route_parse(nlmsghdr, &route);
+        if (err < 0) {
+            nla_log(LOG_INFO, "rtnl_route_parse error: %s", nl_geterror(err));
+            return NULL;
+        }
+    }
+
+    msg = google::protobuf::Arena::CreateMessage<fpm::Message>(nla_fpm_pb_get_arena());
+
+    if (nlmsghdr->nlmsg_type == NLMSG_DONE) {
+        msg->set_type(fpm::Message::END_OF_RIB);
+    } else if (nlmsghdr->nlmsg_type == RTM_NEWROUTE) {
+        msg->set_type(fpm::Message::ADD_ROUTE);
+        add = msg->mutable_add_route();
+        add->set_table_id(rtnl_route_get_table(route));
+        add->set_address_family(rtnl_route_get_family(route));
+        nla_fpm_pb_set_prefix(add->mutable_key(), rtnl_route_get_dst(route));
+        add->set_protocol(rtnl_route_get_protocol(route));
+        add->set_route_type(rtnl_route_get_type(route));
+        add->set_scope(rtnl_route_get_scope(route));
+        add->set_metric(rtnl_route_get_priority(route));
+        rtnl_route_foreach_nexthop(route, nla_fpm_pb_add_nexthop, add);
+    } else {
+        msg->set_type(fpm::Message::DELETE_ROUTE);
+        del = msg->mutable_delete_route();
+        del->set_table_id(rtnl_route_get_table(route));
+        del->set_address_family(rtnl_route_get_family(route));
+        nla_fpm_pb_set_prefix(del->mutable_key(), rtnl_route_get_dst(route));
+        del->set_metric(rtnl_route_get_priority(route));
+    }
+
+    *len = msg->ByteSizeLong();
+    if (nla_fpm_pb_buf.size() < *len) {
+        nla_fpm_pb_buf.resize(*len);
+    }
+
+    if (msg->SerializeWithCachedSizesToArray(nla_fpm_pb_buf.data())) {
+        data = nla_fpm_pb_buf.data();
+    }
+
+    nla_fpm_pb_arena->Reset();
+    if (route) {
+        rtnl_route_put(route);
+    }
+
+    return data;
+}
+
+
+static struct nl_addr *
+nla_fpm_pb_build_addr (int family, const std::string &bytes, int prefixlen)
+{
+    struct nl_addr *addr;
+
+    addr = nl_addr_build(family, bytes.data(), bytes.size());
+    if (addr && prefixlen >= 0) {
+        nl_addr_set_prefixlen(addr, prefixlen);
+    }
+
+    return addr;
+}
+
+
+static struct rtnl_route *
+nla_fpm_pb_build_route (uint32_t table, uint32_t family,
+                        const fpm::Prefix &key, uint32_t metric)
+{
+    struct rtnl_route *route;
+    struct nl_addr *dst;
+
+    dst = nla_fpm_pb_build_addr(family, key.bytes(), key.length());
+    if (!dst) {
+        return NULL;
+    }
+
+    route = rtnl_route_alloc();
+    rtnl_route_set_table(route, table);
+    rtnl_route_set_family(route, family);
+    rtnl_route_set_dst(route, dst);
+    rtnl_route_set_priority(route, metric);
+    nl_addr_put(dst);
+
+    return route;
+}
+
+
+/*
+ * Translate the serialized fpm.Message in data into a netlink route message
+ * and hand it over to nlmsg_cb.
+ *
+ * @return -1 if data can't be parsed, 0 otherwise.
+ */
+int
+nla_fpm_pb_decode (const void *data, size_t len,
+                   void (*nlmsg_cb)(const void *msg, unsigned int msg_len))
+{
+    struct rtnl_route *route = NULL;
+    struct rtnl_nexthop *rtnh;
+    struct nl_addr *gw;
+    struct nl_msg *nl_msg = NULL;
+    struct nlmsghdr done;
+    fpm::Message *msg;
+    int err = 0;
+    int i;
+
+    msg = google::protobuf::Arena::CreateMessage<fpm::Message>(nla_fpm_pb_get_arena());
+    if (!msg->ParseFromArray(data, len)) {
+        nla_log(LOG_WARN, "fpm protobuf parse failed, len %zu", len);
+        nla_fpm_pb_arena->Reset();
+        return -1;
+    }
+
+    switch (msg->type()) {
+    case fpm::Message::ADD_ROUTE: {
+        const fpm::AddRoute &add = msg->add_route();
+
+        route = nla_fpm_pb_build_route(add.table_id(), add.address_family(),
+                                       add.key(), add.metric());
+        if (!route) {
+            break;
+        }
+
+        rtnl_route_set_protocol(route, add.protocol());
+        rtnl_route_set_type(route, add.route_type());
+        rtnl_route_set_scope(route, add.scope());
+
+        for (i = 0; i < add.nexthops_size(); i++) {
+            const fpm::Nexthop &nh = add.nexthops(i);
+
+            rtnh = rtnl_route_nh_alloc();
+            rtnl_route_nh_set_ifindex(rtnh, nh.if_index());
+            rtnl_route_nh_set_weight(rtnh, nh.weight());
+            if (!nh.address().empty()) {
+                gw = nla_fpm_pb_build_addr(add.address_family(), nh.address(), -1);
+                if (gw) {
+                    rtnl_route_nh_set_gateway(rtnh, gw);
+                    nl_addr_put(gw);
+                }
+            }
+            rtnl_route_add_nexthop(route, rtnh);
+        }
+
+        err = rtnl_route_build_add_request(route, NLM_F_CREATE | NLM_F_REPLACE, &nl_msg);
+        break;
+    }
+
+    case fpm::Message::DELETE_ROUTE: {
+        const fpm::DeleteRoute &del = msg->delete_route();
+
+        route = nla_fpm_pb_build_route(del.table_id(), del.address_family(),
+                                       del.key(), del.metric());
+        if (!route) {
+            break;
+        }
+
+        err = rtnl_route_build_del_request(route, 0, &nl_msg);
+        break;
+    }
+
+    case fpm::Message::END_OF_RIB:
+        memset(&done, 0, sizeof(done));
+        done.nlmsg_len = NLMSG_HDRLEN;
+        done.nlmsg_type = NLMSG_DONE;
+        if (nlmsg_cb) {
+            nlmsg_cb(&done, done.nlmsg_len);
+        }
+        break;
+
+    default:
+        nla_log(LOG_INFO, "fpm protobuf msg type %d ignored", msg->type());
+        break;
+    }
+
+    nla_fpm_pb_arena->Reset();
+
+    if (route) {
+        rtnl_route_put(route);
+    }
+
+    if (err < 0) {
+        nla_log(LOG_WARN, "failed to build route request: %s", nl_geterror(err));
+        return 0;
+    }
+
+    if (nl_msg) {
+        if (nlmsg_cb) {
+            nlmsg_cb(nlmsg_hdr(nl_msg), nlmsg_hdr(nl_msg)->nlmsg_len);
+        }
+        nlmsg_free(nl_msg);
+    }
+
+    return 0;
+}
@@ -68,6 +68,7 @@ nla_fpm_server_trigger_event (nla_event_t event, const void *msg, unsigned int m
     evinfo.nlaei_type = event;
     evinfo.nlaei_msglen  = msglen;
     evinfo.nlaei_msg = msg;
+    evinfo.nlaei_time = msg ? nla_clock_ns() : 0;
 
     nla_log(LOG_INFO, "from %s trigger event %s ", MODULE(NLA_FPM_SERVER), EVENT(event));
     nla_log(LOG_INFO, "msg %p, len %d", msg, msglen);
@@ -78,59 +79,33 @@ nla_fpm_server_trigger_event (nla_event_t event, const void *msg, unsigned int m
 static void
 nla_fpm_server_trigger_write (const void *msg, unsigned int msg_len)
 {
-    nla_fpm_server_trigger_event(NLA_WRITE, msg, msg_len);
+    nla_fpm_server_trigger_event(nla_nlmsg_event(msg), msg, msg_len);
 }
 
 
 static void
-nla_fpm_server_write_cb (struct bufferevent *bev UNUSED, void *ctx UNUSED)
+nla_fpm_server_write_cb (struct bufferevent *bev, void *ctx UNUSED)
 {
     nla_log(LOG_INFO, "sent msg");
+
+    nla_bufferevent_uncork(bev, nla_fpm_server_ctx.nlac_infravec->nlaiv_get_sockopt(NLA_FPM_SERVER));
+
+    nla_stats_queue(NLA_FPM_SERVER, evbuffer_get_length(bufferevent_get_output(bev)));
 }
 
 
 static void
 nla_fpm_server_read_cb (struct bufferevent *bev, void *ctx UNUSED)
 {
-    struct evbuffer *inevb;
-    fpm_msg_hdr_t fpm_msg_hdr;
-    uint8_t data[8192];
-    size_t n;
-
-    for (;;) {
-        /* Read one fpm message at a time. */
-        inevb = bufferevent_get_input(bev);
-        n = evbuffer_get_length(inevb);
-        if (n <= 0) {
-            /* Done. */
-            break;
-        }
-
-        if (n < FPM_MSG_HDR_LEN) {
-            nla_log(LOG_INFO, "[read bytes %zu] We should never come here", n);
-            break;
-        }
-
-        /* Take a look at the fpm header to find out the msg length */
-        evbuffer_copyout(inevb, &fpm_msg_hdr, FPM_MSG_HDR_LEN);
-
-        if (!fpm_msg_hdr_ok(&fpm_msg_hdr)) {
-            nla_log(LOG_INFO, "fpm_msg_hdr_ok check failed");
-            assert(false);
-        }
+    size_t max_msg_len;
 
-        if (n < fpm_msg_len(&fpm_msg_hdr)) {
-            nla_log(LOG_INFO, "[read bytes %zu, fpm msg len %zu] Not enough data to proceed",
-                    n, fpm_msg_len(&fpm_msg_hdr));
-            break;
-        }
-
-        n = bufferevent_read(bev, data, fpm_msg_len(&fpm_msg_hdr));
+    max_msg_len = nla_fpm_server_ctx.nlac_infravec->nlaiv_get_max_msg_len(NLA_FPM_SERVER);
 
-        nla_log(LOG_INFO, "read bytes, msg %p len %zu", data, n);
-
-        nla_fpm_msg_walk(data, n, nla_fpmmsg_dump, nla_nlmsg_dump);
-        nla_fpm_msg_walk(data, n, NULL, nla_fpm_server_trigger_write);
+    if (nla_fpm_msg_read(bufferevent_get_input(bev), max_msg_len,
+                         nla_fpm_server_trigger_write) < 0) {
+        nla_log(LOG_WARN, "malformed msg from fpm client, reset the connection");
+        nla_fpm_server_trigger_event(NLA_CONNECTION_DOWN, NULL, 0);
+        nla_fpm_server_listener_timer_start();
     }
 }
 
@@ -171,9 +146,8 @@ nla_fpm_server_accept_connections (struct evconnlistener *listener UNUSED,
         return;
     }
 
-    nla_fpm_server_ctx.nlac_bev = bufferevent_socket_new(nla_gl.nlag_base,
-                                                         fd,
-                                                         BEV_OPT_CLOSE_ON_FREE);
+    nla_fpm_server_ctx.nlac_bev = nla_bufferevent_new(fd, NULL,
+                                                      nla_fpm_server_ctx.nlac_infravec->nlaiv_get_sockopt(NLA_FPM_SERVER));
     if (!nla_fpm_server_ctx.nlac_bev) {
         nla_log(LOG_INFO, "bufferevent_socket_new failure");
         return;
@@ -209,19 +183,16 @@ nla_fpm_server_listener (evutil_socket_t fd UNUSED,
                      short what UNUSED,
                      void *arg UNUSED)
 {
-    struct sockaddr_un addr;
+    nla_sockaddr_t addr;
 
     nla_log(LOG_INFO, " ");
 
-    nla_fpm_server_ctx.nlac_infravec->nlaiv_get_sockaddr(NLA_FPM_SERVER, &addr);
+    if (nla_fpm_server_ctx.nlac_infravec->nlaiv_get_sockaddr(NLA_FPM_SERVER, &addr) < 0) {
+        return;
+    }
 
-    nla_fpm_server_ctx.nlac_listener = evconnlistener_new_bind(nla_gl.nlag_base,
-                                           nla_fpm_server_accept_connections,
-                                           NULL,
-                                           LEV_OPT_REUSEABLE|LEV_OPT_CLOSE_ON_FREE,
-                                           -1,
-                                           (struct sockaddr*)&addr,
-                                           sizeof(addr));
+    nla_fpm_server_ctx.nlac_listener = nla_listener_new(&addr,
+                                           nla_fpm_server_accept_connections);
 
     if (!nla_fpm_server_ctx.nlac_listener) {
         nla_log(LOG_INFO, "failed to create a listener!\n");
@@ -285,31 +256,36 @@ nla_fpm_server_init_flash (void)
 
 
 static void
-nla_fpm_server_notify (nla_module_id_t from UNUSED, nla_event_info_t *evinfo)
+nla_fpm_server_notify (nla_module_id_t from, nla_event_info_t *evinfo)
 {
-    struct evbuffer *outevb;
+    int dropped;
 
     switch(evinfo->nlaei_type) {
     case NLA_WRITE:
-        outevb = evbuffer_new();
-
+    case NLA_END_OF_DUMP:
         nla_log(LOG_INFO, "%s : write to fpm client, msg %p len %d",
                 EVENT(evinfo->nlaei_type), evinfo->nlaei_msg, evinfo->nlaei_msglen);
 
-        evbuffer_add(outevb, nla_build_fpm_hdr(evinfo->nlaei_msglen), FPM_MSG_HDR_LEN);
-
-        evbuffer_add(outevb, evinfo->nlaei_msg, evinfo->nlaei_msglen);
+        dropped = nla_fpm_msg_write(nla_fpm_server_ctx.nlac_bev,
+                                    nla_fpm_server_ctx.nlac_infravec->nlaiv_get_fpm_msg_type(NLA_FPM_SERVER),
+                                    evinfo->nlaei_msg,
+                                    evinfo->nlaei_msglen,
+                                    nla_fpm_server_ctx.nlac_infravec->nlaiv_get_max_msg_len(NLA_FPM_SERVER));
+        if (dropped < 0) {
+            nla_log(LOG_WARN, "bufferevent_write_buffer failed");
+            nla_stats_write_failure(NLA_FPM_SERVER, 1);
+            break;
+        }
 
-        if (bufferevent_write_buffer(nla_fpm_server_ctx.nlac_bev, outevb) < 0) {
-            nla_log(LOG_INFO, "bufferevent_write_buffer failed");
-            /*
-             * If we hit this core, we might need to create evbuffer queue
-             * which gets processed in the background.
-             */
-            assert(false);
+        if (dropped > 0) {
+            nla_log(LOG_WARN, "%d oversized msgs not sent to fpm client", dropped);
+            nla_stats_write_failure(NLA_FPM_SERVER, dropped);
         }
 
-        evbuffer_free(outevb);
+        nla_stats_module_out(NLA_FPM_SERVER, evinfo->nlaei_msglen);
+        nla_stats_latency(from, NLA_FPM_SERVER, evinfo->nlaei_time);
+        nla_stats_queue(NLA_FPM_SERVER,
+                        evbuffer_get_length(bufferevent_get_output(nla_fpm_server_ctx.nlac_bev)));
 
         break;
 
@@ -18,22 +18,43 @@
 #include <iostream>
 #include <memory>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <deque>
+#include <set>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <string>
 #include <assert.h>
 #include <chrono>
-#include <future>
+#include <algorithm>
 #include <unistd.h>
 #include <fcntl.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
 
 #include <grpc++/grpc++.h>
+#include <grpc++/alarm.h>
+#include <google/protobuf/arena.h>
 #include "authentication_service.grpc.pb.h"
 #include "jnx_addr.grpc.pb.h"
 #include "prpd_common.grpc.pb.h"
 #include "rib_service.grpc.pb.h"
 #include "prpd_service.grpc.pb.h"
 
+/* Before libevent, which pulls in the TRY_AGAIN macro of netdb.h */
+static const routing::RouteOperStatus RIB_STATUS_TRY_AGAIN = routing::TRY_AGAIN;
+
 /* Libevent. */
 #include <event.h>
 
+/* After the protobuf headers, which have an AF_INET enumerator */
+#include <net/if.h>
+#include <arpa/inet.h>
+
 /* Netlink */
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
@@ -51,6 +72,7 @@
 
 
 using grpc::Channel;
+using grpc::ClientAsyncReader;
 using grpc::ClientAsyncResponseReader;
 using grpc::ClientContext;
 using grpc::CompletionQueue;
@@ -59,25 +81,379 @@ using routing::Rib;
 using routing::Base;
 
 
+/* Routes per RouteUpdate/RouteRemove request, at most 1000 */
+#define NLA_RIB_BATCH_MAX       1000
+
+/* How long a route may wait for its batch to fill up, and its operations to collapse */
+#define NLA_RIB_BATCH_DELAY_MS  10
+
+/* Initial arena block, enough for most batches */
+#define NLA_RIB_ARENA_BLOCK     (256 << 10)
+
+/* Arenas kept for reuse */
+#define NLA_RIB_ARENA_POOL      8
+
+/* Login retry backoff */
+#define NLA_GRPC_BACKOFF_MIN_MS   100
+#define NLA_GRPC_BACKOFF_MAX_MS   30000
+
+#define NLA_GRPC_LOGIN_TIMEOUT_MS 5000
+
+/* Channel state watches are renewed after */
+#define NLA_GRPC_WATCH_TIMEOUT_S  60
+
+/* Routes per RouteMonitorReply during the initial table walk */
+#define NLA_RIB_MONITOR_REPLY_ROUTES 1000
+
+/* RouteMonitorReply batches waiting for the event loop, at most */
+#define NLA_RIB_MONITOR_BACKLOG   64
+
+/* How long RPD keeps our routes once disconnected, they are reconciled on reconnect */
+#define NLA_RIB_PURGE_TIME_S      60
+
+/* Reconcile after, if no end of dump was received */
+#define NLA_RIB_SYNC_TIMEOUT_S    30
+
+/* Kernel table ids looked up in the flat table map, the others in a map */
+#define NLA_RIB_TABLE_IDS         256
+
+/* Failed route operations are retried after 100 ms, doubling up to 10 s */
+#define NLA_RIB_RETRY_MIN_MS      100
+#define NLA_RIB_RETRY_MAX_MS      10000
+
+/* Retries kept in memory, the next ones are spilled to the retry spill file */
+#define NLA_RIB_RETRY_MAX         65536
+
+/* Spill file read size */
+#define NLA_RIB_SPILL_CHUNK       65536
+
+
+/*
+ * The requests are built on an arena, which is reset and recycled once
+ * the call completes. The initial block survives the resets.
+ */
+typedef struct rib_arena_s {
+    google::protobuf::Arena *ra_arena;
+    char                     ra_block[NLA_RIB_ARENA_BLOCK];
+} rib_arena_t;
+
+
+typedef enum rib_op_e {
+    RIB_OP_UPDATE,
+    RIB_OP_REMOVE,
+    RIB_OP_GET,
+    RIB_OP_MAX,
+} rib_op_t;
+
+
+typedef enum rib_stream_state_e {
+    RIB_STREAM_START,
+    RIB_STREAM_READ,
+    RIB_STREAM_FINISH,
+} rib_stream_state_t;
+
+
+/*
+ * Where and when the event of a route operation came in, to record its
+ * latency once RPD completes it.
+ */
+typedef struct rib_ingress_s {
+    int                    ri_from;      /* nla_module_id_t */
+    uint64_t               ri_time;      /* nla_clock_ns(), 0 if unknown */
+} rib_ingress_t;
+
+
+/*
+ * A route of a call, kept until the call completes so that it can be
+ * retried.
+ */
+typedef struct rib_call_route_s {
+    std::string            rcr_key;
+    struct rtnl_route     *rcr_route;    /* referenced */
+    int                    rcr_backoff;  /* ms, 0 unless it is a retry */
+    rib_ingress_t          rcr_ingress;
+} rib_call_route_t;
+
+
+/*
+ * A RIB RPC in flight, also its completion queue tag. RouteGet is a
+ * stream, which completes the call once per read.
+ */
+typedef struct rib_call_s {
+    const char                   *rc_rpc;
+    rib_op_t                      rc_op;
+    std::string                   rc_table;
+    int                           rc_shard;
+    int                           rc_count;      /* routes or keys */
+    std::vector<rib_call_route_t> rc_routes;     /* in order */
+    rib_arena_t                  *rc_arena;
+    routing::RouteUpdateRequest  *rc_updateReq;  /* on rc_arena */
+    routing::RouteRemoveRequest  *rc_removeReq;  /* on rc_arena */
+    routing::RouteGetRequest     *rc_getReq;     /* on rc_arena */
+    grpc::ClientContext           rc_context;
+    routing::RouteOperReply       rc_reply;
+    grpc::Status                  rc_status;
+    std::unique_ptr<ClientAsyncResponseReader<routing::RouteOperReply>> rc_reader;
+    rib_stream_state_t            rc_streamState;
+    bool                          rc_ok;         /* of the last stream operation */
+    routing::RouteGetReply        rc_getReply;
+    std::unique_ptr<ClientAsyncReader<routing::RouteGetReply>> rc_getReader;
+} rib_call_t;
+
+
+/*
+ * The operation queued on a prefix.
+ */
+typedef struct rib_pending_s {
+    rib_op_t               rp_op;       /* RIB_OP_UPDATE or RIB_OP_REMOVE */
+    bool                   rp_present;  /* RPD has the prefix before rp_op */
+    struct rtnl_route     *rp_route;    /* referenced */
+    int                    rp_backoff;  /* ms, 0 unless it is a retry */
+    rib_ingress_t          rp_ingress;  /* of the oldest operation collapsed */
+} rib_pending_t;
+
+
+/*
+ * The operations queued on the prefixes of a table, collapsed to their net
+ * effect. The operations on a prefix with an RPC in flight are blocked
+ * until it completes, so that they can't be reordered.
+ */
+typedef struct rib_queue_s {
+    std::unordered_map<std::string, rib_pending_t> rq_pending;
+    std::unordered_map<std::string, rib_pending_t> rq_blocked;
+} rib_queue_t;
+
+
+/*
+ * A failed route operation, waiting to be queued again.
+ */
+typedef struct rib_retry_s {
+    rib_op_t               rr_op;
+    struct rtnl_route     *rr_route;    /* referenced */
+    int                    rr_backoff;  /* ms */
+    rib_ingress_t          rr_ingress;  /* lost once spilled */
+    std::multimap<std::chrono::steady_clock::time_point, std::string>::iterator rr_due;
+} rib_retry_t;
+
+
+/*
+ * A retry spilled to the spill file. Only the last record of a prefix,
+ * with its sequence number, is valid.
+ */
+typedef struct rib_spilled_s {
+    uint32_t               rsp_seq;
+    rib_op_t               rsp_op;
+} rib_spilled_t;
+
+
+/*
+ * After a reconnect, the routes are reconciled with the ones RPD kept.
+ * The routes of the first dump are held back, keyed by table and prefix.
+ * Once the dump ends, the routes with our cookie are streamed back from
+ * RPD with RouteGet, and only the routes which differ are sent. The held
+ * routes RPD doesn't have are added last.
+ */
+typedef struct rib_sync_s {
+    std::map<std::string, struct rtnl_route*> rs_routes;  /* held back, referenced */
+    std::set<std::string>  rs_tables;
+    bool                   rs_getting;
+    int                    rs_gets;      /* RouteGet streams in flight */
+    int                    rs_modified;
+    int                    rs_removed;
+    int                    rs_unchanged;
+    struct event          *rs_timer;
+} rib_sync_t;
+
+
+/*
+ * A channel of the pool, with its own HTTP/2 connection and its own
+ * completion queue, polled by a dedicated thread. Shard 0 is on the main
+ * channel, which also carries the logins, RouteGet and the monitoring.
+ */
+typedef struct rib_shard_s {
+    std::shared_ptr<grpc::Channel> rsh_channel;
+    routing::Rib::Stub      *rsh_ribStub;
+    grpc::CompletionQueue    rsh_cq;
+    std::thread             *rsh_thread;
+} rib_shard_t;
+
+
+/*
+ * The RIB RPCs are asynchronous. They are started from the event loop and
+ * complete on the CompletionQueues of the shards, whose threads hand the
+ * completed calls back to the event loop through a pipe.
+ *
+ * The route operations are queued per table and prefix. The queues are
+ * sent in batches once a table has a full batch queued, or when the batch
+ * delay expires, as long as RPC slots are free. While RPD is slow, the
+ * operations keep collapsing in the queues. The batches are split across
+ * the shards by prefix (or table) hash. A prefix has a single operation in
+ * flight anyway, so the shards can't reorder its operations.
+ *
+ * The route operations RPD fails transiently are queued again after a
+ * backoff per prefix. Past NLA_RIB_RETRY_MAX retries, the routes are
+ * spilled to a file as netlink route messages, and read back once the
+ * retries in memory drain.
+ */
+typedef struct rib_cq_s {
+    std::vector<rib_shard_t*> rcq_shards;
+    bool                     rcq_shardByTable;
+    std::mutex               rcq_lock;
+    std::vector<rib_call_t*> rcq_done;        /* from the cq thread */
+    std::set<rib_call_t*>    rcq_outstanding; /* started, not completed */
+    std::deque<rib_call_t*>  rcq_backlog;     /* waiting for a free slot */
+    std::map<std::string, rib_queue_t> rcq_queues;  /* by table */
+    std::unordered_set<std::string> rcq_inflight;   /* prefixes in a call */
+    std::unordered_set<std::string> rcq_installed;  /* prefixes RPD has once queued */
+    bool                     rcq_starved;     /* queues wait for a free slot */
+    struct event            *rcq_batchTimer;
+    std::unordered_map<std::string, rib_retry_t> rcq_retries;  /* by prefix */
+    std::multimap<std::chrono::steady_clock::time_point, std::string> rcq_retryDue;
+    struct event            *rcq_retryTimer;
+    std::unordered_map<std::string, rib_spilled_t> rcq_spilled;  /* by prefix */
+    std::string              rcq_spillPath;
+    int                      rcq_spillFd;
+    uint32_t                 rcq_spillSeq;
+    off_t                    rcq_spillReadOff;
+    off_t                    rcq_spillSize;
+    std::vector<rib_arena_t*> rcq_arenas;     /* free */
+    size_t                   rcq_maxOutstanding;
+    rib_sync_t              *rcq_sync;
+    int                      rcq_pipeFd[2];
+    struct event            *rcq_pipeReadEvent;
+} rib_cq_t;
+
+
+/*
+ * A login (RoutePurgeTimeConfig) RPC in flight
+ */
+typedef struct conn_mgr_login_s {
+    grpc::ClientContext             cl_context;
+    routing::RtPurgeConfigRequest   cl_req;
+    routing::RtOperReply            cl_reply;
+    grpc::Status                    cl_status;
+    std::unique_ptr<ClientAsyncResponseReader<routing::RtOperReply>> cl_reader;
+} conn_mgr_login_t;
+
+
+/*
+ * The connection manager watches the channel from its own thread, and
+ * passes the connection state changes to the event loop through an
+ * eventfd.
+ */
+typedef struct conn_mgr_s {
+    grpc::CompletionQueue    cm_cq;
+    std::thread             *cm_thread;
+    std::mutex               cm_lock;
+    bool                     cm_stop;
+    grpc::Alarm              cm_wakeup;
+    std::deque<nla_event_t>  cm_events;    /* to the event loop */
+    int                      cm_eventFd;
+    struct event            *cm_eventFdEvent;
+} conn_mgr_t;
+
+
+/*
+ * The RouteMonitorRegister stream of a table, also its completion queue
+ * tag.
+ */
+typedef struct rib_stream_s {
+    std::string                       rs_table;
+    int                               rs_family;
+    uint32_t                          rs_kernelTable;
+    rib_stream_state_t                rs_state;
+    bool                              rs_endOfTable;
+    grpc::ClientContext               rs_context;
+    routing::RouteMonitorRegRequest   rs_req;
+    routing::RouteMonitorReply        rs_reply;
+    grpc::Status                      rs_status;
+    std::unique_ptr<grpc::ClientAsyncReader<routing::RouteMonitorReply>> rs_reader;
+} rib_stream_t;
+
+
+/*
+ * The monitored tables are streamed to a dedicated thread, which encodes
+ * every RouteMonitorReply into one buffer of netlink messages. The buffers
+ * are handed over to the event loop through an eventfd. The thread stops
+ * reading the streams while NLA_RIB_MONITOR_BACKLOG buffers are pending,
+ * so that a slow event loop pushes back on RPD.
+ */
+typedef struct rib_monitor_s {
+    grpc::CompletionQueue               rm_cq;
+    std::thread                        *rm_thread;
+    std::vector<rib_stream_t*>          rm_streams;
+    std::map<std::string, unsigned int> rm_ifIndex;   /* thread only */
+    unsigned int                        rm_ifGeneration; /* of rm_ifIndex */
+    std::mutex                          rm_lock;
+    std::condition_variable             rm_cond;
+    bool                                rm_stop;
+    std::deque<std::vector<char>>       rm_batches;   /* to the event loop */
+    int                                 rm_eventFd;
+    struct event                       *rm_eventFdEvent;
+} rib_monitor_t;
+
+
+/*
+ * A RIB table, interned. Its RouteTable is shared by the keys of all the
+ * requests, rather than built for every route.
+ */
+typedef struct rib_table_s {
+    std::string            rt_name;
+    int                    rt_family;
+    uint32_t               rt_kernelTable;
+    routing::RouteTable    rt_table;
+} rib_table_t;
+
+
+typedef enum rib_family_e {
+    RIB_FAMILY_INET,
+    RIB_FAMILY_INET6,
+    RIB_FAMILY_OTHER,
+    RIB_FAMILY_MAX,
+} rib_family_t;
+
+
+/*
+ * The RIB tables of the kernel tables, by family and kernel table id. The
+ * usual ids are looked up in a flat map, precomputed with the default
+ * tables (inet.0 and inet6.0) for the tables which aren't mapped.
+ */
+typedef struct rib_table_map_s {
+    std::deque<rib_table_t> rtm_tables;
+    rib_table_t            *rtm_flat[RIB_FAMILY_MAX][NLA_RIB_TABLE_IDS];
+    std::map<std::pair<int, uint32_t>, rib_table_t*> rtm_ids;    /* past the flat map */
+    std::unordered_map<std::string, rib_table_t*>    rtm_names;
+} rib_table_map_t;
+
+
 typedef struct grpc_context_s {
     std::shared_ptr<grpc::Channel> *gc_channel;
-    std::thread        *gc_connectionManagerThread;
-    std::promise<void> *gc_exitSignal; /* Create a std::promise object */
-    std::future<void>  *gc_futureObj;  /* Fetch std::future object associated with promise */
-    struct event       *gc_pipeReadEvent;
-    int                 gc_pipeFd[2];
+    routing::Rib::Stub *gc_ribStub;
+    routing::Base::Stub *gc_baseStub;
+    rib_cq_t           *gc_ribCq;
+    conn_mgr_t         *gc_connMgr;
+    rib_monitor_t      *gc_ribMonitor;
+    rib_table_map_t    *gc_tableMap;
+    nla_grpcopt_t       gc_grpcopt;      /* channel arguments */
+    bool                gc_compress;     /* deflate RouteUpdate/RouteRemove */
 } grpc_context_t;
 
 
-typedef struct nh_arg_s {
-    routing::RouteNexthop  *na_rtNh;
-    uint32_t                na_nhIndex;
-} nh_arg_t;
+grpc_context_t grpc_ctx;
+
+static void RibSyncGetDone(rib_call_t *call);
+static void RibSyncTimer(evutil_socket_t fd, short what, void *arg);
+static void RibSyncFree(rib_sync_t *sync);
 
 
-grpc_context_t grpc_ctx;
+static const char *ribOpRpc[RIB_OP_MAX] = {
+    "RouteUpdate",
+    "RouteRemove",
+    "RouteGet",
+};
 
 extern void nla_prpdc_event_cb(nla_event_t event);
+extern void nla_prpdc_write_cb(const void *msg, unsigned int msg_len);
 
 
 const char *
@@ -97,68 +473,141 @@ GetCookie ()
 uint32_t
 GetPurgeTime ()
 {
-    return 1;
+    return NLA_RIB_PURGE_TIME_S;
 }
 
 
-int
-ConfigRoutePurgeTime ()
+static rib_family_t
+RibFamily (int family)
 {
-    routing::Base::Stub           baseChannel(*grpc_ctx.gc_channel);
-    routing::RtPurgeConfigRequest rtPurgeCfgReq;
-    routing::RtOperReply          rtOperReply;
-    grpc::ClientContext           context;
-    grpc::Status                  status;
+    switch (family) {
+    case AF_INET:
+        return RIB_FAMILY_INET;
+    case AF_INET6:
+        return RIB_FAMILY_INET6;
+    }
+    return RIB_FAMILY_OTHER;
+}
 
-    /*
-     * Build ClientContext object
-     */
-    context.AddMetadata("client-id", GetClientId());
 
-    rtPurgeCfgReq.set_time(GetPurgeTime());
+static rib_table_t *
+RibTableIntern (rib_table_map_t *tableMap, const char *name, uint32_t kernelTable)
+{
+    rib_table_t *table;
 
-    status = baseChannel.RoutePurgeTimeConfig(&context, rtPurgeCfgReq, &rtOperReply);
-    if (!status.ok()) {
-        nla_log(LOG_INFO, "Config RPC failed");
-        return -1;
+    auto it = tableMap->rtm_names.find(name);
+    if (it != tableMap->rtm_names.end()) {
+        return it->second;
     }
 
-    if (rtOperReply.ret_code() != routing::RET_SUCCESS) {
-        nla_log(LOG_INFO, "Config failed with status %d", rtOperReply.ret_code());
-        return -1;
+    tableMap->rtm_tables.emplace_back();
+    table = &tableMap->rtm_tables.back();
+    table->rt_name = name;
+    table->rt_family = nla_table_family(name);
+    table->rt_kernelTable = kernelTable;
+    table->rt_table.mutable_rtt_name()->set_name(name);
+    tableMap->rtm_names[name] = table;
+
+    return table;
+}
+
+
+/*
+ * Map the kernel tables kernelTables to the RIB tables tables, the other
+ * kernel tables map to inet.0 or inet6.0.
+ */
+void
+RibClientTableMap (uint32_t *kernelTables, char **tables, int count)
+{
+    rib_table_map_t *tableMap;
+    rib_table_t *defaults[RIB_FAMILY_MAX];
+    rib_table_t *table;
+    int family, i;
+    uint32_t id;
+
+    delete grpc_ctx.gc_tableMap;
+    grpc_ctx.gc_tableMap = tableMap = new rib_table_map_t();
+
+    defaults[RIB_FAMILY_INET] = RibTableIntern(tableMap, "inet.0", RT_TABLE_MAIN);
+    defaults[RIB_FAMILY_INET6] = RibTableIntern(tableMap, "inet6.0", RT_TABLE_MAIN);
+    defaults[RIB_FAMILY_OTHER] = RibTableIntern(tableMap, "unknown", RT_TABLE_MAIN);
+
+    for (family = 0; family < RIB_FAMILY_MAX; family++) {
+        for (id = 0; id < NLA_RIB_TABLE_IDS; id++) {
+            tableMap->rtm_flat[family][id] = defaults[family];
+        }
     }
 
-    nla_log(LOG_INFO, "Config successful");
+    for (i = 0; i < count; i++) {
+        table = RibTableIntern(tableMap, tables[i], kernelTables[i]);
+        family = RibFamily(table->rt_family);
 
-    return 0;
+        if (kernelTables[i] < NLA_RIB_TABLE_IDS) {
+            tableMap->rtm_flat[family][kernelTables[i]] = table;
+        } else {
+            tableMap->rtm_ids[std::make_pair(family, kernelTables[i])] = table;
+        }
+
+        nla_log(LOG_INFO, "kernel table %u maps to %s", kernelTables[i], tables[i]);
+    }
+}
+
+
+/*
+ * The RIB table of route.
+ */
+static const rib_table_t *
+RibTable (struct rtnl_route *route)
+{
+    rib_family_t family = RibFamily(rtnl_route_get_family(route));
+    uint32_t id = rtnl_route_get_table(route);
+
+    if (id < NLA_RIB_TABLE_IDS) {
+        return grpc_ctx.gc_tableMap->rtm_flat[family][id];
+    }
+
+    auto it = grpc_ctx.gc_tableMap->rtm_ids.find(std::make_pair((int)family, id));
+    if (it != grpc_ctx.gc_tableMap->rtm_ids.end()) {
+        return it->second;
+    }
+
+    return grpc_ctx.gc_tableMap->rtm_flat[family][RT_TABLE_MAIN];
+}
+
+
+/*
+ * The RIB table named name, NULL if it isn't mapped.
+ */
+static const rib_table_t *
+RibTableByName (const std::string &name)
+{
+    auto it = grpc_ctx.gc_tableMap->rtm_names.find(name);
+    if (it == grpc_ctx.gc_tableMap->rtm_names.end()) {
+        return NULL;
+    }
+
+    return it->second;
 }
 
 
 const char *
 GetTableName (struct rtnl_route *route)
 {
-    switch (rtnl_route_get_family(route)) {
-    case AF_INET:
-        return "inet.0";
-    case AF_INET6:
-        return "inet6.0";
-    }
-    return "unknown";
+    return RibTable(route)->rt_name.c_str();
 }
 
 
 void
 CreateNetworkAddressFromNladdr (struct nl_addr *nlAddr, routing::NetworkAddress *NetworkAddr)
 {
-    jnxBase::IpAddress       IpAddr;
+    const char *addr = (const char *)nl_addr_get_binary_addr(nlAddr);
 
-    IpAddr.set_addr_bytes((const char*)nl_addr_get_binary_addr(nlAddr), nl_addr_get_len(nlAddr));
     switch (nl_addr_get_family(nlAddr)) {
     case AF_INET:
-        NetworkAddr->mutable_inet()->CopyFrom(IpAddr);
+        NetworkAddr->mutable_inet()->set_addr_bytes(addr, nl_addr_get_len(nlAddr));
         break;
     case AF_INET6:
-        NetworkAddr->mutable_inet6()->CopyFrom(IpAddr);
+        NetworkAddr->mutable_inet6()->set_addr_bytes(addr, nl_addr_get_len(nlAddr));
         break;
     default:
         break;
@@ -169,414 +618,2481 @@ CreateNetworkAddressFromNladdr (struct nl_addr *nlAddr, routing::NetworkAddress
 void
 AddNexthop (struct rtnl_nexthop *rtnh, void *arg)
 {
-    routing::RouteGateway    rtGw;
-    routing::NetworkAddress  rtGwAddr;
-    nh_arg_t                *nhArg;
+    routing::RouteNexthop   *rtNh = (routing::RouteNexthop *)arg;
+    routing::RouteGateway   *rtGw;
     struct nl_addr          *nlGwaddr;
-    struct nl_addr          *nlViaAddr = NULL;
-    uint32_t                 ifIndex;
-
-    nhArg = (nh_arg_t *)arg;
+    struct nl_addr          *nlViaAddr;
+    const char              *ifName;
 
     /*
      * Build the Gateway
      */
     nlGwaddr  = rtnl_route_nh_get_gateway(rtnh);
-    //nlViaAddr = rtnl_route_nh_get_via(rtnh);
-    ifIndex   = rtnl_route_nh_get_ifindex(rtnh);
+    nlViaAddr = rtnl_route_nh_get_via(rtnh);
+    ifName    = nla_ifname(rtnl_route_nh_get_ifindex(rtnh));
 
-    if (!nlGwaddr && !nlViaAddr) {
+    if (!nlGwaddr && !nlViaAddr && !ifName) {
         /* Skip these nexthops, Nothing to do here */
         return;
     }
 
+    /*
+     * Build the nexthop
+     */
+    rtGw = rtNh->add_gateways();
+
     if (nlGwaddr) {
-        CreateNetworkAddressFromNladdr(nlGwaddr, &rtGwAddr);
-        rtGw.mutable_gateway_address()->CopyFrom(rtGwAddr);
+        CreateNetworkAddressFromNladdr(nlGwaddr, rtGw->mutable_gateway_address());
     }
 
     if (nlViaAddr) {
-        CreateNetworkAddressFromNladdr(nlViaAddr, &rtGwAddr);
-        rtGw.mutable_gateway_address()->CopyFrom(rtGwAddr);
+        CreateNetworkAddressFromNladdr(nlViaAddr, rtGw->mutable_gateway_address());
     }
 
-    if (ifIndex) {
-        //rtGw.set_interface_name("ens3f0.0");
-        //rtnl_link_i2name(link_cache, nh->rtnh_ifindex, buf, sizeof(buf)));
+    if (ifName) {
+        rtGw->set_interface_name(ifName);
     }
-
-    /*
-     * Build the nexthop
-     */
-    nhArg->na_rtNh->add_gateways();
-    nhArg->na_rtNh->mutable_gateways(nhArg->na_nhIndex++)->CopyFrom(rtGw);
 }
 
 
-int
-RibClientAddRoute (struct rtnl_route *route)
-{
-    routing::Rib::Stub            ribChannel(*grpc_ctx.gc_channel);
-    routing::RouteMatchFields     rtKey;
-    routing::RouteTable           rtTable;
-    routing::RouteEntry           rtEntry;
-    routing::NetworkAddress       rtPrefix;
-    routing::RouteNexthop         rtNh;
-    routing::RouteAttributes      rtAttrs;
-    routing::RouteAttributeUint32 rtAttrColorVal;
-    routing::RouteUpdateRequest   rtUpdateReq;
-    routing::RouteOperReply       rtOperReply;
-    grpc::ClientContext           context;
-    grpc::Status                  status;
-    struct nl_addr                *dstAddr;
-    uint32_t                      rtPrefixLen;
-
+static struct nl_addr *
+CreateNladdrFromNetworkAddress (const routing::NetworkAddress &networkAddr)
+{
+    const jnxBase::IpAddress *ipAddr;
+    struct nl_addr *nlAddr;
+    int family;
+
+    switch (networkAddr.Af_case()) {
+    case routing::NetworkAddress::kInet:
+        family = AF_INET;
+        ipAddr = &networkAddr.inet();
+        break;
+    case routing::NetworkAddress::kInet6:
+        family = AF_INET6;
+        ipAddr = &networkAddr.inet6();
+        break;
+    default:
+        return NULL;
+    }
 
-    /*
-     * Build ClientContext object
-     */
-    context.AddMetadata("client-id", GetClientId());
+    if (ipAddr->AddrFormat_case() == jnxBase::IpAddress::kAddrString) {
+        if (nl_addr_parse(ipAddr->addr_string().c_str(), family, &nlAddr) < 0) {
+            return NULL;
+        }
+        return nlAddr;
+    }
 
-    /*
-     * Build RouteTable object
-     */
-    rtTable.mutable_rtt_name()->set_name(GetTableName(route));
+    return nl_addr_build(family, ipAddr->addr_bytes().data(), ipAddr->addr_bytes().size());
+}
 
-    /*
-     * Build the Prefix object
-     */
-    dstAddr = rtnl_route_get_dst(route);
-    CreateNetworkAddressFromNladdr(dstAddr, &rtPrefix);
-    rtPrefixLen = nl_addr_get_prefixlen(dstAddr);
 
+/*
+ * Build the key of route in place, in a request on an arena. The key
+ * points to the interned RouteTable, which the arena doesn't own.
+ */
+static void
+BuildRouteKey (struct rtnl_route *route, routing::RouteMatchFields *rtKey)
+{
+    struct nl_addr *dstAddr = rtnl_route_get_dst(route);
 
-    /*
-     * Build the nexthop
-     */
-    nh_arg_t nhArg;
-    nhArg.na_rtNh = &rtNh;
-    nhArg.na_nhIndex = 0;
-    rtnl_route_foreach_nexthop(route, AddNexthop, &nhArg);
+    rtKey->set_cookie(GetCookie());
+    rtKey->unsafe_arena_set_allocated_table(
+        const_cast<routing::RouteTable *>(&RibTable(route)->rt_table));
+    CreateNetworkAddressFromNladdr(dstAddr, rtKey->mutable_dest_prefix());
+    rtKey->set_dest_prefix_len(nl_addr_get_prefixlen(dstAddr));
+}
 
 
-    /*
-     * Build RouteMatchFields object
-     */
-    rtKey.set_cookie(GetCookie());
-    rtKey.mutable_table()->CopyFrom(rtTable);
-    rtKey.mutable_dest_prefix()->CopyFrom(rtPrefix);
-    rtKey.set_dest_prefix_len(rtPrefixLen);
+/*
+ * Build the RouteEntry of route in place.
+ */
+static void
+BuildRouteEntry (struct rtnl_route *route, routing::RouteEntry *rtEntry)
+{
+    BuildRouteKey(route, rtEntry->mutable_key());
 
+    rtnl_route_foreach_nexthop(route, AddNexthop, rtEntry->mutable_nexthop());
 
     /*
      * Add color Attribute
      */
-    rtAttrColorVal.set_value(100);
-    auto& rtAttrColor = *rtAttrs.mutable_colors();
-    rtAttrColor[0] = rtAttrColorVal;
+    (*rtEntry->mutable_attributes()->mutable_colors())[0].set_value(100);
+}
 
-    /*
-     * Build RouteEntry object
-     */
-    rtEntry.mutable_key()->CopyFrom(rtKey);
-    rtEntry.mutable_nexthop()->CopyFrom(rtNh);
-    rtEntry.mutable_attributes()->CopyFrom(rtAttrs);
 
-    /*
-     * Build RouteUpdateRequest
-     */
-    rtUpdateReq.add_routes();
-    rtUpdateReq.mutable_routes(0)->CopyFrom(rtEntry);
+/*
+ * The route (to remove) matching rtKey.
+ */
+static struct rtnl_route *
+CreateRouteFromRouteKey (const routing::RouteMatchFields &rtKey)
+{
+    const rib_table_t *table;
+    struct rtnl_route *route;
+    struct nl_addr *dstAddr;
 
-    status = ribChannel.RouteAdd(&context, rtUpdateReq, &rtOperReply);
-    if (!status.ok()) {
-        nla_log(LOG_INFO, "RouteAdd RPC failed");
-        return -1;
+    table = RibTableByName(rtKey.table().rtt_name().name());
+    if (!table) {
+        return NULL;
     }
 
-    if (rtOperReply.status() != routing::SUCCESS) {
-        nla_log(LOG_INFO, "RouteAdd failed with status %d", rtOperReply.status());
-        return 0;
+    dstAddr = CreateNladdrFromNetworkAddress(rtKey.dest_prefix());
+    if (!dstAddr) {
+        return NULL;
     }
 
-    nla_log(LOG_INFO, "RouteAdd successful");
+    nl_addr_set_prefixlen(dstAddr, rtKey.dest_prefix_len());
 
-    return 0;
+    route = rtnl_route_alloc();
+    rtnl_route_set_table(route, table->rt_kernelTable);
+    rtnl_route_set_family(route, nl_addr_get_family(dstAddr));
+    rtnl_route_set_dst(route, dstAddr);
+    nl_addr_put(dstAddr);
+
+    return route;
 }
 
 
-int
-RibClientRemoveRoute (struct rtnl_route *route)
-{
-    routing::Rib::Stub          ribChannel(*grpc_ctx.gc_channel);
-    routing::NetworkAddress     rtPrefix;
-    routing::RouteTable         rtTable;
-    routing::RouteMatchFields   rtKey;
-    routing::RouteRemoveRequest rtRemoveReq;
-    routing::RouteOperReply     rtOperReply;
-    grpc::ClientContext         context;
-    struct nl_addr             *dstAddr;
-    uint32_t                    rtPrefixLen;
+/*
+ * Append the bytes of networkAddr to out, whatever its format.
+ */
+static void
+AppendAddressBytes (const routing::NetworkAddress &networkAddr, std::string *out)
+{
+    const jnxBase::IpAddress *ipAddr;
+    unsigned char buf[sizeof(struct in6_addr)];
+    int family, len;
+
+    switch (networkAddr.Af_case()) {
+    case routing::NetworkAddress::kInet:
+        family = AF_INET;
+        len = sizeof(struct in_addr);
+        ipAddr = &networkAddr.inet();
+        break;
+    case routing::NetworkAddress::kInet6:
+        family = AF_INET6;
+        len = sizeof(struct in6_addr);
+        ipAddr = &networkAddr.inet6();
+        break;
+    default:
+        return;
+    }
 
-    /*
-     * Build ClientContext object
-     */
-    context.AddMetadata("client-id", GetClientId());
+    if (ipAddr->AddrFormat_case() == jnxBase::IpAddress::kAddrString) {
+        if (inet_pton(family, ipAddr->addr_string().c_str(), buf) == 1) {
+            out->append((const char *)buf, len);
+        }
+        return;
+    }
 
-    /*
-     * Build RouteTable object
-     */
-    rtTable.mutable_rtt_name()->set_name(GetTableName(route));
+    out->append(ipAddr->addr_bytes());
+}
 
-    /*
-     * Build the Prefix object
-     */
-    dstAddr = rtnl_route_get_dst(route);
-    CreateNetworkAddressFromNladdr(dstAddr, &rtPrefix);
-    rtPrefixLen = nl_addr_get_prefixlen(dstAddr);
 
+/*
+ * The key of a route, its table and prefix. RibRouteKey and RibKey build
+ * the same key from a route and from its RouteMatchFields.
+ */
+static std::string
+RibRouteKey (struct rtnl_route *route)
+{
+    struct nl_addr *dstAddr = rtnl_route_get_dst(route);
+    std::string key = RibTable(route)->rt_name;
 
-    /*
-     * Build RouteMatchFields object
-     */
-    rtKey.set_cookie(GetCookie());
-    rtKey.mutable_table()->CopyFrom(rtTable);
-    rtKey.mutable_dest_prefix()->CopyFrom(rtPrefix);
-    rtKey.set_dest_prefix_len(rtPrefixLen);
+    key.push_back('\0');
+    key.append((const char *)nl_addr_get_binary_addr(dstAddr), nl_addr_get_len(dstAddr));
+    key.push_back((char)nl_addr_get_prefixlen(dstAddr));
 
-    rtRemoveReq.add_keys();
-    rtRemoveReq.mutable_keys(0)->CopyFrom(rtKey);
+    return key;
+}
 
-    auto status = ribChannel.RouteRemove(&context, rtRemoveReq, &rtOperReply);
-    if (!status.ok()) {
-        nla_log(LOG_INFO, "RouteRemove RPC failed");
-        return -1;
-    }
 
-    if (rtOperReply.status() != routing::SUCCESS) {
-        nla_log(LOG_INFO, "RouteRemove failed with status %d", rtOperReply.status());
-        return 0;
-    }
+static std::string
+RibKey (const routing::RouteMatchFields &rtKey)
+{
+    std::string key = rtKey.table().rtt_name().name();
 
-    nla_log(LOG_INFO, "RouteRemove successful");
+    key.push_back('\0');
+    AppendAddressBytes(rtKey.dest_prefix(), &key);
+    key.push_back((char)rtKey.dest_prefix_len());
 
-    return 0;
+    return key;
 }
 
 
-/**
- * We can retry if the errno is transient.
+/*
+ * The RPC slots left once the backlog is sent.
  */
-bool
-PipeErrnoRetry (const int err)
+static int
+RibCallSlots ()
 {
-    switch (err) {
-    case EINTR:
-    case EAGAIN:
-        return true;
+    rib_cq_t *ribCq = grpc_ctx.gc_ribCq;
 
-    default:
-        return false;
-    }
+    return (int)ribCq->rcq_maxOutstanding - (int)ribCq->rcq_outstanding.size() -
+           (int)ribCq->rcq_backlog.size();
 }
 
 
-void
-PipeWrite (int pipeWrtiteFd, nla_event_t connectionState)
+static void
+RibCallSend (rib_call_t *call)
 {
-    int len;
+    rib_cq_t *ribCq = grpc_ctx.gc_ribCq;
+    rib_shard_t *shard = ribCq->rcq_shards[call->rc_shard];
+
+    switch (call->rc_op) {
+    case RIB_OP_UPDATE:
+        call->rc_reader = shard->rsh_ribStub->PrepareAsyncRouteUpdate(&call->rc_context,
+                                                                      *call->rc_updateReq,
+                                                                      &shard->rsh_cq);
+        break;
+    case RIB_OP_REMOVE:
+        call->rc_reader = shard->rsh_ribStub->PrepareAsyncRouteRemove(&call->rc_context,
+                                                                      *call->rc_removeReq,
+                                                                      &shard->rsh_cq);
+        break;
+    default:
+        assert(0);
+        return;
+    }
 
-    do {
-        nla_log(LOG_INFO, "PipeWriteConnectionState");
-        errno = 0;
-        len = write(pipeWrtiteFd, &connectionState, sizeof(connectionState));
-    } while (len < 0 && PipeErrnoRetry(errno));
+    call->rc_reader->StartCall();
+    call->rc_reader->Finish(&call->rc_reply, &call->rc_status, call);
+    ribCq->rcq_outstanding.insert(call);
 }
 
 
-void
-PipeRead (evutil_socket_t pipeWrtiteFd, short event UNUSED, void *arg UNUSED)
+/*
+ * Send the calls of the backlog, in order, as long as slots are free.
+ */
+static void
+RibBacklogSend ()
 {
-    int len;
-    nla_event_t state;
-
-    do {
-        nla_log(LOG_INFO, "PipeReadConnectionState");
-        errno = 0;
-        len = read(pipeWrtiteFd, &state, sizeof(state));
-        if (len > 0) {
-            nla_prpdc_event_cb(state);
-        }
-    } while (len < 0 && (errno == EINTR));
+    rib_cq_t *ribCq = grpc_ctx.gc_ribCq;
+    rib_call_t *call;
+
+    while (!ribCq->rcq_backlog.empty() &&
+           ribCq->rcq_outstanding.size() < ribCq->rcq_maxOutstanding) {
+        call = ribCq->rcq_backlog.front();
+        ribCq->rcq_backlog.pop_front();
+        RibCallSend(call);
+    }
 }
 
 
-void
-ConnectionManager (int pipeWrtiteFd)
+/*
+ * Start call, or queue it until a slot is free.
+ */
+static void
+RibCallStart (rib_call_t *call)
 {
-    nla_event_t connectionState = NLA_CONNECTION_DOWN;
-    nla_event_t newConnectionState = NLA_CONNECTION_DOWN;
+    rib_cq_t *ribCq = grpc_ctx.gc_ribCq;
 
-    std::chrono::system_clock::time_point deadline;
+    if (!ribCq->rcq_backlog.empty() ||
+        ribCq->rcq_outstanding.size() >= ribCq->rcq_maxOutstanding) {
+        ribCq->rcq_backlog.push_back(call);
+        return;
+    }
 
-    nla_log(LOG_INFO, "ConnectionManager init");
+    RibCallSend(call);
+}
 
-    while (grpc_ctx.gc_futureObj->wait_for(std::chrono::milliseconds(1)) == std::future_status::timeout) {
 
-        auto state = (*grpc_ctx.gc_channel)->GetState(false);
+static rib_arena_t *
+RibArenaGet ()
+{
+    rib_cq_t *ribCq = grpc_ctx.gc_ribCq;
+    google::protobuf::ArenaOptions options;
+    rib_arena_t *ribArena;
+
+    if (!ribCq->rcq_arenas.empty()) {
+        ribArena = ribCq->rcq_arenas.back();
+        ribCq->rcq_arenas.pop_back();
+        return ribArena;
+    }
 
-        switch (state) {
-        case GRPC_CHANNEL_READY:
-            nla_log(LOG_INFO, "GRPC_CHANNEL_READY");
-            while (ConfigRoutePurgeTime() < 0) {
-                nla_log(LOG_INFO, "Login failed");
-            }
-            nla_log(LOG_INFO, "Login successful");
-            newConnectionState = NLA_CONNECTION_UP;
-            break;
-        default:
-            switch (state) {
-            case GRPC_CHANNEL_IDLE:
-                nla_log(LOG_INFO, "GRPC_CHANNEL_IDLE");
-                break;
+    ribArena = new rib_arena_t;
+    options.initial_block = ribArena->ra_block;
+    options.initial_block_size = sizeof(ribArena->ra_block);
+    ribArena->ra_arena = new google::protobuf::Arena(options);
 
-            case GRPC_CHANNEL_CONNECTING:
-                nla_log(LOG_INFO, "GRPC_CHANNEL_CONNECTING");
-                break;
+    return ribArena;
+}
 
-            case GRPC_CHANNEL_TRANSIENT_FAILURE:
-                nla_log(LOG_INFO, "GRPC_CHANNEL_TRANSIENT_FAILURE");
-                break;
 
-            case GRPC_CHANNEL_SHUTDOWN:
-                nla_log(LOG_INFO, "GRPC_CHANNEL_SHUTDOWN");
-                break;
+static void
+RibArenaFree (rib_arena_t *ribArena)
+{
+    delete ribArena->ra_arena;
+    delete ribArena;
+}
 
-            default:
-                nla_log(LOG_INFO, "default");
-                break;
-            }
-            newConnectionState = NLA_CONNECTION_DOWN;
-            /* Try connecting */
-            (*grpc_ctx.gc_channel)->GetState(true);
-        }
 
-        if (newConnectionState != connectionState) {
-            connectionState = newConnectionState;
-            PipeWrite(pipeWrtiteFd, connectionState);
-        }
+static void
+RibArenaPut (rib_arena_t *ribArena)
+{
+    rib_cq_t *ribCq = grpc_ctx.gc_ribCq;
 
-        /* Wait for state to change */
-        while (grpc_ctx.gc_futureObj->wait_for(std::chrono::milliseconds(1)) == std::future_status::timeout) {
-            deadline = std::chrono::system_clock::now() + std::chrono::seconds(1);
-            if (!(*grpc_ctx.gc_channel)->WaitForStateChange(state, deadline)) {
-                /* nla_log(LOG_INFO, "Timeout while WaitForStateChange"); */
-                continue;
-            }
-            break;
-        }
+    if (ribCq->rcq_arenas.size() >= NLA_RIB_ARENA_POOL) {
+        RibArenaFree(ribArena);
+        return;
     }
 
-    nla_log(LOG_INFO, "ConnectionManager terminate");
+    ribArena->ra_arena->Reset();
+    ribCq->rcq_arenas.push_back(ribArena);
 }
 
 
-int
-StartConnectionManager ()
+static rib_call_t *
+RibCallNew (const std::string &table, rib_op_t op, int shard)
 {
-
-    grpc_ctx.gc_pipeFd[0] = -1;
-    grpc_ctx.gc_pipeFd[1] = -1;
+    google::protobuf::Arena *arena;
+    rib_call_t *call;
+
+    call = new rib_call_t();
+    call->rc_rpc = ribOpRpc[op];
+    call->rc_op = op;
+    call->rc_table = table;
+    call->rc_shard = shard;
+    call->rc_arena = RibArenaGet();
+
+    arena = call->rc_arena->ra_arena;
+    switch (op) {
+    case RIB_OP_REMOVE:
+        call->rc_removeReq =
+            google::protobuf::Arena::CreateMessage<routing::RouteRemoveRequest>(arena);
+        break;
+    case RIB_OP_GET:
+        call->rc_getReq =
+            google::protobuf::Arena::CreateMessage<routing::RouteGetRequest>(arena);
+        break;
+    default:
+        call->rc_updateReq =
+            google::protobuf::Arena::CreateMessage<routing::RouteUpdateRequest>(arena);
+        break;
+    }
 
     /*
-     * Create pipe for inter-thread communication
+     * Build ClientContext object
      */
-    if (pipe2(grpc_ctx.gc_pipeFd, O_NONBLOCK|O_CLOEXEC) < 0) {
-        nla_log(LOG_INFO, "failed to create pipe");
-        return -1;
-    }
+    call->rc_context.AddMetadata("client-id", GetClientId());
 
-    grpc_ctx.gc_pipeReadEvent = event_new(nla_gl.nlag_base,
-                                          grpc_ctx.gc_pipeFd[0],
-                                          EV_READ|EV_PERSIST,
-                                          PipeRead,
-                                          NULL);
-
-    if (event_add(grpc_ctx.gc_pipeReadEvent, NULL) < 0) {
-        nla_log(LOG_INFO, "failed to add pipe read event");
-        return -1;
+    /* Batches of routes compress well, the other RPCs are small */
+    if (grpc_ctx.gc_compress && (op == RIB_OP_UPDATE || op == RIB_OP_REMOVE)) {
+        call->rc_context.set_compression_algorithm(GRPC_COMPRESS_DEFLATE);
     }
 
-    /* Spawn thread that loops indefinitely to keep track of the connection */
-    grpc_ctx.gc_connectionManagerThread =
-        new std::thread(ConnectionManager, grpc_ctx.gc_pipeFd[1]);
-
-    return 0;
+    return call;
 }
 
 
-void
-RibClientReset ()
+static void
+RibCallFree (rib_call_t *call)
 {
-    nla_log(LOG_INFO, "RibClientReset");
-
-    if (grpc_ctx.gc_connectionManagerThread) {
-        /* Set the value in promise */
-        assert(grpc_ctx.gc_exitSignal);
-        grpc_ctx.gc_exitSignal->set_value();
-
-        /* Wait for thread to join */
-        grpc_ctx.gc_connectionManagerThread->join();
-        delete grpc_ctx.gc_connectionManagerThread;
-        grpc_ctx.gc_connectionManagerThread = NULL;
-    }
+    rib_arena_t *ribArena = call->rc_arena;
 
-    if (grpc_ctx.gc_exitSignal) {
-        delete grpc_ctx.gc_exitSignal;
-        grpc_ctx.gc_exitSignal = NULL;
+    for (auto &callRoute : call->rc_routes) {
+        if (callRoute.rcr_route) {
+            rtnl_route_put(callRoute.rcr_route);
+        }
     }
 
-    if (grpc_ctx.gc_futureObj) {
-        delete grpc_ctx.gc_futureObj;
-        grpc_ctx.gc_futureObj = NULL;
-    }
+    delete call;
+    RibArenaPut(ribArena);
+}
 
-    if (grpc_ctx.gc_channel) {
-        delete grpc_ctx.gc_channel;
-        grpc_ctx.gc_channel = NULL;
-    }
 
-    if (grpc_ctx.gc_pipeReadEvent) {
-        event_free(grpc_ctx.gc_pipeReadEvent);
-        grpc_ctx.gc_pipeReadEvent = NULL;
+/*
+ * A request aborts on its first failed route. Build the call for the
+ * routes following the failed one, which haven't been processed.
+ */
+static rib_call_t *
+RibCallRest (rib_call_t *call, int first)
+{
+    rib_call_t *rest;
+
+    rest = RibCallNew(call->rc_table, call->rc_op, call->rc_shard);
+    if (call->rc_op == RIB_OP_REMOVE) {
+        call->rc_removeReq->mutable_keys()->DeleteSubrange(0, first);
+        rest->rc_removeReq->Swap(call->rc_removeReq);
+    } else {
+        call->rc_updateReq->mutable_routes()->DeleteSubrange(0, first);
+        rest->rc_updateReq->Swap(call->rc_updateReq);
     }
+    rest->rc_count = call->rc_count - first;
 
-    close(grpc_ctx.gc_pipeFd[0]);
-    grpc_ctx.gc_pipeFd[0] = -1;
+    /* Their prefixes stay in flight */
+    rest->rc_routes.assign(call->rc_routes.begin() + first, call->rc_routes.end());
+    call->rc_routes.resize(first);
 
-    close(grpc_ctx.gc_pipeFd[1]);
-    grpc_ctx.gc_pipeFd[1] = -1;
+    return rest;
 }
 
 
-int
-RibClientInit (char *ribServerAddr)
+static void
+RibBatchTimerStart ()
 {
-    /*
+    rib_cq_t *ribCq = grpc_ctx.gc_ribCq;
+    struct timeval delay = {0, NLA_RIB_BATCH_DELAY_MS * 1000};
+
+    if (!evtimer_pending(ribCq->rcq_batchTimer, NULL)) {
+        evtimer_add(ribCq->rcq_batchTimer, &delay);
+    }
+}
+
+
+/*
+ * The prefixes of call are no longer in flight, unblock the operations
+ * queued on them meanwhile.
+ */
+static void
+RibCallRelease (rib_call_t *call)
+{
+    rib_cq_t *ribCq = grpc_ctx.gc_ribCq;
+    rib_queue_t &queue = ribCq->rcq_queues[call->rc_table];
+
+    for (const auto &callRoute : call->rc_routes) {
+        ribCq->rcq_inflight.erase(callRoute.rcr_key);
+
+        auto it = queue.rq_blocked.find(callRoute.rcr_key);
+        if (it != queue.rq_blocked.end()) {
+            queue.rq_pending.insert(*it);
+            queue.rq_blocked.erase(it);
+            RibBatchTimerStart();
+        }
+    }
+}
+
+
+/*
+ * The shard of a prefix, or of a table.
+ */
+static int
+RibShard (const std::string &key)
+{
+    rib_cq_t *ribCq = grpc_ctx.gc_ribCq;
+
+    if (ribCq->rcq_shards.size() == 1) {
+        return 0;
+    }
+
+    return std::hash<std::string>()(key) % ribCq->rcq_shards.size();
+}
+
+
+/*
+ * Move the operations queued on table into batches, one per operation and
+ * shard, and start them as long as RPC slots are free.
+ */
+static void
+RibQueueFlush (const std::string &table, rib_queue_t &queue)
+{
+    rib_cq_t *ribCq = grpc_ctx.gc_ribCq;
+    rib_call_t *calls[RIB_OP_MAX][NLA_CHANNELS_MAX] = {};
+    int tableShard = RibShard(table);
+    int slots = RibCallSlots();
+    rib_call_t *call;
+    rib_op_t op;
+    int shard;
+
+    auto it = queue.rq_pending.begin();
+    while (it != queue.rq_pending.end()) {
+        rib_pending_t &pending = it->second;
+
+        op = pending.rp_op;
+        shard = ribCq->rcq_shardByTable ? tableShard : RibShard(it->first);
+        call = calls[op][shard];
+        if (!call) {
+            if (slots <= 0) {
+                ribCq->rcq_starved = true;
+                break;
+            }
+            slots--;
+            call = calls[op][shard] = RibCallNew(table, op, shard);
+        }
+
+        /*
+         * Build the RouteEntry (or key) in the request
+         */
+        if (op == RIB_OP_UPDATE) {
+            BuildRouteEntry(pending.rp_route, call->rc_updateReq->add_routes());
+        } else {
+            BuildRouteKey(pending.rp_route, call->rc_removeReq->add_keys());
+        }
+
+        /* The call keeps the route, in case it has to be retried */
+        ribCq->rcq_inflight.insert(it->first);
+        call->rc_routes.push_back({it->first, pending.rp_route, pending.rp_backoff,
+                                   pending.rp_ingress});
+        it = queue.rq_pending.erase(it);
+
+        if (++call->rc_count >= NLA_RIB_BATCH_MAX) {
+            RibCallStart(call);
+            calls[op][shard] = NULL;
+        }
+    }
+
+    for (auto &opCalls : calls) {
+        for (auto partial : opCalls) {
+            if (partial) {
+                RibCallStart(partial);
+            }
+        }
+    }
+}
+
+
+static void
+RibQueueFlushAll ()
+{
+    rib_cq_t *ribCq = grpc_ctx.gc_ribCq;
+
+    ribCq->rcq_starved = false;
+
+    for (auto &queue : ribCq->rcq_queues) {
+        if (!queue.second.rq_pending.empty()) {
+            RibQueueFlush(queue.first, queue.second);
+        }
+
+        if (ribCq->rcq_starved) {
+            break;
+        }
+    }
+}
+
+
+static void
+RibBatchTimer (evutil_socket_t fd UNUSED, short what UNUSED, void *arg UNUSED)
+{
+    RibQueueFlushAll();
+}
+
+
+/*
+ * Forget the retry of the prefix key, superseded by a newer operation.
+ */
+static void
+RibRetryCancel (const std::string &key)
+{
+    rib_cq_t *ribCq = grpc_ctx.gc_ribCq;
+    auto it = ribCq->rcq_retries.find(key);
+    auto spilled = ribCq->rcq_spilled.find(key);
+
+    /* RPD still has the prefix, as far as we know */
+    if (it != ribCq->rcq_retries.end()) {
+        if (it->second.rr_op == RIB_OP_REMOVE) {
+            ribCq->rcq_installed.insert(key);
+        }
+        ribCq->rcq_retryDue.erase(it->second.rr_due);
+        rtnl_route_put(it->second.rr_route);
+        ribCq->rcq_retries.erase(it);
+    }
+
+    if (spilled != ribCq->rcq_spilled.end()) {
+        if (spilled->second.rsp_op == RIB_OP_REMOVE) {
+            ribCq->rcq_installed.insert(key);
+        }
+        ribCq->rcq_spilled.erase(spilled);
+    }
+}
+
+
+/*
+ * Append the retry of route to the spill file, as a netlink route message
+ * carrying the sequence number of the record and the backoff.
+ *
+ * @return -1 if it couldn't be written.
+ */
+static int
+RibSpillWrite (const std::string &key, rib_op_t op, struct rtnl_route *route, int backoff)
+{
+    rib_cq_t *ribCq = grpc_ctx.gc_ribCq;
+    struct nl_msg *nlMsg = NULL;
+    struct nlmsghdr *nlh;
+    size_t len;
+    ssize_t written;
+    int err;
+
+    if (ribCq->rcq_spilled.empty() && ribCq->rcq_spillSize) {
+        /* Only cancelled records left */
+        if (ftruncate(ribCq->rcq_spillFd, 0) == 0) {
+            ribCq->rcq_spillReadOff = 0;
+            ribCq->rcq_spillSize = 0;
+        }
+    }
+
+    if (ribCq->rcq_spillFd < 0) {
+        ribCq->rcq_spillFd = open(ribCq->rcq_spillPath.c_str(),
+                                  O_RDWR|O_CREAT|O_TRUNC|O_APPEND|O_CLOEXEC, 0600);
+        if (ribCq->rcq_spillFd < 0) {
+            nla_log(LOG_WARN, "failed to open %s: %s", ribCq->rcq_spillPath.c_str(),
+                    strerror(errno));
+            return -1;
+        }
+    }
+
+    if (op == RIB_OP_UPDATE) {
+        err = rtnl_route_build_add_request(route, NLM_F_CREATE | NLM_F_REPLACE, &nlMsg);
+    } else {
+        err = rtnl_route_build_del_request(route, 0, &nlMsg);
+    }
+
+    if (err < 0) {
+        nla_log(LOG_WARN, "failed to build route request: %s", nl_geterror(err));
+        return -1;
+    }
+
+    nlh = nlmsg_hdr(nlMsg);
+    nlh->nlmsg_seq = ++ribCq->rcq_spillSeq;
+    nlh->nlmsg_pid = backoff;
+    len = NLMSG_ALIGN(nlh->nlmsg_len);
+
+    written = write(ribCq->rcq_spillFd, nlh, len);
+    nlmsg_free(nlMsg);
+
+    if (written != (ssize_t)len) {
+        nla_log(LOG_WARN, "failed to write %s: %s", ribCq->rcq_spillPath.c_str(),
+                written < 0 ? strerror(errno) : "short write");
+        /* Drop the partial record */
+        if (ftruncate(ribCq->rcq_spillFd, ribCq->rcq_spillSize) < 0) {
+            nla_log(LOG_WARN, "failed to truncate %s", ribCq->rcq_spillPath.c_str());
+        }
+        return -1;
+    }
+
+    if (ribCq->rcq_spilled.empty()) {
+        nla_log(LOG_NOTICE, "%zu RIB retries, spilling to %s", ribCq->rcq_retries.size(),
+                ribCq->rcq_spillPath.c_str());
+    }
+
+    ribCq->rcq_spillSize += len;
+    ribCq->rcq_spilled[key] = {ribCq->rcq_spillSeq, op};
+
+    return 0;
+}
+
+
+/*
+ * Retry op on the prefix key of route after backoff, or spill it if the
+ * retries in memory are full.
+ */
+static void
+RibRetryAdd (const std::string &key, rib_op_t op, struct rtnl_route *route, int backoff,
+             std::chrono::steady_clock::time_point due, rib_ingress_t ingress)
+{
+    rib_cq_t *ribCq = grpc_ctx.gc_ribCq;
+    struct timeval delay;
+    rib_retry_t *retry;
+
+    if (ribCq->rcq_retries.size() >= NLA_RIB_RETRY_MAX) {
+        if (RibSpillWrite(key, op, route, backoff) < 0) {
+            nla_log(LOG_WARN, "%s retry lost", ribOpRpc[op]);
+        }
+        return;
+    }
+
+    nl_object_get(OBJ_CAST(route));
+
+    retry = &ribCq->rcq_retries[key];
+    retry->rr_op = op;
+    retry->rr_route = route;
+    retry->rr_backoff = backoff;
+    retry->rr_ingress = ingress;
+    retry->rr_due = ribCq->rcq_retryDue.emplace(due, key);
+
+    /* Due first */
+    if (retry->rr_due == ribCq->rcq_retryDue.begin()) {
+        auto wait = std::chrono::duration_cast<std::chrono::microseconds>(
+                        due - std::chrono::steady_clock::now()).count();
+        if (wait < 0) {
+            wait = 0;
+        }
+        delay.tv_sec = wait / 1000000;
+        delay.tv_usec = wait % 1000000;
+        evtimer_add(ribCq->rcq_retryTimer, &delay);
+    }
+}
+
+
+/*
+ * Queue op on the prefix key of route, collapsed with the operation queued
+ * on it already: an update replaces it, and a remove cancels an update of
+ * a prefix RPD doesn't have. backoff is 0, unless op is retried.
+ */
+static void
+RibQueueRoute (const std::string &table, const std::string &key,
+               struct rtnl_route *route, rib_op_t op, int backoff,
+               rib_ingress_t ingress)
+{
+    rib_cq_t *ribCq = grpc_ctx.gc_ribCq;
+    rib_queue_t &queue = ribCq->rcq_queues[table];
+    bool present;
+
+    if (!backoff) {
+        RibRetryCancel(key);
+    }
+
+    present = ribCq->rcq_installed.count(key);
+    auto &pending = ribCq->rcq_inflight.count(key) ? queue.rq_blocked : queue.rq_pending;
+    auto it = pending.find(key);
+
+    if (op == RIB_OP_UPDATE) {
+        ribCq->rcq_installed.insert(key);
+    } else {
+        ribCq->rcq_installed.erase(key);
+    }
+
+    if (it == pending.end()) {
+        if (op == RIB_OP_REMOVE && !present) {
+            return;
+        }
+
+        it = pending.emplace(key, rib_pending_t()).first;
+        it->second.rp_present = present;
+    } else {
+        rtnl_route_put(it->second.rp_route);
+
+        if (op == RIB_OP_REMOVE && !it->second.rp_present) {
+            pending.erase(it);
+            return;
+        }
+    }
+
+    nl_object_get(OBJ_CAST(route));
+    it->second.rp_op = op;
+    it->second.rp_route = route;
+    it->second.rp_backoff = backoff;
+
+    /* The latency is from the first change RPD doesn't have yet */
+    if (!it->second.rp_ingress.ri_time) {
+        it->second.rp_ingress = ingress;
+    }
+
+    if (queue.rq_pending.size() >= NLA_RIB_BATCH_MAX) {
+        RibQueueFlush(table, queue);
+    } else {
+        RibBatchTimerStart();
+    }
+}
+
+
+static void
+RibQueueFree (rib_queue_t &queue)
+{
+    for (auto &pending : queue.rq_pending) {
+        rtnl_route_put(pending.second.rp_route);
+    }
+
+    for (auto &pending : queue.rq_blocked) {
+        rtnl_route_put(pending.second.rp_route);
+    }
+}
+
+
+/*
+ * A spilled record is valid if it is the last one of its prefix, which
+ * wasn't cancelled meanwhile.
+ */
+static void
+RibSpillRecord (struct nlmsghdr *nlh, std::chrono::steady_clock::time_point now)
+{
+    rib_cq_t *ribCq = grpc_ctx.gc_ribCq;
+    struct rtnl_route *route;
+    std::string key;
+    int err;
+
+    err = rtnl_route_parse(nlh, &route);
+    if (err < 0) {
+        nla_log(LOG_INFO, "rtnl_route_parse error: %s", nl_geterror(err));
+        return;
+    }
+
+    key = RibRouteKey(route);
+
+    auto spilled = ribCq->rcq_spilled.find(key);
+    if (spilled != ribCq->rcq_spilled.end() && spilled->second.rsp_seq == nlh->nlmsg_seq) {
+        ribCq->rcq_spilled.erase(spilled);
+        RibRetryAdd(key, nlh->nlmsg_type == RTM_NEWROUTE ? RIB_OP_UPDATE : RIB_OP_REMOVE,
+                    route, nlh->nlmsg_pid, now, rib_ingress_t());
+    }
+
+    rtnl_route_put(route);
+}
+
+
+/*
+ * Read the spilled retries back, as long as they fit in memory. They have
+ * waited long enough, they are due right away.
+ */
+static void
+RibSpillLoad ()
+{
+    rib_cq_t *ribCq = grpc_ctx.gc_ribCq;
+    auto now = std::chrono::steady_clock::now();
+    std::vector<char> buf(NLA_RIB_SPILL_CHUNK);
+    struct nlmsghdr *nlh;
+    ssize_t len;
+    int rem;
+
+    while (!ribCq->rcq_spilled.empty() && ribCq->rcq_retries.size() < NLA_RIB_RETRY_MAX &&
+           ribCq->rcq_spillReadOff < ribCq->rcq_spillSize) {
+        len = pread(ribCq->rcq_spillFd, buf.data(), buf.size(), ribCq->rcq_spillReadOff);
+        if (len <= 0) {
+            nla_log(LOG_WARN, "failed to read %s: %s", ribCq->rcq_spillPath.c_str(),
+                    len < 0 ? strerror(errno) : "truncated");
+            break;
+        }
+
+        rem = len;
+        nlh = (struct nlmsghdr *)buf.data();
+        if (!NLMSG_OK(nlh, rem)) {
+            nla_log(LOG_WARN, "malformed record in %s", ribCq->rcq_spillPath.c_str());
+            break;
+        }
+
+        while (NLMSG_OK(nlh, rem) && ribCq->rcq_retries.size() < NLA_RIB_RETRY_MAX) {
+            RibSpillRecord(nlh, now);
+            ribCq->rcq_spillReadOff += NLMSG_ALIGN(nlh->nlmsg_len);
+            nlh = NLMSG_NEXT(nlh, rem);
+        }
+    }
+
+    if (ribCq->rcq_spillReadOff < ribCq->rcq_spillSize &&
+        ribCq->rcq_retries.size() >= NLA_RIB_RETRY_MAX) {
+        return;
+    }
+
+    /* Read through, or unreadable */
+    if (!ribCq->rcq_spilled.empty()) {
+        nla_log(LOG_WARN, "%zu spilled RIB retries lost", ribCq->rcq_spilled.size());
+        ribCq->rcq_spilled.clear();
+    }
+
+    if (ftruncate(ribCq->rcq_spillFd, 0) < 0) {
+        nla_log(LOG_WARN, "failed to truncate %s", ribCq->rcq_spillPath.c_str());
+    }
+    ribCq->rcq_spillReadOff = 0;
+    ribCq->rcq_spillSize = 0;
+
+    nla_log(LOG_NOTICE, "RIB retry spill drained, %zu RIB retries", ribCq->rcq_retries.size());
+}
+
+
+/*
+ * Queue the due retries again, they are batched with the other operations.
+ */
+static void
+RibRetryTimer (evutil_socket_t fd UNUSED, short what UNUSED, void *arg UNUSED)
+{
+    rib_cq_t *ribCq = grpc_ctx.gc_ribCq;
+    struct timeval delay = {0, NLA_RIB_RETRY_MIN_MS * 1000};
+    auto now = std::chrono::steady_clock::now();
+    rib_retry_t retry;
+    std::string key;
+
+    while (!ribCq->rcq_retryDue.empty() && ribCq->rcq_retryDue.begin()->first <= now) {
+        key = ribCq->rcq_retryDue.begin()->second;
+        ribCq->rcq_retryDue.erase(ribCq->rcq_retryDue.begin());
+
+        auto it = ribCq->rcq_retries.find(key);
+        retry = it->second;
+        ribCq->rcq_retries.erase(it);
+
+        /* RPD still has the prefix, as far as we know */
+        if (retry.rr_op == RIB_OP_REMOVE) {
+            ribCq->rcq_installed.insert(key);
+        }
+
+        RibQueueRoute(GetTableName(retry.rr_route), key, retry.rr_route, retry.rr_op,
+                      retry.rr_backoff, retry.rr_ingress);
+        rtnl_route_put(retry.rr_route);
+    }
+
+    if (!ribCq->rcq_spilled.empty() && ribCq->rcq_retries.size() < NLA_RIB_RETRY_MAX / 2) {
+        RibSpillLoad();
+    }
+
+    if (!ribCq->rcq_retryDue.empty()) {
+        auto wait = std::chrono::duration_cast<std::chrono::microseconds>(
+                        ribCq->rcq_retryDue.begin()->first - now).count();
+        if (wait < 0) {
+            wait = 0;
+        }
+        delay.tv_sec = wait / 1000000;
+        delay.tv_usec = wait % 1000000;
+        evtimer_add(ribCq->rcq_retryTimer, &delay);
+    } else if (!ribCq->rcq_spilled.empty()) {
+        evtimer_add(ribCq->rcq_retryTimer, &delay);
+    }
+}
+
+
+/*
+ * Retry the routes of call from first on, after doubling their backoff.
+ * The routes with a newer operation blocked on them are superseded.
+ */
+static void
+RibRetryCall (rib_call_t *call, int first)
+{
+    rib_cq_t *ribCq = grpc_ctx.gc_ribCq;
+    rib_queue_t &queue = ribCq->rcq_queues[call->rc_table];
+    auto now = std::chrono::steady_clock::now();
+    int backoff;
+    int i;
+
+    for (i = first; i < (int)call->rc_routes.size(); i++) {
+        rib_call_route_t &callRoute = call->rc_routes[i];
+
+        if (queue.rq_blocked.count(callRoute.rcr_key)) {
+            continue;
+        }
+
+        backoff = callRoute.rcr_backoff ?
+                  std::min(callRoute.rcr_backoff * 2, NLA_RIB_RETRY_MAX_MS) : NLA_RIB_RETRY_MIN_MS;
+
+        RibRetryAdd(callRoute.rcr_key, call->rc_op, callRoute.rcr_route, backoff,
+                    now + std::chrono::milliseconds(backoff), callRoute.rcr_ingress);
+    }
+}
+
+
+/*
+ * @return true if RPD may accept the route later on.
+ */
+static bool
+RibRetryStatus (routing::RouteOperStatus status)
+{
+    switch (status) {
+    case routing::INTERNAL_ERROR:
+    case routing::NOT_INITIALIZED:
+    case routing::TOO_MANY_OPS:
+    case routing::TABLE_NOT_READY:
+    case routing::NOT_READY:
+    case RIB_STATUS_TRY_AGAIN:
+        return true;
+    default:
+        return false;
+    }
+}
+
+
+/*
+ * RPD has the first count routes of call.
+ */
+static void
+RibCallLatency (rib_call_t *call, int count)
+{
+    int i;
+
+    for (i = 0; i < count && i < (int)call->rc_routes.size(); i++) {
+        const rib_ingress_t &ingress = call->rc_routes[i].rcr_ingress;
+
+        nla_stats_latency((nla_module_id_t)ingress.ri_from, NLA_PRPD_CLIENT, ingress.ri_time);
+    }
+}
+
+
+static void
+RibCallDone (rib_call_t *call)
+{
+    rib_cq_t *ribCq = grpc_ctx.gc_ribCq;
+    routing::RouteOperStatus status;
+    uint32_t completed;
+
+    if (call->rc_op == RIB_OP_GET) {
+        RibSyncGetDone(call);
+        return;
+    }
+
+    ribCq->rcq_outstanding.erase(call);
+
+    if (!call->rc_status.ok()) {
+        nla_log(LOG_INFO, "%s RPC failed: %s, %d routes retried", call->rc_rpc,
+                call->rc_status.error_message().c_str(), call->rc_count);
+        RibRetryCall(call, 0);
+    } else if ((status = call->rc_reply.status()) != routing::SUCCESS) {
+        completed = call->rc_reply.operations_completed();
+        nla_log(LOG_INFO, "%s failed with status %d on route %u of %d",
+                call->rc_rpc, status, completed + 1, call->rc_count);
+
+        RibCallLatency(call, completed);
+
+        if (RibRetryStatus(status)) {
+            /* RPD is busy, back off with the failed route and the rest */
+            RibRetryCall(call, completed);
+        } else {
+            nla_stats_write_failure(NLA_PRPD_CLIENT, 1);
+
+            if ((int)completed + 1 < call->rc_count) {
+                /* Skip the failed route, and retry the rest ahead of the backlog */
+                ribCq->rcq_backlog.push_front(RibCallRest(call, completed + 1));
+            }
+        }
+    } else {
+        nla_log(LOG_INFO, "%s successful, %d routes", call->rc_rpc, call->rc_count);
+
+        RibCallLatency(call, call->rc_count);
+    }
+
+    RibCallRelease(call);
+    RibCallFree(call);
+
+    nla_stats_queue(NLA_PRPD_CLIENT, RibClientRetryDepth());
+
+    RibBacklogSend();
+
+    if (ribCq->rcq_starved) {
+        RibQueueFlushAll();
+    }
+}
+
+
+/*
+ * Completion queue thread of shard, runs until the queue is shut down and
+ * drained.
+ */
+static void
+RibCqPoll (rib_cq_t *ribCq, rib_shard_t *shard)
+{
+    void *tag;
+    bool ok;
+    char wakeup = 0;
+
+    while (shard->rsh_cq.Next(&tag, &ok)) {
+        {
+            std::lock_guard<std::mutex> lock(ribCq->rcq_lock);
+            ((rib_call_t *)tag)->rc_ok = ok;
+            ribCq->rcq_done.push_back((rib_call_t *)tag);
+        }
+
+        /* A full pipe already has a wakeup pending */
+        while (write(ribCq->rcq_pipeFd[1], &wakeup, sizeof(wakeup)) < 0 &&
+               errno == EINTR) {
+            continue;
+        }
+    }
+}
+
+
+static void
+RibCqPipeRead (evutil_socket_t fd, short event UNUSED, void *arg)
+{
+    rib_cq_t *ribCq = (rib_cq_t *)arg;
+    std::vector<rib_call_t*> done;
+    char wakeup[64];
+
+    while (read(fd, wakeup, sizeof(wakeup)) > 0) {
+        continue;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(ribCq->rcq_lock);
+        done.swap(ribCq->rcq_done);
+    }
+
+    for (auto call : done) {
+        RibCallDone(call);
+    }
+}
+
+
+/*
+ * A channel to ribServerAddr. The channels don't share their connection,
+ * as they would by default.
+ */
+static std::shared_ptr<grpc::Channel>
+RibChannelNew (const char *ribServerAddr)
+{
+    const nla_grpcopt_t *grpcopt = &grpc_ctx.gc_grpcopt;
+    grpc::ChannelArguments args;
+
+    args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+
+    /* A full batch of routes may exceed the default 4MB */
+    if (grpcopt->nlago_max_msg_size != NLA_INVALID) {
+        args.SetMaxSendMessageSize(grpcopt->nlago_max_msg_size);
+        args.SetMaxReceiveMessageSize(grpcopt->nlago_max_msg_size);
+    }
+
+    /* HTTP/2 flow control, the stream window and its autotuning */
+    if (grpcopt->nlago_window_size != NLA_INVALID) {
+        args.SetInt(GRPC_ARG_HTTP2_STREAM_LOOKAHEAD_BYTES, grpcopt->nlago_window_size);
+    }
+    if (grpcopt->nlago_bdp_probe != NLA_INVALID) {
+        args.SetInt(GRPC_ARG_HTTP2_BDP_PROBE, grpcopt->nlago_bdp_probe);
+    }
+    if (grpcopt->nlago_write_buffer_size != NLA_INVALID) {
+        args.SetInt(GRPC_ARG_HTTP2_WRITE_BUFFER_SIZE, grpcopt->nlago_write_buffer_size);
+    }
+
+    if (grpcopt->nlago_keepalive_time != NLA_INVALID) {
+        args.SetInt(GRPC_ARG_KEEPALIVE_TIME_MS, grpcopt->nlago_keepalive_time);
+        /* Otherwise the pings stop after 2 without data */
+        args.SetInt(GRPC_ARG_HTTP2_MAX_PINGS_WITHOUT_DATA, 0);
+    }
+    if (grpcopt->nlago_keepalive_timeout != NLA_INVALID) {
+        args.SetInt(GRPC_ARG_KEEPALIVE_TIMEOUT_MS, grpcopt->nlago_keepalive_timeout);
+    }
+    if (grpcopt->nlago_keepalive_idle != NLA_INVALID) {
+        args.SetInt(GRPC_ARG_KEEPALIVE_PERMIT_WITHOUT_CALLS, grpcopt->nlago_keepalive_idle);
+    }
+    if (grpcopt->nlago_idle_timeout != NLA_INVALID) {
+        args.SetInt(GRPC_ARG_CLIENT_IDLE_TIMEOUT_MS, grpcopt->nlago_idle_timeout);
+    }
+
+    return grpc::CreateCustomChannel(ribServerAddr, grpc::InsecureChannelCredentials(), args);
+}
+
+
+static int
+RibCqStart (const char *ribServerAddr, int maxOutstandingRpcs, const char *spillFile,
+            int channels, bool shardByTable)
+{
+    rib_shard_t *shard;
+    rib_cq_t *ribCq;
+    int i;
+
+    ribCq = new rib_cq_t();
+    ribCq->rcq_shardByTable = shardByTable;
+    ribCq->rcq_maxOutstanding = maxOutstandingRpcs;
+    ribCq->rcq_spillPath = spillFile;
+    ribCq->rcq_spillFd = -1;
+    ribCq->rcq_pipeFd[0] = -1;
+    ribCq->rcq_pipeFd[1] = -1;
+    grpc_ctx.gc_ribCq = ribCq;
+
+    if (pipe2(ribCq->rcq_pipeFd, O_NONBLOCK|O_CLOEXEC) < 0) {
+        nla_log(LOG_INFO, "failed to create pipe");
+        return -1;
+    }
+
+    ribCq->rcq_pipeReadEvent = event_new(nla_gl.nlag_base,
+                                         ribCq->rcq_pipeFd[0],
+                                         EV_READ|EV_PERSIST,
+                                         RibCqPipeRead,
+                                         ribCq);
+
+    if (!ribCq->rcq_pipeReadEvent || event_add(ribCq->rcq_pipeReadEvent, NULL) < 0) {
+        nla_log(LOG_INFO, "failed to add pipe read event");
+        return -1;
+    }
+
+    ribCq->rcq_batchTimer = evtimer_new(nla_gl.nlag_base, RibBatchTimer, NULL);
+    if (!ribCq->rcq_batchTimer) {
+        nla_log(LOG_INFO, "failed to create batch timer");
+        return -1;
+    }
+
+    ribCq->rcq_retryTimer = evtimer_new(nla_gl.nlag_base, RibRetryTimer, NULL);
+    if (!ribCq->rcq_retryTimer) {
+        nla_log(LOG_INFO, "failed to create retry timer");
+        return -1;
+    }
+
+    /* Reconcile with the routes RPD kept */
+    ribCq->rcq_sync = new rib_sync_t();
+    ribCq->rcq_sync->rs_timer = evtimer_new(nla_gl.nlag_base, RibSyncTimer, NULL);
+    if (!ribCq->rcq_sync->rs_timer) {
+        nla_log(LOG_INFO, "failed to create sync timer");
+        return -1;
+    }
+
+    for (i = 0; i < channels; i++) {
+        shard = new rib_shard_t();
+        ribCq->rcq_shards.push_back(shard);
+
+        if (i == 0) {
+            shard->rsh_channel = *grpc_ctx.gc_channel;
+        } else {
+            shard->rsh_channel = RibChannelNew(ribServerAddr);
+            /* Connect right away, only the main channel is watched */
+            shard->rsh_channel->GetState(true);
+        }
+
+        shard->rsh_ribStub = new routing::Rib::Stub(shard->rsh_channel);
+        shard->rsh_thread = new std::thread(RibCqPoll, ribCq, shard);
+    }
+
+    return 0;
+}
+
+
+/*
+ * Cancel the outstanding RPCs and wait for the completion queue to drain.
+ */
+static void
+RibCqStop ()
+{
+    rib_cq_t *ribCq = grpc_ctx.gc_ribCq;
+
+    if (!ribCq) {
+        return;
+    }
+
+    for (auto call : ribCq->rcq_outstanding) {
+        call->rc_context.TryCancel();
+    }
+
+    for (auto shard : ribCq->rcq_shards) {
+        shard->rsh_cq.Shutdown();
+        shard->rsh_thread->join();
+        delete shard->rsh_thread;
+        delete shard->rsh_ribStub;
+        delete shard;
+    }
+
+    /* Every outstanding call has been handed back by the threads */
+    for (auto call : ribCq->rcq_done) {
+        RibCallFree(call);
+    }
+
+    for (auto call : ribCq->rcq_backlog) {
+        RibCallFree(call);
+    }
+
+    for (auto &queue : ribCq->rcq_queues) {
+        RibQueueFree(queue.second);
+    }
+
+    /* The routes RPD kept are reconciled on reconnect */
+    for (auto &retry : ribCq->rcq_retries) {
+        rtnl_route_put(retry.second.rr_route);
+    }
+
+    if (ribCq->rcq_spillFd >= 0) {
+        close(ribCq->rcq_spillFd);
+        unlink(ribCq->rcq_spillPath.c_str());
+    }
+
+    for (auto ribArena : ribCq->rcq_arenas) {
+        RibArenaFree(ribArena);
+    }
+
+    RibSyncFree(ribCq->rcq_sync);
+
+    if (ribCq->rcq_batchTimer) {
+        event_free(ribCq->rcq_batchTimer);
+    }
+
+    if (ribCq->rcq_retryTimer) {
+        event_free(ribCq->rcq_retryTimer);
+    }
+
+    if (ribCq->rcq_pipeReadEvent) {
+        event_free(ribCq->rcq_pipeReadEvent);
+    }
+
+    if (ribCq->rcq_pipeFd[0] >= 0) {
+        close(ribCq->rcq_pipeFd[0]);
+        close(ribCq->rcq_pipeFd[1]);
+    }
+
+    delete ribCq;
+    grpc_ctx.gc_ribCq = NULL;
+}
+
+
+/*
+ * The gateway addresses (or interfaces) of rtNh, in a canonical order, for
+ * comparison.
+ */
+static std::string
+RibSyncNexthop (const routing::RouteNexthop &rtNh)
+{
+    std::vector<std::string> gateways;
+    std::string nexthop;
+
+    for (const auto &rtGw : rtNh.gateways()) {
+        gateways.emplace_back();
+        AppendAddressBytes(rtGw.gateway_address(), &gateways.back());
+        /* Interface only gateways differ by their interface */
+        if (gateways.back().empty()) {
+            gateways.back() = rtGw.interface_name();
+        }
+    }
+
+    std::sort(gateways.begin(), gateways.end());
+    for (const auto &gateway : gateways) {
+        nexthop += gateway;
+    }
+
+    return nexthop;
+}
+
+
+static void
+RibSyncFree (rib_sync_t *sync)
+{
+    if (!sync) {
+        return;
+    }
+
+    for (auto &route : sync->rs_routes) {
+        rtnl_route_put(route.second);
+    }
+
+    if (sync->rs_timer) {
+        event_free(sync->rs_timer);
+    }
+
+    delete sync;
+}
+
+
+/*
+ * All the RouteGet streams are done, add the routes RPD doesn't have and
+ * go live.
+ */
+static void
+RibSyncDone ()
+{
+    rib_cq_t *ribCq = grpc_ctx.gc_ribCq;
+    rib_sync_t *sync = ribCq->rcq_sync;
+
+    nla_log(LOG_NOTICE, "reconciled with RPD: %d unchanged, %d modified, %d removed, %zu added",
+            sync->rs_unchanged, sync->rs_modified, sync->rs_removed, sync->rs_routes.size());
+
+    /* Or updated, if RouteGet failed on their table */
+    for (auto &route : sync->rs_routes) {
+        RibQueueRoute(GetTableName(route.second), route.first, route.second, RIB_OP_UPDATE, 0,
+                      rib_ingress_t());
+    }
+
+    RibSyncFree(sync);
+    ribCq->rcq_sync = NULL;
+
+    RibQueueFlushAll();
+}
+
+
+/*
+ * Diff the routes RPD reported with the held back ones. The held routes
+ * RPD has are sent only if their gateways changed, the routes RPD has and
+ * we don't are removed.
+ */
+static void
+RibSyncReply (rib_sync_t *sync, rib_call_t *get)
+{
+    rib_cq_t *ribCq = grpc_ctx.gc_ribCq;
+    const routing::RouteGetReply &reply = get->rc_getReply;
+    routing::RouteNexthop rtNh;
+    struct rtnl_route *route;
+    std::string key;
+
+    if (reply.status() != routing::SUCCESS && reply.status() != routing::ROUTE_NOT_FOUND) {
+        nla_log(LOG_INFO, "RouteGet %s failed with status %d", get->rc_table.c_str(),
+                reply.status());
+    }
+
+    for (const auto &rtEntry : reply.routes()) {
+        if (rtEntry.key().cookie() != GetCookie()) {
+            continue;
+        }
+
+        key = RibKey(rtEntry.key());
+        if (ribCq->rcq_installed.count(key)) {
+            continue;
+        }
+
+        /* RPD has it */
+        ribCq->rcq_installed.insert(key);
+
+        auto it = sync->rs_routes.find(key);
+        if (it == sync->rs_routes.end()) {
+            route = CreateRouteFromRouteKey(rtEntry.key());
+            if (route) {
+                RibQueueRoute(get->rc_table, key, route, RIB_OP_REMOVE, 0, rib_ingress_t());
+                rtnl_route_put(route);
+                sync->rs_removed++;
+            }
+            continue;
+        }
+
+        rtNh.Clear();
+        rtnl_route_foreach_nexthop(it->second, AddNexthop, &rtNh);
+
+        if (RibSyncNexthop(rtNh) != RibSyncNexthop(rtEntry.nexthop())) {
+            RibQueueRoute(get->rc_table, key, it->second, RIB_OP_UPDATE, 0, rib_ingress_t());
+            sync->rs_modified++;
+        } else {
+            sync->rs_unchanged++;
+        }
+
+        rtnl_route_put(it->second);
+        sync->rs_routes.erase(it);
+    }
+}
+
+
+/*
+ * A RouteGet stream operation completed.
+ */
+static void
+RibSyncGetDone (rib_call_t *call)
+{
+    rib_cq_t *ribCq = grpc_ctx.gc_ribCq;
+    rib_sync_t *sync = ribCq->rcq_sync;
+
+    switch (call->rc_streamState) {
+    case RIB_STREAM_READ:
+        if (call->rc_ok) {
+            RibSyncReply(sync, call);
+        }
+        /* FALLTHROUGH */
+    case RIB_STREAM_START:
+        if (call->rc_ok) {
+            call->rc_streamState = RIB_STREAM_READ;
+            call->rc_getReader->Read(&call->rc_getReply, call);
+        } else {
+            call->rc_streamState = RIB_STREAM_FINISH;
+            call->rc_getReader->Finish(&call->rc_status, call);
+        }
+        return;
+
+    case RIB_STREAM_FINISH:
+        break;
+    }
+
+    ribCq->rcq_outstanding.erase(call);
+
+    if (!call->rc_status.ok()) {
+        nla_log(LOG_WARN, "RouteGet %s failed: %s", call->rc_table.c_str(),
+                call->rc_status.error_message().c_str());
+    }
+
+    RibCallFree(call);
+
+    if (--sync->rs_gets == 0) {
+        RibSyncDone();
+    }
+}
+
+
+/*
+ * Stream the routes with our cookie in table from RPD.
+ */
+static void
+RibSyncGet (rib_sync_t *sync, const std::string &table)
+{
+    rib_cq_t *ribCq = grpc_ctx.gc_ribCq;
+    const rib_table_t *ribTable = RibTableByName(table);
+    routing::RouteMatchFields *rtKey;
+    routing::RouteGetRequest *req;
+    rib_call_t *call;
+
+    call = RibCallNew(table, RIB_OP_GET, 0);
+    req = call->rc_getReq;
+
+    /* Every prefix of the table */
+    rtKey = req->mutable_key();
+    rtKey->set_cookie(GetCookie());
+    rtKey->unsafe_arena_set_allocated_table(const_cast<routing::RouteTable *>(&ribTable->rt_table));
+    if (ribTable->rt_family == AF_INET6) {
+        rtKey->mutable_dest_prefix()->mutable_inet6()->set_addr_bytes(std::string(16, 0));
+    } else {
+        rtKey->mutable_dest_prefix()->mutable_inet()->set_addr_bytes(std::string(4, 0));
+    }
+    rtKey->set_dest_prefix_len(0);
+
+    req->set_match_type(routing::EXACT_OR_LONGER);
+    req->set_reply_address_format(jnxBase::ADDRESS_BYTES);
+    req->set_route_count(NLA_RIB_BATCH_MAX);
+
+    call->rc_getReader = ribCq->rcq_shards[0]->rsh_ribStub->PrepareAsyncRouteGet(
+                             &call->rc_context, *req, &ribCq->rcq_shards[0]->rsh_cq);
+    call->rc_streamState = RIB_STREAM_START;
+    call->rc_getReader->StartCall(call);
+    ribCq->rcq_outstanding.insert(call);
+    sync->rs_gets++;
+}
+
+
+/*
+ * The held back routes are complete, reconcile them with RPD.
+ */
+static void
+RibSyncStart ()
+{
+    rib_sync_t *sync = grpc_ctx.gc_ribCq->rcq_sync;
+
+    if (sync->rs_getting) {
+        return;
+    }
+
+    sync->rs_getting = true;
+    evtimer_del(sync->rs_timer);
+
+    /* RPD may have routes in tables we have none for anymore */
+    for (const auto &table : grpc_ctx.gc_tableMap->rtm_tables) {
+        if (table.rt_family != AF_UNSPEC) {
+            sync->rs_tables.insert(table.rt_name);
+        }
+    }
+
+    nla_log(LOG_INFO, "reconcile %zu routes with RPD", sync->rs_routes.size());
+
+    for (const auto &table : sync->rs_tables) {
+        RibSyncGet(sync, table);
+    }
+}
+
+
+static void
+RibSyncTimer (evutil_socket_t fd UNUSED, short what UNUSED, void *arg UNUSED)
+{
+    nla_log(LOG_WARN, "no end of dump after %d s", NLA_RIB_SYNC_TIMEOUT_S);
+    RibSyncStart();
+}
+
+
+/*
+ * Hold route back until it is reconciled.
+ *
+ * @return false if RPD is known to have it already, and so it has to be
+ *         sent right away.
+ */
+static bool
+RibSyncAddRoute (rib_sync_t *sync, const std::string &key, struct rtnl_route *route)
+{
+    struct timeval timeout = {NLA_RIB_SYNC_TIMEOUT_S, 0};
+
+    if (grpc_ctx.gc_ribCq->rcq_installed.count(key)) {
+        return false;
+    }
+
+    auto held = sync->rs_routes.emplace(key, route);
+    if (!held.second) {
+        rtnl_route_put(held.first->second);
+        held.first->second = route;
+    }
+    nl_object_get(OBJ_CAST(route));
+
+    sync->rs_tables.insert(GetTableName(route));
+
+    if (!sync->rs_getting && !evtimer_pending(sync->rs_timer, NULL)) {
+        evtimer_add(sync->rs_timer, &timeout);
+    }
+
+    return true;
+}
+
+
+/*
+ * @return true if route was held back, and so only has to be forgotten.
+ */
+static bool
+RibSyncRemoveRoute (rib_sync_t *sync, const std::string &key)
+{
+    auto it = sync->rs_routes.find(key);
+
+    if (grpc_ctx.gc_ribCq->rcq_installed.count(key)) {
+        return false;
+    }
+
+    if (it != sync->rs_routes.end()) {
+        rtnl_route_put(it->second);
+        sync->rs_routes.erase(it);
+    }
+
+    return true;
+}
+
+
+int
+RibClientAddRoute (struct rtnl_route *route, int from, uint64_t ingress)
+{
+    rib_cq_t   *ribCq = grpc_ctx.gc_ribCq;
+    std::string key;
+
+    if (!ribCq) {
+        return -1;
+    }
+
+    key = RibRouteKey(route);
+
+    if (ribCq->rcq_sync && RibSyncAddRoute(ribCq->rcq_sync, key, route)) {
+        return 0;
+    }
+
+    RibQueueRoute(GetTableName(route), key, route, RIB_OP_UPDATE, 0, {from, ingress});
+
+    return 0;
+}
+
+
+int
+RibClientRemoveRoute (struct rtnl_route *route, int from, uint64_t ingress)
+{
+    rib_cq_t   *ribCq = grpc_ctx.gc_ribCq;
+    std::string key;
+
+    if (!ribCq) {
+        return -1;
+    }
+
+    key = RibRouteKey(route);
+
+    if (ribCq->rcq_sync && RibSyncRemoveRoute(ribCq->rcq_sync, key)) {
+        return 0;
+    }
+
+    RibQueueRoute(GetTableName(route), key, route, RIB_OP_REMOVE, 0, {from, ingress});
+
+    return 0;
+}
+
+
+/*
+ * Send the routes queued so far without waiting for the batch delay. The
+ * first flush ends the dump of the routes to reconcile.
+ */
+void
+RibClientFlush ()
+{
+    rib_cq_t *ribCq = grpc_ctx.gc_ribCq;
+
+    if (!ribCq) {
+        return;
+    }
+
+    if (ribCq->rcq_sync) {
+        RibSyncStart();
+    }
+
+    RibQueueFlushAll();
+}
+
+
+/*
+ * @return the route operations waiting to be retried, in memory and
+ *         spilled.
+ */
+int
+RibClientRetryDepth ()
+{
+    rib_cq_t *ribCq = grpc_ctx.gc_ribCq;
+
+    if (!ribCq) {
+        return 0;
+    }
+
+    return ribCq->rcq_retries.size() + ribCq->rcq_spilled.size();
+}
+
+
+static int
+GetRtProtocol (routing::RouteProtoType protocol)
+{
+    switch (protocol) {
+    case routing::KERNEL:
+        return RTPROT_KERNEL;
+    case routing::STATIC:
+        return RTPROT_STATIC;
+    case routing::BGP:
+        return RTPROT_BGP;
+    case routing::ISIS:
+        return RTPROT_ISIS;
+    case routing::OSPF:
+    case routing::OSPF3:
+    case routing::OSPF_ANY:
+        return RTPROT_OSPF;
+    case routing::RIP:
+    case routing::RIPNG:
+        return RTPROT_RIP;
+    default:
+        return RTPROT_UNSPEC;
+    }
+}
+
+
+/*
+ * Interface names resolved once, most gateways share a few interfaces. The
+ * cache is cleared when the kernel link messages change a name, and the
+ * unknown interfaces are looked up again, they may show up later.
+ */
+static unsigned int
+RibMonitorIfIndex (rib_monitor_t *ribMon, const std::string &ifName)
+{
+    unsigned int generation = nla_ifname_generation();
+    unsigned int ifIndex;
+
+    if (ribMon->rm_ifGeneration != generation) {
+        ribMon->rm_ifIndex.clear();
+        ribMon->rm_ifGeneration = generation;
+    }
+
+    auto it = ribMon->rm_ifIndex.find(ifName);
+    if (it != ribMon->rm_ifIndex.end()) {
+        return it->second;
+    }
+
+    ifIndex = if_nametoindex(ifName.c_str());
+    if (ifIndex) {
+        ribMon->rm_ifIndex[ifName] = ifIndex;
+    }
+
+    return ifIndex;
+}
+
+
+/*
+ * Append rtEntry to batch as a netlink route message of type msgType.
+ */
+static void
+RibMonitorEncodeRoute (rib_monitor_t *ribMon, rib_stream_t *stream,
+                       const routing::RouteEntry &rtEntry, int msgType,
+                       std::vector<char> &batch)
+{
+    struct rtnl_route *route;
+    struct rtnl_nexthop *rtnh;
+    struct nl_addr *nlAddr;
+    struct nl_msg *nlMsg = NULL;
+    struct nlmsghdr *nlmsghdr;
+    unsigned int ifIndex;
+    int err;
+
+    /* Our own routes, already in the kernel */
+    if (rtEntry.key().cookie() == GetCookie()) {
+        return;
+    }
+
+    nlAddr = CreateNladdrFromNetworkAddress(rtEntry.key().dest_prefix());
+    if (!nlAddr || nl_addr_get_family(nlAddr) != stream->rs_family) {
+        nla_log(LOG_INFO, "%s : unsupported route prefix", stream->rs_table.c_str());
+        if (nlAddr) {
+            nl_addr_put(nlAddr);
+        }
+        return;
+    }
+    nl_addr_set_prefixlen(nlAddr, rtEntry.key().dest_prefix_len());
+
+    route = rtnl_route_alloc();
+    rtnl_route_set_family(route, stream->rs_family);
+    rtnl_route_set_table(route, stream->rs_kernelTable);
+    rtnl_route_set_dst(route, nlAddr);
+    rtnl_route_set_protocol(route, GetRtProtocol(rtEntry.protocol()));
+    nl_addr_put(nlAddr);
+
+    if (msgType == RTM_NEWROUTE) {
+        /* No gateway blackholes the traffic */
+        rtnl_route_set_type(route, rtEntry.nexthop().gateways_size() ? RTN_UNICAST : RTN_BLACKHOLE);
+
+        for (const auto &rtGw : rtEntry.nexthop().gateways()) {
+            rtnh = rtnl_route_nh_alloc();
+
+            if (rtGw.has_gateway_address()) {
+                nlAddr = CreateNladdrFromNetworkAddress(rtGw.gateway_address());
+                if (nlAddr) {
+                    rtnl_route_nh_set_gateway(rtnh, nlAddr);
+                    nl_addr_put(nlAddr);
+                }
+            }
+
+            if (!rtGw.interface_name().empty()) {
+                ifIndex = RibMonitorIfIndex(ribMon, rtGw.interface_name());
+                if (ifIndex) {
+                    rtnl_route_nh_set_ifindex(rtnh, ifIndex);
+                }
+            }
+
+            rtnl_route_add_nexthop(route, rtnh);
+        }
+
+        err = rtnl_route_build_add_request(route, NLM_F_CREATE | NLM_F_REPLACE, &nlMsg);
+    } else {
+        /* Any scope, libnl would guess link scope without a gateway */
+        rtnl_route_set_scope(route, RT_SCOPE_NOWHERE);
+        err = rtnl_route_build_del_request(route, 0, &nlMsg);
+    }
+
+    rtnl_route_put(route);
+
+    if (err < 0) {
+        nla_log(LOG_INFO, "failed to build route request: %s", nl_geterror(err));
+        return;
+    }
+
+    nlmsghdr = nlmsg_hdr(nlMsg);
+    batch.insert(batch.end(), (char *)nlmsghdr, (char *)nlmsghdr + NLMSG_ALIGN(nlmsghdr->nlmsg_len));
+    nlmsg_free(nlMsg);
+}
+
+
+/*
+ * Encode the routes of the last RouteMonitorReply of stream into batch.
+ */
+static void
+RibMonitorEncode (rib_monitor_t *ribMon, rib_stream_t *stream, std::vector<char> &batch)
+{
+    const routing::RouteMonitorReply &reply = stream->rs_reply;
+
+    if (reply.status() != routing::SUCCESS) {
+        nla_log(LOG_WARN, "RouteMonitorRegister %s : status %d",
+                stream->rs_table.c_str(), reply.status());
+        return;
+    }
+
+    for (const auto &entry : reply.monitor_routes()) {
+        switch (entry.monitor_rt_op()) {
+        case routing::ROUTE_MONITOR_ROUTE_OP_ADD:
+        case routing::ROUTE_MONITOR_ROUTE_OP_MODIFY:
+            RibMonitorEncodeRoute(ribMon, stream, entry.route(), RTM_NEWROUTE, batch);
+            break;
+
+        case routing::ROUTE_MONITOR_ROUTE_OP_DELETE:
+        case routing::ROUTE_MONITOR_ROUTE_OP_NO_ADVERTISE:
+            RibMonitorEncodeRoute(ribMon, stream, entry.route(), RTM_DELROUTE, batch);
+            break;
+
+        case routing::ROUTE_MONITOR_ROUTE_OP_END_OF_TABLE:
+            nla_log(LOG_INFO, "RouteMonitorRegister %s : end of table", stream->rs_table.c_str());
+            stream->rs_endOfTable = true;
+            break;
+
+        default:
+            break;
+        }
+    }
+}
+
+
+/*
+ * Queue batch to the event loop, once there is room.
+ *
+ * @return -1 if the monitor is stopped, 0 otherwise.
+ */
+static int
+RibMonitorQueue (rib_monitor_t *ribMon, std::vector<char> &batch)
+{
+    uint64_t one = 1;
+
+    std::unique_lock<std::mutex> lock(ribMon->rm_lock);
+
+    ribMon->rm_cond.wait(lock, [ribMon] {
+        return ribMon->rm_stop || ribMon->rm_batches.size() < NLA_RIB_MONITOR_BACKLOG;
+    });
+
+    if (ribMon->rm_stop) {
+        return -1;
+    }
+
+    ribMon->rm_batches.push_back(std::move(batch));
+    batch.clear();
+
+    while (write(ribMon->rm_eventFd, &one, sizeof(one)) < 0 && errno == EINTR) {
+        continue;
+    }
+
+    return 0;
+}
+
+
+/*
+ * One more table is done with its initial walk, or its stream ended
+ * before. The walk of all the tables is the dump, end it in batch once
+ * they all are.
+ */
+static void
+RibMonitorEndOfTable (rib_monitor_t *ribMon, size_t *endOfTables, std::vector<char> &batch)
+{
+    struct nlmsghdr done;
+
+    if (++*endOfTables < ribMon->rm_streams.size()) {
+        return;
+    }
+
+    memset(&done, 0, sizeof(done));
+    done.nlmsg_len = NLMSG_HDRLEN;
+    done.nlmsg_type = NLMSG_DONE;
+    batch.insert(batch.end(), (char *)&done, (char *)&done + NLMSG_HDRLEN);
+}
+
+
+static void
+RibMonitorPoll (rib_monitor_t *ribMon)
+{
+    std::vector<char> batch;
+    size_t active = ribMon->rm_streams.size();
+    size_t endOfTables = 0;
+    rib_stream_t *stream;
+    bool endOfTable;
+    void *tag;
+    bool ok;
+
+    while (active && ribMon->rm_cq.Next(&tag, &ok)) {
+        stream = (rib_stream_t *)tag;
+
+        switch (stream->rs_state) {
+        case RIB_STREAM_START:
+        case RIB_STREAM_READ:
+            if (!ok) {
+                stream->rs_state = RIB_STREAM_FINISH;
+                stream->rs_reader->Finish(&stream->rs_status, stream);
+                break;
+            }
+
+            if (stream->rs_state == RIB_STREAM_READ) {
+                endOfTable = stream->rs_endOfTable;
+                RibMonitorEncode(ribMon, stream, batch);
+
+                if (!endOfTable && stream->rs_endOfTable) {
+                    RibMonitorEndOfTable(ribMon, &endOfTables, batch);
+                }
+
+                if (!batch.empty()) {
+                    RibMonitorQueue(ribMon, batch);
+                }
+            }
+
+            stream->rs_state = RIB_STREAM_READ;
+            stream->rs_reader->Read(&stream->rs_reply, stream);
+            break;
+
+        case RIB_STREAM_FINISH:
+            nla_log(LOG_INFO, "RouteMonitorRegister %s ended: %s", stream->rs_table.c_str(),
+                    stream->rs_status.error_message().c_str());
+
+            /* Ended before its end of table, the dump must not wait for it */
+            if (!stream->rs_endOfTable) {
+                stream->rs_endOfTable = true;
+                RibMonitorEndOfTable(ribMon, &endOfTables, batch);
+                if (!batch.empty()) {
+                    RibMonitorQueue(ribMon, batch);
+                }
+            }
+
+            active--;
+            break;
+        }
+    }
+}
+
+
+/*
+ * Hand the route batches over to the peers.
+ */
+static void
+RibMonitorEvent (evutil_socket_t fd, short event UNUSED, void *arg)
+{
+    rib_monitor_t *ribMon = (rib_monitor_t *)arg;
+    std::deque<std::vector<char>> batches;
+    uint64_t count;
+
+    if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        nla_log(LOG_INFO, "eventfd read failed: %s", strerror(errno));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(ribMon->rm_lock);
+        batches.swap(ribMon->rm_batches);
+    }
+    ribMon->rm_cond.notify_one();
+
+    for (auto &batch : batches) {
+        nla_nlmsg_walk(batch.data(), batch.size(), nla_prpdc_write_cb);
+    }
+}
+
+
+static void
+RibMonitorStop ()
+{
+    rib_monitor_t *ribMon = grpc_ctx.gc_ribMonitor;
+    void *tag;
+    bool ok;
+
+    if (!ribMon) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(ribMon->rm_lock);
+        ribMon->rm_stop = true;
+    }
+    ribMon->rm_cond.notify_one();
+
+    for (auto stream : ribMon->rm_streams) {
+        stream->rs_context.TryCancel();
+    }
+
+    if (ribMon->rm_thread) {
+        ribMon->rm_thread->join();
+        delete ribMon->rm_thread;
+    }
+
+    ribMon->rm_cq.Shutdown();
+    while (ribMon->rm_cq.Next(&tag, &ok)) {
+        continue;
+    }
+
+    for (auto stream : ribMon->rm_streams) {
+        delete stream;
+    }
+
+    if (ribMon->rm_eventFdEvent) {
+        event_free(ribMon->rm_eventFdEvent);
+    }
+
+    if (ribMon->rm_eventFd >= 0) {
+        close(ribMon->rm_eventFd);
+    }
+
+    delete ribMon;
+    grpc_ctx.gc_ribMonitor = NULL;
+}
+
+
+/*
+ * Register for the routes of tables, and feed them to the peers as they
+ * are streamed back. Only the first call after a reset registers.
+ */
+int
+RibClientMonitor (char **tables, int count)
+{
+    const rib_table_t *table;
+    rib_monitor_t *ribMon;
+    rib_stream_t *stream;
+    int i;
+
+    if (!grpc_ctx.gc_ribStub || grpc_ctx.gc_ribMonitor) {
+        return 0;
+    }
+
+    ribMon = new rib_monitor_t();
+    grpc_ctx.gc_ribMonitor = ribMon;
+
+    ribMon->rm_eventFd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+    if (ribMon->rm_eventFd < 0) {
+        nla_log(LOG_INFO, "failed to create eventfd");
+        goto failed;
+    }
+
+    ribMon->rm_eventFdEvent = event_new(nla_gl.nlag_base,
+                                        ribMon->rm_eventFd,
+                                        EV_READ|EV_PERSIST,
+                                        RibMonitorEvent,
+                                        ribMon);
+
+    if (!ribMon->rm_eventFdEvent || event_add(ribMon->rm_eventFdEvent, NULL) < 0) {
+        nla_log(LOG_INFO, "failed to add eventfd event");
+        goto failed;
+    }
+
+    for (i = 0; i < count; i++) {
+        stream = new rib_stream_t();
+        stream->rs_table = tables[i];
+        stream->rs_family = nla_table_family(tables[i]);
+        table = RibTableByName(tables[i]);
+        stream->rs_kernelTable = table ? table->rt_kernelTable : RT_TABLE_MAIN;
+        stream->rs_state = RIB_STREAM_START;
+
+        stream->rs_context.AddMetadata("client-id", GetClientId());
+        stream->rs_req.mutable_rt_tbl_name()->set_name(tables[i]);
+        stream->rs_req.set_monitor_op(routing::REGISTER_ADD);
+        stream->rs_req.mutable_monitor_flag()->set_request_eor(true);
+        stream->rs_req.set_monitor_ctx(i);
+        stream->rs_req.set_monitor_reply_route_count(NLA_RIB_MONITOR_REPLY_ROUTES);
+
+        stream->rs_reader = grpc_ctx.gc_ribStub->PrepareAsyncRouteMonitorRegister(&stream->rs_context,
+                                                                                 stream->rs_req,
+                                                                                 &ribMon->rm_cq);
+        stream->rs_reader->StartCall(stream);
+        ribMon->rm_streams.push_back(stream);
+
+        nla_log(LOG_INFO, "RouteMonitorRegister %s", tables[i]);
+    }
+
+    ribMon->rm_thread = new std::thread(RibMonitorPoll, ribMon);
+
+    return 0;
+
+failed:
+
+    RibMonitorStop();
+    return -1;
+}
+
+
+/*
+ * Completion queue tags of the connection manager
+ */
+typedef enum conn_mgr_tag_e {
+    CM_TAG_STATE = 1,   /* channel state changed */
+    CM_TAG_LOGIN,       /* login RPC completed */
+    CM_TAG_BACKOFF,     /* login retry */
+    CM_TAG_WAKEUP,      /* stop */
+} conn_mgr_tag_t;
+
+#define CM_TAG(tag) ((void *)(intptr_t)(tag))
+
+
+static const char *
+ChannelStateName (grpc_connectivity_state state)
+{
+    switch (state) {
+    case GRPC_CHANNEL_IDLE:
+        return "GRPC_CHANNEL_IDLE";
+    case GRPC_CHANNEL_CONNECTING:
+        return "GRPC_CHANNEL_CONNECTING";
+    case GRPC_CHANNEL_READY:
+        return "GRPC_CHANNEL_READY";
+    case GRPC_CHANNEL_TRANSIENT_FAILURE:
+        return "GRPC_CHANNEL_TRANSIENT_FAILURE";
+    case GRPC_CHANNEL_SHUTDOWN:
+        return "GRPC_CHANNEL_SHUTDOWN";
+    }
+    return "default";
+}
+
+
+/*
+ * Queue a connection state change to the event loop. Called with cm_lock.
+ */
+static void
+ConnectionManagerQueue (conn_mgr_t *connMgr, nla_event_t event)
+{
+    uint64_t one = 1;
+
+    connMgr->cm_events.push_back(event);
+
+    while (write(connMgr->cm_eventFd, &one, sizeof(one)) < 0 && errno == EINTR) {
+        continue;
+    }
+}
+
+
+static conn_mgr_login_t *
+ConnectionManagerLogin (conn_mgr_t *connMgr)
+{
+    conn_mgr_login_t *login;
+
+    login = new conn_mgr_login_t();
+
+    /*
+     * Build ClientContext object
+     */
+    login->cl_context.AddMetadata("client-id", GetClientId());
+    login->cl_context.set_deadline(std::chrono::system_clock::now() +
+                                   std::chrono::milliseconds(NLA_GRPC_LOGIN_TIMEOUT_MS));
+
+    login->cl_req.set_time(GetPurgeTime());
+
+    login->cl_reader = grpc_ctx.gc_baseStub->PrepareAsyncRoutePurgeTimeConfig(&login->cl_context,
+                                                                             login->cl_req,
+                                                                             &connMgr->cm_cq);
+    login->cl_reader->StartCall();
+    login->cl_reader->Finish(&login->cl_reply, &login->cl_status, CM_TAG(CM_TAG_LOGIN));
+
+    return login;
+}
+
+
+static bool
+ConnectionManagerLoginDone (conn_mgr_login_t *login)
+{
+    if (!login->cl_status.ok()) {
+        nla_log(LOG_INFO, "Config RPC failed");
+        return false;
+    }
+
+    if (login->cl_reply.ret_code() != routing::RET_SUCCESS) {
+        nla_log(LOG_INFO, "Config failed with status %d", login->cl_reply.ret_code());
+        return false;
+    }
+
+    nla_log(LOG_INFO, "Config successful");
+
+    return true;
+}
+
+
+/*
+ * Connection manager thread. It sleeps on its completion queue, and logs
+ * in whenever the channel gets ready, retrying with an exponential
+ * backoff. The state and the stub are only used with cm_lock held, and
+ * not once stopped: the channel may be gone by then, its destruction
+ * completes the state watch.
+ */
+static void
+ConnectionManager (conn_mgr_t *connMgr)
+{
+    std::unique_ptr<grpc::Alarm> backoff;
+    conn_mgr_login_t *login = NULL;
+    grpc_connectivity_state state;
+    void *tag = CM_TAG(CM_TAG_STATE);
+    bool watching = true;
+    bool loggedIn = false;
+    bool up = false;
+    int backoffMs = NLA_GRPC_BACKOFF_MIN_MS;
+    bool ok;
+
+    nla_log(LOG_INFO, "ConnectionManager init");
+
+    std::unique_lock<std::mutex> lock(connMgr->cm_lock);
+
+    for (;;) {
+        switch ((intptr_t)tag) {
+        case CM_TAG_STATE:
+            watching = false;
+            if (connMgr->cm_stop) {
+                break;
+            }
+
+            /* Also try connecting */
+            state = (*grpc_ctx.gc_channel)->GetState(true);
+            nla_log(LOG_INFO, "%s", ChannelStateName(state));
+
+            if (state != GRPC_CHANNEL_READY) {
+                loggedIn = false;
+                if (up) {
+                    up = false;
+                    ConnectionManagerQueue(connMgr, NLA_CONNECTION_DOWN);
+                }
+            } else if (!loggedIn && !login && !backoff) {
+                login = ConnectionManagerLogin(connMgr);
+            }
+
+            (*grpc_ctx.gc_channel)->NotifyOnStateChange(state,
+                std::chrono::system_clock::now() + std::chrono::seconds(NLA_GRPC_WATCH_TIMEOUT_S),
+                &connMgr->cm_cq, CM_TAG(CM_TAG_STATE));
+            watching = true;
+            break;
+
+        case CM_TAG_LOGIN:
+            loggedIn = ConnectionManagerLoginDone(login);
+            delete login;
+            login = NULL;
+            if (connMgr->cm_stop) {
+                break;
+            }
+
+            if (!loggedIn) {
+                nla_log(LOG_INFO, "Login failed, retry in %d ms", backoffMs);
+                backoff.reset(new grpc::Alarm());
+                backoff->Set(&connMgr->cm_cq,
+                             std::chrono::system_clock::now() + std::chrono::milliseconds(backoffMs),
+                             CM_TAG(CM_TAG_BACKOFF));
+                backoffMs = std::min(backoffMs * 2, NLA_GRPC_BACKOFF_MAX_MS);
+                break;
+            }
+
+            nla_log(LOG_INFO, "Login successful");
+            backoffMs = NLA_GRPC_BACKOFF_MIN_MS;
+            if (!up && (*grpc_ctx.gc_channel)->GetState(false) == GRPC_CHANNEL_READY) {
+                up = true;
+                ConnectionManagerQueue(connMgr, NLA_CONNECTION_UP);
+            }
+            break;
+
+        case CM_TAG_BACKOFF:
+            backoff.reset();
+            if (connMgr->cm_stop) {
+                break;
+            }
+
+            if (!loggedIn && !login &&
+                (*grpc_ctx.gc_channel)->GetState(false) == GRPC_CHANNEL_READY) {
+                login = ConnectionManagerLogin(connMgr);
+            }
+            break;
+
+        default:
+            break;
+        }
+
+        if (connMgr->cm_stop) {
+            if (login) {
+                login->cl_context.TryCancel();
+            }
+            if (backoff) {
+                backoff->Cancel();
+            }
+            if (!watching && !login && !backoff) {
+                break;
+            }
+        }
+
+        lock.unlock();
+        if (!connMgr->cm_cq.Next(&tag, &ok)) {
+            break;
+        }
+        lock.lock();
+    }
+
+    nla_log(LOG_INFO, "ConnectionManager terminate");
+}
+
+
+/*
+ * Hand the connection state changes over to the prpd client.
+ */
+static void
+ConnectionManagerEvent (evutil_socket_t fd, short event UNUSED, void *arg)
+{
+    conn_mgr_t *connMgr = (conn_mgr_t *)arg;
+    std::deque<nla_event_t> events;
+    uint64_t count;
+
+    if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        nla_log(LOG_INFO, "eventfd read failed: %s", strerror(errno));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(connMgr->cm_lock);
+        events.swap(connMgr->cm_events);
+    }
+
+    for (auto state : events) {
+        nla_prpdc_event_cb(state);
+    }
+}
+
+
+int
+StartConnectionManager ()
+{
+    conn_mgr_t *connMgr;
+
+    connMgr = new conn_mgr_t();
+    grpc_ctx.gc_connMgr = connMgr;
+
+    connMgr->cm_eventFd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+    if (connMgr->cm_eventFd < 0) {
+        nla_log(LOG_INFO, "failed to create eventfd");
+        return -1;
+    }
+
+    connMgr->cm_eventFdEvent = event_new(nla_gl.nlag_base,
+                                         connMgr->cm_eventFd,
+                                         EV_READ|EV_PERSIST,
+                                         ConnectionManagerEvent,
+                                         connMgr);
+
+    if (!connMgr->cm_eventFdEvent || event_add(connMgr->cm_eventFdEvent, NULL) < 0) {
+        nla_log(LOG_INFO, "failed to add eventfd event");
+        return -1;
+    }
+
+    /* Spawn thread that keeps track of the connection */
+    connMgr->cm_thread = new std::thread(ConnectionManager, connMgr);
+
+    return 0;
+}
+
+
+/*
+ * Ask the connection manager to stop, it exits once the channel is gone.
+ */
+static void
+StopConnectionManager ()
+{
+    conn_mgr_t *connMgr = grpc_ctx.gc_connMgr;
+
+    if (!connMgr) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(connMgr->cm_lock);
+    if (!connMgr->cm_stop) {
+        connMgr->cm_stop = true;
+        connMgr->cm_wakeup.Set(&connMgr->cm_cq, std::chrono::system_clock::now(),
+                               CM_TAG(CM_TAG_WAKEUP));
+    }
+}
+
+
+static void
+FreeConnectionManager ()
+{
+    conn_mgr_t *connMgr = grpc_ctx.gc_connMgr;
+    void *tag;
+    bool ok;
+
+    if (!connMgr) {
+        return;
+    }
+
+    if (connMgr->cm_thread) {
+        connMgr->cm_thread->join();
+        delete connMgr->cm_thread;
+    }
+
+    connMgr->cm_cq.Shutdown();
+    while (connMgr->cm_cq.Next(&tag, &ok)) {
+        continue;
+    }
+
+    if (connMgr->cm_eventFdEvent) {
+        event_free(connMgr->cm_eventFdEvent);
+    }
+
+    if (connMgr->cm_eventFd >= 0) {
+        close(connMgr->cm_eventFd);
+    }
+
+    delete connMgr;
+    grpc_ctx.gc_connMgr = NULL;
+}
+
+
+void
+RibClientReset ()
+{
+    nla_log(LOG_INFO, "RibClientReset");
+
+    StopConnectionManager();
+
+    RibMonitorStop();
+
+    RibCqStop();
+
+    if (grpc_ctx.gc_ribStub) {
+        delete grpc_ctx.gc_ribStub;
+        grpc_ctx.gc_ribStub = NULL;
+    }
+
+    if (grpc_ctx.gc_baseStub) {
+        delete grpc_ctx.gc_baseStub;
+        grpc_ctx.gc_baseStub = NULL;
+    }
+
+    /* Last reference, the channel shuts down */
+    if (grpc_ctx.gc_channel) {
+        delete grpc_ctx.gc_channel;
+        grpc_ctx.gc_channel = NULL;
+    }
+
+    FreeConnectionManager();
+}
+
+
+int
+RibClientInit (char *ribServerAddr, int maxOutstandingRpcs, char *retrySpillFile,
+               int channels, bool shardByTable, const nla_grpcopt_t *grpcopt,
+               bool compress)
+{
+    grpc_ctx.gc_grpcopt = *grpcopt;
+    grpc_ctx.gc_compress = compress;
+
+    /*
      * Instantiate the client. It requires a channel, out of which the actual RPCs
      * are created. This channel models a connection to an endpoint (in this case,
      * localhost at port 50051). We indicate that the channel isn't authenticated
      * (use of InsecureChannelCredentials()).
      */
-    grpc_ctx.gc_channel =
-        new std::shared_ptr<grpc::Channel>(grpc::CreateChannel(ribServerAddr, grpc::InsecureChannelCredentials()));
+    grpc_ctx.gc_channel = new std::shared_ptr<grpc::Channel>(RibChannelNew(ribServerAddr));
 
-    /* Create a std::promise object */
-    grpc_ctx.gc_exitSignal = new std::promise<void>;
+    /* Unless configured, every kernel table maps to inet.0 or inet6.0 */
+    if (!grpc_ctx.gc_tableMap) {
+        RibClientTableMap(NULL, NULL, 0);
+    }
+
+    /* Long lived, shared by all the RPCs */
+    grpc_ctx.gc_ribStub = new routing::Rib::Stub(*grpc_ctx.gc_channel);
+    grpc_ctx.gc_baseStub = new routing::Base::Stub(*grpc_ctx.gc_channel);
 
-    /* Fetch std::future object associated with promise */
-    grpc_ctx.gc_futureObj =
-        new std::future<void>(grpc_ctx.gc_exitSignal->get_future());
+    if (RibCqStart(ribServerAddr, maxOutstandingRpcs, retrySpillFile, channels,
+                   shardByTable) < 0) {
+        return -1;
+    }
 
     if (StartConnectionManager() < 0) {
         return -1;
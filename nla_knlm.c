@@ -60,6 +60,9 @@ nla_module_vector_t nla_knlm_vector;
 /* Netlink socket */
 struct nl_sock *nlsock;
 
+/* When the msgs being read were received, the ingress of their events */
+static uint64_t nla_knlm_rx_time;
+
 
 static void nla_knlm_connect_timer_start(void);
 
@@ -72,6 +75,7 @@ nla_knlm_trigger_event (nla_event_t event, const void *msg, unsigned int msglen)
     evinfo.nlaei_type = event;
     evinfo.nlaei_msglen  = msglen;
     evinfo.nlaei_msg = msg;
+    evinfo.nlaei_time = msg ? nla_knlm_rx_time : 0;
 
     nla_log(LOG_INFO, "from %s trigger event %s ", MODULE(NLA_KNLM), EVENT(event));
     nla_log(LOG_INFO, "msg %p, len %d", msg, msglen);
@@ -100,17 +104,88 @@ nla_knlm_read_nl_msg (struct nl_msg *msg UNUSED, void *arg UNUSED)
 {
     nla_log(LOG_INFO, "read bytes, msg %p len %u", nlmsg_hdr(msg), nlmsg_hdr(msg)->nlmsg_len);
 
-    nla_nlmsg_walk(nlmsg_hdr(msg), nlmsg_hdr(msg)->nlmsg_len, nla_nlmsg_dump);
+    /* Link messages only keep the interface names, they aren't routes */
+    if (nlmsg_hdr(msg)->nlmsg_type == RTM_NEWLINK ||
+        nlmsg_hdr(msg)->nlmsg_type == RTM_DELLINK) {
+        nla_ifname_update(nlmsg_hdr(msg));
+        return 0;
+    }
+
+    if (nla_log_enabled(LOG_INFO)) {
+        nla_nlmsg_walk(nlmsg_hdr(msg), nlmsg_hdr(msg)->nlmsg_len, nla_nlmsg_dump);
+    }
     nla_nlmsg_walk(nlmsg_hdr(msg), nlmsg_hdr(msg)->nlmsg_len, nla_knlm_trigger_write);
 
     return 0;
 }
 
 
+/*
+ * Called for the NLMSG_DONE which ends the dump requested by
+ * nla_knlm_init_flash(). Let the peers know the replay is complete.
+ */
+static int
+nla_knlm_read_nl_done (struct nl_msg *msg, void *arg UNUSED)
+{
+    nla_log(LOG_NOTICE, "route dump done");
+
+    nla_knlm_trigger_event(NLA_END_OF_DUMP, nlmsg_hdr(msg), nlmsg_hdr(msg)->nlmsg_len);
+
+    return NL_STOP;
+}
+
+
+static int
+nla_knlm_read_link (struct nl_msg *msg, void *arg UNUSED)
+{
+    nla_ifname_update(nlmsg_hdr(msg));
+
+    return 0;
+}
+
+
+/*
+ * Learn the names of the existing interfaces. The link events joined
+ * beforehand keep them up to date from then on.
+ */
+static void
+nla_knlm_link_dump (void)
+{
+    struct nl_sock *sock;
+    struct ifinfomsg ifi;
+    int err;
+
+    sock = nl_socket_alloc();
+    if (!sock) {
+        return;
+    }
+
+    nl_socket_disable_auto_ack(sock);
+    nl_socket_modify_cb(sock, NL_CB_VALID, NL_CB_CUSTOM, nla_knlm_read_link, NULL);
+
+    memset(&ifi, 0, sizeof(ifi));
+    ifi.ifi_family = AF_UNSPEC;
+
+    err = nl_connect(sock, NETLINK_ROUTE);
+    if (err >= 0) {
+        err = nl_send_simple(sock, RTM_GETLINK, NLM_F_DUMP, &ifi, sizeof(ifi));
+    }
+    if (err >= 0) {
+        err = nl_recvmsgs_default(sock);
+    }
+    if (err < 0) {
+        nla_log(LOG_WARN, "link dump failed: %s", nl_geterror(err));
+    }
+
+    nl_socket_free(sock);
+}
+
+
 static void
 nla_knlm_socket_read_msg (evutil_socket_t fd UNUSED, short what UNUSED, void *arg)
 {
     nla_log(LOG_INFO, " ");
+    nla_knlm_rx_time = nla_clock_ns();
     nl_recvmsgs_default((struct nl_sock *)arg);
 }
 
@@ -134,6 +209,7 @@ nla_knlm_connect (evutil_socket_t fd UNUSED, short what UNUSED, void *arg UNUSED
 
     /* register callback function, to receive notifications */
     nl_socket_modify_cb(nlsock, NL_CB_VALID, NL_CB_CUSTOM, nla_knlm_read_nl_msg, NULL);
+    nl_socket_modify_cb(nlsock, NL_CB_FINISH, NL_CB_CUSTOM, nla_knlm_read_nl_done, NULL);
 
     /* subscribe to route notifications group */
     nl_join_groups(nlsock, NLA_RTMGRP_ALL);
@@ -156,6 +232,8 @@ nla_knlm_connect (evutil_socket_t fd UNUSED, short what UNUSED, void *arg UNUSED
 
     event_add(nla_knlm_ctx.nlac_socket_read, NULL);
 
+    nla_knlm_link_dump();
+
     nla_knlm_trigger_event(NLA_CONNECTION_UP, NULL, 0);
 
     return;
@@ -177,6 +255,8 @@ nla_knlm_reset (void)
     nl_socket_free(nlsock);
     nlsock = NULL;
 
+    nla_ifname_flush();
+
     nla_context_cleanup(&nla_knlm_ctx);
 }
 
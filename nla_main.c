@@ -49,6 +49,7 @@
 
 /* nla header files. */
 #include <nla_fpm.h>
+#include <nla_shm.h>
 #include <nla_defs.h>
 #include <nla_externs.h>
 
@@ -295,6 +296,10 @@ nla_infra_process_connection_status_change (nla_module_id_t module,
         return 1;
     }
 
+    if (evinfo->nlaei_type == NLA_CONNECTION_DOWN) {
+        nla_stats_reconnect(module);
+    }
+
     nla_infa_modules[module].nlam_connection_state = evinfo->nlaei_type;
 
     nla_log(LOG_NOTICE, "module %s status %s", MODULE(module), EVENT(evinfo->nlaei_type));
@@ -338,6 +343,8 @@ nla_infra_event_dispatcher (nla_module_id_t from, nla_event_info_t *evinfo)
         return;
     }
 
+    nla_stats_module_in(from, evinfo->nlaei_msglen);
+
     for (i = 0; i < NLA_MODULE_ALL; i++) {
 
         if (!nla_is_module_enabled(i)) {
@@ -359,17 +366,27 @@ nla_infra_event_dispatcher (nla_module_id_t from, nla_event_info_t *evinfo)
             continue;
         }
 
+        if (evinfo->nlaei_type == NLA_END_OF_DUMP) {
+            /* a marker, not a route: no policy to evaluate */
+            nla_log(LOG_INFO, "from %s to %s -> event %s ",
+                    MODULE(from), MODULE(i), EVENT(evinfo->nlaei_type));
+            nla_infa_modules[i].nlam_vec->nlamv_notify_cb(from, evinfo);
+            nla_stats_edge(from, (nla_module_id_t)i, evinfo->nlaei_msglen);
+            continue;
+        }
+
         /* evaluate module specific policies to format the message */
-        module_specific_evinfo = nla_policy_evaluate(i, evinfo);
+        module_specific_evinfo = nla_policy_evaluate(from, i, evinfo);
         if (!module_specific_evinfo) {
             nla_log(LOG_INFO, "policy evaluation failed: skip notifying this msg to %s", MODULE(i));
-            return;
+            continue;
         }
 
         nla_log(LOG_INFO, "from %s to %s -> event %s ",
                 MODULE(from), MODULE(i), EVENT(module_specific_evinfo->nlaei_type));
 
         nla_infa_modules[i].nlam_vec->nlamv_notify_cb(from, module_specific_evinfo);
+        nla_stats_edge(from, (nla_module_id_t)i, module_specific_evinfo->nlaei_msglen);
 
         nla_event_info_free(module_specific_evinfo);
     }
@@ -400,28 +417,93 @@ nla_infra_modules_init ()
     nla_infra_register_module(NLA_FPM_CLIENT,  nla_fpm_client_get_vec);
     nla_infra_register_module(NLA_NLM_SERVER,  nla_nlm_server_get_vec);
     nla_infra_register_module(NLA_NLM_CLIENT,  nla_nlm_client_get_vec);
+    nla_infra_register_module(NLA_SHM_SERVER,  nla_shm_server_get_vec);
 
     /* Call init routines of the modules */
     nla_infra_init_all_modules();
 }
 
 
-static void
-nla_infra_get_sockaddr (nla_module_id_t module, struct sockaddr_un *un_addr)
+/*
+ * Build the socket address of the module from server-address and
+ * server-port. server-address is one of
+ *   unix:<path>            unix domain stream socket
+ *   unix-seqpacket:<path>  unix domain seqpacket socket
+ *   <ipv6 address>         TCP over IPv6
+ *   <ipv4 address>         TCP over IPv4
+ * A unix path starting with '@' is in the abstract namespace.
+ *
+ * @return -1 if server-address can't be parsed, 0 otherwise.
+ */
+static int
+nla_infra_get_sockaddr (nla_module_id_t module, nla_sockaddr_t *addr)
 {
-    struct sockaddr_in in_addr;
+    const char *addr_str = nla_infa_modules[module].nlam_config.nlamc_addr;
+    int port = nla_infa_modules[module].nlam_config.nlamc_port;
+    struct sockaddr_un *un_addr;
+    struct sockaddr_in *in_addr;
+    struct sockaddr_in6 *in6_addr;
+    const char *path = NULL;
+    size_t path_len;
+
+    memset(addr, 0, sizeof(nla_sockaddr_t));
+    addr->nlasa_socktype = SOCK_STREAM;
+
+    if (!addr_str) {
+        nla_log(LOG_ERR, "%s : server-address not configured", MODULE(module));
+        return -1;
+    }
+
+    if (!strncmp(addr_str, NLA_UNIX_STREAM_PREFIX, strlen(NLA_UNIX_STREAM_PREFIX))) {
+        path = addr_str + strlen(NLA_UNIX_STREAM_PREFIX);
+    } else if (!strncmp(addr_str, NLA_UNIX_SEQPACKET_PREFIX,
+                        strlen(NLA_UNIX_SEQPACKET_PREFIX))) {
+        path = addr_str + strlen(NLA_UNIX_SEQPACKET_PREFIX);
+        addr->nlasa_socktype = SOCK_SEQPACKET;
+    }
+
+    if (path) {
+        un_addr = (struct sockaddr_un *)&addr->nlasa_addr;
+        path_len = strlen(path);
+        if (!path_len || path_len >= sizeof(un_addr->sun_path)) {
+            nla_log(LOG_ERR, "%s : invalid unix socket path %s", MODULE(module), addr_str);
+            return -1;
+        }
 
-    memset(un_addr, 0, sizeof(struct sockaddr_un));
+        un_addr->sun_family = AF_UNIX;
+        memcpy(un_addr->sun_path, path, path_len);
+        if (path[0] == '@') {
+            /* abstract namespace, the name isn't NUL terminated */
+            un_addr->sun_path[0] = '\0';
+            addr->nlasa_len = offsetof(struct sockaddr_un, sun_path) + path_len;
+        } else {
+            addr->nlasa_len = sizeof(struct sockaddr_un);
+        }
+        return 0;
+    }
 
-    memset(&in_addr, 0, sizeof(in_addr));
+    if (strchr(addr_str, ':')) {
+        in6_addr = (struct sockaddr_in6 *)&addr->nlasa_addr;
+        in6_addr->sin6_family = AF_INET6;
+        in6_addr->sin6_port = htons(port);
+        if (inet_pton(AF_INET6, addr_str, &in6_addr->sin6_addr) != 1) {
+            nla_log(LOG_ERR, "%s : invalid address %s", MODULE(module), addr_str);
+            return -1;
+        }
+        addr->nlasa_len = sizeof(struct sockaddr_in6);
+        return 0;
+    }
 
-    in_addr.sin_family = AF_INET;
-    inet_pton(AF_INET,
-              nla_infa_modules[module].nlam_config.nlamc_addr,
-              &(in_addr.sin_addr.s_addr));
-    in_addr.sin_port = htons(nla_infa_modules[module].nlam_config.nlamc_port);
+    in_addr = (struct sockaddr_in *)&addr->nlasa_addr;
+    in_addr->sin_family = AF_INET;
+    in_addr->sin_port = htons(port);
+    if (inet_pton(AF_INET, addr_str, &in_addr->sin_addr) != 1) {
+        nla_log(LOG_ERR, "%s : invalid address %s", MODULE(module), addr_str);
+        return -1;
+    }
+    addr->nlasa_len = sizeof(struct sockaddr_in);
 
-    memcpy(un_addr, &in_addr, sizeof(struct sockaddr_in));
+    return 0;
 }
 
 
@@ -439,6 +521,138 @@ nla_infra_get_server_port (nla_module_id_t module)
 }
 
 
+static size_t
+nla_infra_get_max_msg_len (nla_module_id_t module)
+{
+    if (nla_infa_modules[module].nlam_config.nlamc_max_msg_len == NLA_INVALID) {
+        return FPM_MAX_MSG_LEN;
+    }
+    return nla_infa_modules[module].nlam_config.nlamc_max_msg_len;
+}
+
+
+static int
+nla_infra_get_fpm_msg_type (nla_module_id_t module)
+{
+    if (nla_infa_modules[module].nlam_config.nlamc_fpm_msg_type == NLA_INVALID) {
+        return FPM_MSG_TYPE_NETLINK;
+    }
+    return nla_infa_modules[module].nlam_config.nlamc_fpm_msg_type;
+}
+
+
+static size_t
+nla_infra_get_ring_size (nla_module_id_t module)
+{
+    if (nla_infa_modules[module].nlam_config.nlamc_ring_size == NLA_INVALID) {
+        return NLA_SHM_RING_SIZE_DEFAULT;
+    }
+    return nla_infa_modules[module].nlam_config.nlamc_ring_size;
+}
+
+
+static bool
+nla_infra_get_replay_cache (nla_module_id_t module)
+{
+    return nla_infa_modules[module].nlam_config.nlamc_replay_cache;
+}
+
+
+static const nla_sockopt_t *
+nla_infra_get_sockopt (nla_module_id_t module)
+{
+    return &nla_infa_modules[module].nlam_config.nlamc_sockopt;
+}
+
+
+static const nla_grpcopt_t *
+nla_infra_get_grpcopt (nla_module_id_t module)
+{
+    return &nla_infa_modules[module].nlam_config.nlamc_grpcopt;
+}
+
+
+static int
+nla_infra_get_compression (nla_module_id_t module)
+{
+    if (nla_infa_modules[module].nlam_config.nlamc_compression == NLA_INVALID) {
+        return NLA_COMPRESSION_NONE;
+    }
+    return nla_infa_modules[module].nlam_config.nlamc_compression;
+}
+
+
+static int
+nla_infra_get_max_outstanding_rpcs (nla_module_id_t module)
+{
+    if (nla_infa_modules[module].nlam_config.nlamc_max_outstanding_rpcs == NLA_INVALID) {
+        return NLA_MAX_OUTSTANDING_RPCS;
+    }
+    return nla_infa_modules[module].nlam_config.nlamc_max_outstanding_rpcs;
+}
+
+
+/*
+ * @return the i-th RIB table to monitor, NULL past the last one.
+ */
+static char *
+nla_infra_get_monitor_table (nla_module_id_t module, int i)
+{
+    if (i >= nla_infa_modules[module].nlam_config.nlamc_monitor_tables) {
+        return NULL;
+    }
+    return nla_infa_modules[module].nlam_config.nlamc_monitor_table[i];
+}
+
+
+/*
+ * @return the file RIB retries overflowing the memory are spilled to.
+ */
+static char *
+nla_infra_get_retry_spill_file (nla_module_id_t module)
+{
+    if (!nla_infa_modules[module].nlam_config.nlamc_retry_spill_file) {
+        return (char *)NLA_RETRY_SPILL_FILE;
+    }
+    return nla_infa_modules[module].nlam_config.nlamc_retry_spill_file;
+}
+
+
+static int
+nla_infra_get_channels (nla_module_id_t module)
+{
+    if (nla_infa_modules[module].nlam_config.nlamc_channels == NLA_INVALID) {
+        return 1;
+    }
+    return nla_infa_modules[module].nlam_config.nlamc_channels;
+}
+
+
+/*
+ * @return the RIB table the i-th table-map maps the kernel table
+ *         kernel_table to, NULL past the last one.
+ */
+static char *
+nla_infra_get_table_map (nla_module_id_t module, int i, uint32_t *kernel_table)
+{
+    if (i >= nla_infa_modules[module].nlam_config.nlamc_table_maps) {
+        return NULL;
+    }
+    *kernel_table = nla_infa_modules[module].nlam_config.nlamc_table_map_id[i];
+    return nla_infa_modules[module].nlam_config.nlamc_table_map[i];
+}
+
+
+static int
+nla_infra_get_channel_shard (nla_module_id_t module)
+{
+    if (nla_infa_modules[module].nlam_config.nlamc_channel_shard == NLA_INVALID) {
+        return NLA_CHANNEL_SHARD_PREFIX;
+    }
+    return nla_infa_modules[module].nlam_config.nlamc_channel_shard;
+}
+
+
 static void
 nla_infra_vec_init (void)
 {
@@ -448,6 +662,19 @@ nla_infra_vec_init (void)
     nla_infra_vector.nlaiv_get_sockaddr = nla_infra_get_sockaddr;
     nla_infra_vector.nlaiv_get_addr_str = nla_infra_get_server_addr_str;
     nla_infra_vector.nlaiv_get_port     = nla_infra_get_server_port;
+    nla_infra_vector.nlaiv_get_max_msg_len = nla_infra_get_max_msg_len;
+    nla_infra_vector.nlaiv_get_fpm_msg_type = nla_infra_get_fpm_msg_type;
+    nla_infra_vector.nlaiv_get_ring_size = nla_infra_get_ring_size;
+    nla_infra_vector.nlaiv_get_replay_cache = nla_infra_get_replay_cache;
+    nla_infra_vector.nlaiv_get_sockopt = nla_infra_get_sockopt;
+    nla_infra_vector.nlaiv_get_grpcopt = nla_infra_get_grpcopt;
+    nla_infra_vector.nlaiv_get_compression = nla_infra_get_compression;
+    nla_infra_vector.nlaiv_get_max_outstanding_rpcs = nla_infra_get_max_outstanding_rpcs;
+    nla_infra_vector.nlaiv_get_monitor_table = nla_infra_get_monitor_table;
+    nla_infra_vector.nlaiv_get_retry_spill_file = nla_infra_get_retry_spill_file;
+    nla_infra_vector.nlaiv_get_channels = nla_infra_get_channels;
+    nla_infra_vector.nlaiv_get_table_map = nla_infra_get_table_map;
+    nla_infra_vector.nlaiv_get_channel_shard = nla_infra_get_channel_shard;
 }
 
 
@@ -521,19 +748,20 @@ nla_global_init()
      * explicitly specified
      */
     nla_gl.nlag_trace_fd = stdout;
-#if 0
-    FILE *fd;
-    /* trace file */
+
+    /* stats page */
+    if (!nla_gl.nlag_stats_file) {
+        nla_gl.nlag_stats_file = strdup(NLA_STATS_FILE);
+    }
+
+    /* trace file, binary traces drained off the hot path */
     if (nla_gl.nlag_trace_file) {
-        fd = fopen(nla_gl.nlag_trace_file, "w");
-        if (fd) {
-            nla_gl.nlag_trace_fd = fd;
-        } else {
+        if (nla_trace_start(nla_gl.nlag_trace_file) < 0) {
             nla_log0(LOG_ERR, "Failed to create trace file %s!", nla_gl.nlag_trace_file);
             return;
         }
+        nla_gl.nlag_trace_bin = true;
     }
-#endif
 }
 
 
@@ -546,7 +774,20 @@ nla_global_cleanup()
         nla_gl.nlag_config_file = NULL;
     }
 
+    /* stats page */
+    nla_stats_stop();
+
+    if (nla_gl.nlag_stats_file) {
+        free(nla_gl.nlag_stats_file);
+        nla_gl.nlag_stats_file = NULL;
+    }
+
     /* trace file */
+    if (nla_gl.nlag_trace_bin) {
+        nla_gl.nlag_trace_bin = false;
+        nla_trace_stop();
+    }
+
     if (nla_gl.nlag_trace_file) {
         free(nla_gl.nlag_trace_file);
         nla_gl.nlag_trace_file = NULL;
@@ -586,7 +827,7 @@ main (int argc, char **argv)
     /*
      * Read command line arguments
      */
-    while ((opt = getopt(argc, argv, "c:f:t:Nv")) != EOF) {
+    while ((opt = getopt(argc, argv, "c:f:s:t:Nv")) != EOF) {
         switch(opt) {
             case 'c':                                   /* config file */
                 nla_gl.nlag_config_file = strdup(optarg);
@@ -596,12 +837,20 @@ main (int argc, char **argv)
                 nla_gl.nlag_trace_file = strdup(optarg);
                 break;
 
+            case 's':                                   /* stats file */
+                nla_gl.nlag_stats_file = strdup(optarg);
+                break;
+
             case 'N':                                   /* don't fork a child */
                 nla_gl.nlag_dont_daemonize = true;
                 break;
 
             case 't':                                   /* trace level */
                 nla_gl.nlag_trace_level = atoi(optarg);
+                if (nla_gl.nlag_trace_level > NLA_MIN_LOG_LEVEL) {
+                    fprintf(stderr, "trace level %d not built in, up to %d only\n",
+                            nla_gl.nlag_trace_level, NLA_MIN_LOG_LEVEL);
+                }
                 break;
 
             case 'v':                                   /* show version */
@@ -610,7 +859,7 @@ main (int argc, char **argv)
 
             case '?':
             default:                              /* unsupported */
-                fprintf(stdout, "usage: nlagent [-v]  [-c config-filename] [-t trace-level -f -trace-filename]\n");
+                fprintf(stdout, "usage: nlagent [-v]  [-c config-filename] [-t trace-level -f -trace-filename] [-s stats-filename]\n");
                 exit(1);
         }
     }
@@ -631,6 +880,8 @@ main (int argc, char **argv)
         exit(1);
     }
 
+    nla_stats_start(nla_gl.nlag_stats_file);
+
     nla_infra_init();
 
     /* Wait for events */
@@ -55,6 +55,15 @@
 nla_context_t       nla_nlm_client_ctx;
 nla_module_vector_t nla_nlm_client_vector;
 
+
+/* Compression negotiation */
+static struct event  *nla_nlm_client_hello_timer;
+static nla_zstream_t *nla_nlm_client_zstream;
+
+/* Reset once the read callback is done with the input buffer */
+static bool           nla_nlm_client_reset_pending;
+
+
 static void nla_nlm_client_server_connect_timer_start ();
 
 
@@ -66,6 +75,7 @@ nla_nlm_client_trigger_event (nla_event_t event, const void *msg, unsigned int m
     evinfo.nlaei_type = event;
     evinfo.nlaei_msglen  = msglen;
     evinfo.nlaei_msg = msg;
+    evinfo.nlaei_time = msg ? nla_clock_ns() : 0;
 
     nla_log(LOG_INFO, "from %s trigger event %s ", MODULE(NLA_NLM_CLIENT), EVENT(event));
     nla_log(LOG_INFO, "msg %p, len %d", msg, msglen);
@@ -76,54 +86,125 @@ nla_nlm_client_trigger_event (nla_event_t event, const void *msg, unsigned int m
 static void
 nla_nlm_client_trigger_write (const void *msg, unsigned int msg_len)
 {
-    nla_nlm_client_trigger_event(NLA_WRITE, msg, msg_len);
+    nla_nlm_client_trigger_event(nla_nlmsg_event(msg), msg, msg_len);
 }
 
 
 static void
-nla_nlm_client_write_cb (struct bufferevent *bev UNUSED, void *ctx UNUSED)
+nla_nlm_client_write_cb (struct bufferevent *bev, void *ctx UNUSED)
 {
     nla_log(LOG_INFO, "sent msg");
+
+    nla_bufferevent_uncork(bev, nla_nlm_client_ctx.nlac_infravec->nlaiv_get_sockopt(NLA_NLM_CLIENT));
+
+    nla_stats_queue(NLA_NLM_CLIENT, evbuffer_get_length(bufferevent_get_output(bev)));
 }
 
 
+/*
+ * Output of the compression thread.
+ */
 static void
-nla_nlm_client_read_cb (struct bufferevent *bev, void *ctx UNUSED)
+nla_nlm_client_zstream_out (const void *data, size_t len)
 {
-    struct evbuffer *inevb;
-    struct nlmsghdr  nlmhdr;
-    uint8_t data[8192];
-    size_t n;
-
-    for (;;) {
-        /* Read one fpm message at a time. */
-        inevb = bufferevent_get_input(bev);
-        n = evbuffer_get_length(inevb);
-        if (n <= 0) {
-            /* Done. */
-            break;
-        }
+    if (!data) {
+        nla_log(LOG_WARN, "compression failed, reset the connection");
+        nla_stats_write_failure(NLA_NLM_CLIENT, 1);
+        nla_nlm_client_trigger_event(NLA_CONNECTION_DOWN, NULL, 0);
+        nla_nlm_client_server_connect_timer_start();
+        return;
+    }
 
-        if (n < NL_MSG_HDR_LEN) {
-            nla_log(LOG_INFO, "[read bytes %zu] We should never come here", n);
-            break;
+    nla_log(LOG_INFO, "write %zu compressed bytes", len);
+
+    if (bufferevent_write(nla_nlm_client_ctx.nlac_bev, data, len) < 0) {
+        nla_log(LOG_INFO, "bufferevent_write failed");
+        nla_stats_write_failure(NLA_NLM_CLIENT, 1);
+        return;
+    }
+
+    nla_stats_queue(NLA_NLM_CLIENT,
+                    evbuffer_get_length(bufferevent_get_output(nla_nlm_client_ctx.nlac_bev)));
+}
+
+
+/*
+ * The compression is settled, the connection can be used.
+ */
+static void
+nla_nlm_client_hello_done (int compression)
+{
+    if (nla_nlm_client_hello_timer) {
+        event_free(nla_nlm_client_hello_timer);
+        nla_nlm_client_hello_timer = NULL;
+    }
+
+    if (compression == NLA_COMPRESSION_ZLIB) {
+        nla_nlm_client_zstream = nla_zstream_new(true, nla_nlm_client_zstream_out);
+        if (!nla_nlm_client_zstream) {
+            /*
+             * The server expects a compressed stream. We are called from
+             * nla_nlmsg_read(), which still walks the input buffer of the
+             * connection: nla_nlm_client_read_cb() resets it.
+             */
+            nla_nlm_client_reset_pending = true;
+            return;
         }
+    }
 
-        /* Take a look at the fpm header to find out the msg length */
-        evbuffer_copyout(inevb, &nlmhdr, NL_MSG_HDR_LEN);
+    nla_log(LOG_NOTICE, "connection with nlm server established, compression %s",
+            compression == NLA_COMPRESSION_ZLIB ? "zlib" : "none");
 
-        if (n < NLMSG_ALIGN(nlmhdr.nlmsg_len)) {
-            nla_log(LOG_INFO, "[read bytes %zu, nlmsg len %d] Not enough data to proceed",
-                    n, NLMSG_ALIGN(nlmhdr.nlmsg_len));
-            break;
+    nla_nlm_client_trigger_event(NLA_CONNECTION_UP, NULL, 0);
+}
+
+
+/*
+ * The server didn't answer the compression offer. Falling back to no
+ * compression would read a late answer as a route, while the server
+ * expects a compressed stream, so start over instead.
+ */
+static void
+nla_nlm_client_hello_timeout (evutil_socket_t fd UNUSED, short what UNUSED, void *arg UNUSED)
+{
+    nla_log(LOG_WARN, "nlm server didn't answer the compression offer, reset the connection");
+    nla_nlm_client_server_connect_timer_start();
+}
+
+
+static void
+nla_nlm_client_read_msg (const void *msg, unsigned int msg_len)
+{
+    int compression;
+
+    if (nla_nlm_client_reset_pending) {
+        return;
+    }
+
+    if (nla_nlm_hello_parse(msg, msg_len, &compression)) {
+        if (nla_nlm_client_hello_timer) {
+            nla_nlm_client_hello_done(compression);
+        } else {
+            nla_log(LOG_WARN, "unexpected compression answer from nlm server, dropped");
         }
+        return;
+    }
 
-        n = bufferevent_read(bev, data, NLMSG_ALIGN(nlmhdr.nlmsg_len));
+    nla_nlm_client_trigger_write(msg, msg_len);
+}
 
-        nla_log(LOG_INFO, "read bytes, msg %p len %zu", data, n);
 
-        nla_nlmsg_walk(data, n, nla_nlmsg_dump);
-        nla_nlmsg_walk(data, n, nla_nlm_client_trigger_write);
+static void
+nla_nlm_client_read_cb (struct bufferevent *bev, void *ctx UNUSED)
+{
+    if (nla_nlmsg_read(bufferevent_get_input(bev), nla_nlm_client_read_msg) < 0) {
+        nla_log(LOG_WARN, "malformed msg from nlm server, reset the connection");
+        nla_nlm_client_trigger_event(NLA_CONNECTION_DOWN, NULL, 0);
+        nla_nlm_client_server_connect_timer_start();
+    } else if (nla_nlm_client_reset_pending) {
+        nla_log(LOG_WARN, "compression setup failed, reset the connection");
+        nla_nlm_client_trigger_event(NLA_CONNECTION_DOWN, NULL, 0);
+        nla_nlm_client_server_connect_timer_start();
     }
 }
 
@@ -131,6 +212,7 @@ nla_nlm_client_read_cb (struct bufferevent *bev, void *ctx UNUSED)
 static void
 nla_nlm_client_event_cb (struct bufferevent *bev, short what, void *ctx UNUSED)
 {
+    struct timeval hello_timeout = {2,0};
 
     /* Errors */
     nla_log(LOG_INFO, "0x%x", what);
@@ -139,7 +221,24 @@ nla_nlm_client_event_cb (struct bufferevent *bev, short what, void *ctx UNUSED)
         /* We are good */
         nla_log(LOG_INFO, "[event 0x%x] connection with nlm server established", what);
         bufferevent_enable(bev, EV_READ | EV_WRITE);
-        nla_nlm_client_trigger_event(NLA_CONNECTION_UP, NULL, 0);
+
+        if (nla_nlm_client_ctx.nlac_infravec->nlaiv_get_compression(NLA_NLM_CLIENT) ==
+            NLA_COMPRESSION_NONE) {
+            nla_nlm_client_trigger_event(NLA_CONNECTION_UP, NULL, 0);
+            return;
+        }
+
+        /*
+         * Offer compression, and hold everything else until the server
+         * answers. A server not supporting it never does, and the
+         * connection is reset. Without compression configured the offer
+         * isn't sent, so such a server never sees it.
+         */
+        nla_nlm_hello_write(bev, NLA_COMPRESSION_ZLIB);
+        nla_nlm_client_hello_timer = evtimer_new(nla_gl.nlag_base,
+                                                 nla_nlm_client_hello_timeout,
+                                                 NULL);
+        evtimer_add(nla_nlm_client_hello_timer, &hello_timeout);
     } else {
         if (what & BEV_EVENT_EOF) {
             nla_log(LOG_INFO, "Connection closed.\n");
@@ -163,15 +262,16 @@ nla_nlm_client_server_connect (evutil_socket_t fd UNUSED,
                                short what UNUSED,
                                void *arg UNUSED)
 {
-    struct sockaddr_un addr;
+    nla_sockaddr_t addr;
 
     nla_log(LOG_INFO, " ");
 
-    nla_nlm_client_ctx.nlac_infravec->nlaiv_get_sockaddr(NLA_NLM_CLIENT, &addr);
+    if (nla_nlm_client_ctx.nlac_infravec->nlaiv_get_sockaddr(NLA_NLM_CLIENT, &addr) < 0) {
+        goto retry;
+    }
 
-    nla_nlm_client_ctx.nlac_bev = bufferevent_socket_new(nla_gl.nlag_base,
-                                                         -1,
-                                                         BEV_OPT_CLOSE_ON_FREE);
+    nla_nlm_client_ctx.nlac_bev = nla_bufferevent_new(-1, &addr,
+                                                      nla_nlm_client_ctx.nlac_infravec->nlaiv_get_sockopt(NLA_NLM_CLIENT));
     if (!nla_nlm_client_ctx.nlac_bev) {
         nla_log(LOG_INFO, "bufferevent_socket_new failure");
         goto retry;
@@ -183,9 +283,12 @@ nla_nlm_client_server_connect (evutil_socket_t fd UNUSED,
                       nla_nlm_client_event_cb, NULL);
 
     if (bufferevent_socket_connect(nla_nlm_client_ctx.nlac_bev,
-                                   (struct sockaddr *)&addr,
-                                   sizeof(addr)) < 0) {
+                                   (struct sockaddr *)&addr.nlasa_addr,
+                                   addr.nlasa_len) < 0) {
         nla_log(LOG_INFO, "bufferevent_socket_connect failure");
+        /* e.g. the unix socket path doesn't exist yet */
+        bufferevent_free(nla_nlm_client_ctx.nlac_bev);
+        nla_nlm_client_ctx.nlac_bev = NULL;
         goto retry;
     }
 
@@ -201,6 +304,16 @@ static void
 nla_nlm_client_reset (void)
 {
     nla_log(LOG_INFO, " ");
+
+    if (nla_nlm_client_hello_timer) {
+        event_free(nla_nlm_client_hello_timer);
+        nla_nlm_client_hello_timer = NULL;
+    }
+
+    nla_zstream_free(nla_nlm_client_zstream);
+    nla_nlm_client_zstream = NULL;
+    nla_nlm_client_reset_pending = false;
+
     nla_context_cleanup(&nla_nlm_client_ctx);
 }
 
@@ -249,17 +362,34 @@ nla_nlm_client_init_flash (void)
 
 
 static void
-nla_nlm_client_notify (nla_module_id_t from UNUSED, nla_event_info_t *evinfo)
+nla_nlm_client_notify (nla_module_id_t from, nla_event_info_t *evinfo)
 {
     struct evbuffer *outevb;
 
     switch (evinfo->nlaei_type) {
     case NLA_WRITE:
-        outevb = evbuffer_new();
-
+    case NLA_END_OF_DUMP:
         nla_log(LOG_INFO, "%s : write to nlm server, msg %p len %d",
                 EVENT(evinfo->nlaei_type), evinfo->nlaei_msg, evinfo->nlaei_msglen);
 
+        if (!nla_bufferevent_msg_fits(nla_nlm_client_ctx.nlac_bev, evinfo->nlaei_msglen)) {
+            nla_log(LOG_WARN, "msg len %d exceeds the seqpacket max %d, dropped",
+                    evinfo->nlaei_msglen, NLA_SEQPACKET_MAX_LEN);
+            nla_stats_write_failure(NLA_NLM_CLIENT, 1);
+            break;
+        }
+
+        /* Counted before the compression */
+        nla_stats_module_out(NLA_NLM_CLIENT, evinfo->nlaei_msglen);
+        nla_stats_latency(from, NLA_NLM_CLIENT, evinfo->nlaei_time);
+
+        if (nla_nlm_client_zstream) {
+            nla_zstream_push(nla_nlm_client_zstream, evinfo->nlaei_msg, evinfo->nlaei_msglen);
+            break;
+        }
+
+        outevb = evbuffer_new();
+
         evbuffer_add(outevb, evinfo->nlaei_msg, evinfo->nlaei_msglen);
 
         if (bufferevent_write_buffer(nla_nlm_client_ctx.nlac_bev, outevb) < 0) {
@@ -273,6 +403,9 @@ nla_nlm_client_notify (nla_module_id_t from UNUSED, nla_event_info_t *evinfo)
 
         evbuffer_free(outevb);
 
+        nla_stats_queue(NLA_NLM_CLIENT,
+                        evbuffer_get_length(bufferevent_get_output(nla_nlm_client_ctx.nlac_bev)));
+
         break;
 
     default:
@@ -56,6 +56,13 @@
 nla_context_t       nla_nlm_server_ctx;
 nla_module_vector_t nla_nlm_server_vector;
 
+
+/* Compression negotiation */
+static bool           nla_nlm_server_hello_done;
+static nla_zstream_t *nla_nlm_server_zstream;
+static struct evbuffer *nla_nlm_server_zin;     /* decompressed stream */
+
+
 static void nla_nlm_server_listener_timer_start ();
 
 
@@ -67,6 +74,7 @@ nla_nlm_server_trigger_event (nla_event_t event, const void *msg, unsigned int m
     evinfo.nlaei_type = event;
     evinfo.nlaei_msglen  = msglen;
     evinfo.nlaei_msg = msg;
+    evinfo.nlaei_time = msg ? nla_clock_ns() : 0;
 
     nla_log(LOG_INFO, "from %s trigger event %s ", MODULE(NLA_NLM_SERVER), EVENT(event));
     nla_log(LOG_INFO, "msg %p, len %d", msg, msglen);
@@ -77,54 +85,136 @@ nla_nlm_server_trigger_event (nla_event_t event, const void *msg, unsigned int m
 static void
 nla_nlm_server_trigger_write (const void *msg, unsigned int msg_len)
 {
-    nla_nlm_server_trigger_event(NLA_WRITE, msg, msg_len);
+    nla_nlm_server_trigger_event(nla_nlmsg_event(msg), msg, msg_len);
 }
 
 
 static void
-nla_nlm_server_write_cb (struct bufferevent *bev UNUSED, void *ctx UNUSED)
+nla_nlm_server_write_cb (struct bufferevent *bev, void *ctx UNUSED)
 {
     nla_log(LOG_INFO, "sent msg");
+
+    nla_bufferevent_uncork(bev, nla_nlm_server_ctx.nlac_infravec->nlaiv_get_sockopt(NLA_NLM_SERVER));
+
+    nla_stats_queue(NLA_NLM_SERVER, evbuffer_get_length(bufferevent_get_output(bev)));
 }
 
 
+/*
+ * Output of the decompression thread.
+ */
 static void
-nla_nlm_server_read_cb (struct bufferevent *bev, void *ctx UNUSED)
+nla_nlm_server_zstream_out (const void *data, size_t len)
 {
-    struct evbuffer *inevb;
-    struct nlmsghdr  nlmhdr;
-    uint8_t data[8192];
-    size_t n;
-
-    for (;;) {
-        /* Read one fpm message at a time. */
-        inevb = bufferevent_get_input(bev);
-        n = evbuffer_get_length(inevb);
-        if (n <= 0) {
-            /* Done. */
-            break;
-        }
+    if (!data) {
+        nla_log(LOG_WARN, "decompression failed, reset the connection");
+        goto failed;
+    }
 
-        if (n < NL_MSG_HDR_LEN) {
-            nla_log(LOG_INFO, "[read bytes %zu] We should never come here", n);
-            break;
-        }
+    nla_log(LOG_INFO, "read %zu decompressed bytes", len);
 
-        /* Take a look at the nlmsghdr header to find out the msg length */
-        evbuffer_copyout(inevb, &nlmhdr, NL_MSG_HDR_LEN);
+    evbuffer_add(nla_nlm_server_zin, data, len);
 
-        if (n < NLMSG_ALIGN(nlmhdr.nlmsg_len)) {
-            nla_log(LOG_INFO, "[read bytes %zu, nlmsg len %d] Not enough data to proceed",
-                    n, NLMSG_ALIGN(nlmhdr.nlmsg_len));
-            break;
+    if (nla_nlmsg_read(nla_nlm_server_zin, nla_nlm_server_trigger_write) < 0) {
+        nla_log(LOG_WARN, "malformed msg from nlm client, reset the connection");
+        goto failed;
+    }
+
+    return;
+
+failed:
+
+    nla_nlm_server_trigger_event(NLA_CONNECTION_DOWN, NULL, 0);
+    nla_nlm_server_listener_timer_start();
+}
+
+
+/*
+ * Answer the compression offered by the client, if the connection starts
+ * with one.
+ *
+ * @return false until the first message is received.
+ */
+static bool
+nla_nlm_server_read_hello (struct bufferevent *bev)
+{
+    struct evbuffer *inevb = bufferevent_get_input(bev);
+    struct nlmsghdr nlmsghdr;
+    size_t msg_len;
+    unsigned char *msg;
+    int compression;
+
+    if (evbuffer_get_length(inevb) < NLMSG_HDRLEN) {
+        return false;
+    }
+
+    evbuffer_copyout(inevb, &nlmsghdr, NLMSG_HDRLEN);
+    if (nlmsghdr.nlmsg_type != NLMSG_NOOP ||
+        nlmsghdr.nlmsg_len != NLMSG_LENGTH(sizeof(nla_nlm_hello_t))) {
+        /* Not offered */
+        nla_nlm_server_hello_done = true;
+        return true;
+    }
+
+    msg_len = NLMSG_ALIGN(nlmsghdr.nlmsg_len);
+    if (evbuffer_get_length(inevb) < msg_len) {
+        return false;
+    }
+
+    nla_nlm_server_hello_done = true;
+
+    msg = evbuffer_pullup(inevb, msg_len);
+    if (!msg || !nla_nlm_hello_parse(msg, msg_len, &compression)) {
+        return true;
+    }
+    evbuffer_drain(inevb, msg_len);
+
+    if (compression != NLA_COMPRESSION_ZLIB ||
+        nla_nlm_server_ctx.nlac_infravec->nlaiv_get_compression(NLA_NLM_SERVER) !=
+        NLA_COMPRESSION_ZLIB) {
+        compression = NLA_COMPRESSION_NONE;
+    }
+
+    if (compression == NLA_COMPRESSION_ZLIB) {
+        nla_nlm_server_zin = evbuffer_new();
+        nla_nlm_server_zstream = nla_zstream_new(false, nla_nlm_server_zstream_out);
+        if (!nla_nlm_server_zin || !nla_nlm_server_zstream) {
+            compression = NLA_COMPRESSION_NONE;
         }
+    }
 
-        n = bufferevent_read(bev, data, NLMSG_ALIGN(nlmhdr.nlmsg_len));
+    nla_log(LOG_NOTICE, "nlm client compression %s",
+            compression == NLA_COMPRESSION_ZLIB ? "zlib" : "none");
 
-        nla_log(LOG_INFO, "read bytes, msg %p len %zu", data, n);
+    nla_nlm_hello_write(bev, compression);
 
-        nla_nlmsg_walk(data, n, nla_nlmsg_dump);
-        nla_nlmsg_walk(data, n, nla_nlm_server_trigger_write);
+    return true;
+}
+
+
+static void
+nla_nlm_server_read_cb (struct bufferevent *bev, void *ctx UNUSED)
+{
+    struct evbuffer *inevb = bufferevent_get_input(bev);
+    struct evbuffer_iovec vec;
+
+    if (!nla_nlm_server_hello_done && !nla_nlm_server_read_hello(bev)) {
+        return;
+    }
+
+    if (nla_nlm_server_zstream) {
+        /* Hand over the compressed stream as is */
+        while (evbuffer_peek(inevb, -1, NULL, &vec, 1) > 0) {
+            nla_zstream_push(nla_nlm_server_zstream, vec.iov_base, vec.iov_len);
+            evbuffer_drain(inevb, vec.iov_len);
+        }
+        return;
+    }
+
+    if (nla_nlmsg_read(inevb, nla_nlm_server_trigger_write) < 0) {
+        nla_log(LOG_WARN, "malformed msg from nlm client, reset the connection");
+        nla_nlm_server_trigger_event(NLA_CONNECTION_DOWN, NULL, 0);
+        nla_nlm_server_listener_timer_start();
     }
 }
 
@@ -165,9 +255,8 @@ nla_nlm_server_accept_connections (struct evconnlistener *listener UNUSED,
         return;
     }
 
-    nla_nlm_server_ctx.nlac_bev = bufferevent_socket_new(nla_gl.nlag_base,
-                                                         fd,
-                                                         BEV_OPT_CLOSE_ON_FREE);
+    nla_nlm_server_ctx.nlac_bev = nla_bufferevent_new(fd, NULL,
+                                                      nla_nlm_server_ctx.nlac_infravec->nlaiv_get_sockopt(NLA_NLM_SERVER));
     if (!nla_nlm_server_ctx.nlac_bev) {
         nla_log(LOG_INFO, "bufferevent_socket_new failure");
         return;
@@ -203,19 +292,16 @@ nla_nlm_server_listener (evutil_socket_t fd UNUSED,
                      short what UNUSED,
                      void *arg UNUSED)
 {
-    struct sockaddr_un addr;
+    nla_sockaddr_t addr;
 
     nla_log(LOG_INFO, " ");
 
-    nla_nlm_server_ctx.nlac_infravec->nlaiv_get_sockaddr(NLA_NLM_SERVER, &addr);
+    if (nla_nlm_server_ctx.nlac_infravec->nlaiv_get_sockaddr(NLA_NLM_SERVER, &addr) < 0) {
+        return;
+    }
 
-    nla_nlm_server_ctx.nlac_listener = evconnlistener_new_bind(nla_gl.nlag_base,
-                                           nla_nlm_server_accept_connections,
-                                           NULL,
-                                           LEV_OPT_REUSEABLE|LEV_OPT_CLOSE_ON_FREE,
-                                           -1,
-                                           (struct sockaddr*)&addr,
-                                           sizeof(addr));
+    nla_nlm_server_ctx.nlac_listener = nla_listener_new(&addr,
+                                           nla_nlm_server_accept_connections);
 
     if (!nla_nlm_server_ctx.nlac_listener) {
         nla_log(LOG_INFO, "failed to create a listener!\n");
@@ -231,6 +317,17 @@ static void
 nla_nlm_server_reset (void)
 {
     nla_log(LOG_INFO, " ");
+
+    nla_nlm_server_hello_done = false;
+
+    nla_zstream_free(nla_nlm_server_zstream);
+    nla_nlm_server_zstream = NULL;
+
+    if (nla_nlm_server_zin) {
+        evbuffer_free(nla_nlm_server_zin);
+        nla_nlm_server_zin = NULL;
+    }
+
     nla_context_cleanup(&nla_nlm_server_ctx);
 }
 
@@ -279,17 +376,25 @@ nla_nlm_server_init_flash (void)
 
 
 static void
-nla_nlm_server_notify (nla_module_id_t from UNUSED, nla_event_info_t *evinfo)
+nla_nlm_server_notify (nla_module_id_t from, nla_event_info_t *evinfo)
 {
     struct evbuffer *outevb;
 
     switch(evinfo->nlaei_type) {
     case NLA_WRITE:
-        outevb = evbuffer_new();
-
+    case NLA_END_OF_DUMP:
         nla_log(LOG_INFO, "%s : write to fpm client, msg %p len %d",
                 EVENT(evinfo->nlaei_type), evinfo->nlaei_msg, evinfo->nlaei_msglen);
 
+        if (!nla_bufferevent_msg_fits(nla_nlm_server_ctx.nlac_bev, evinfo->nlaei_msglen)) {
+            nla_log(LOG_WARN, "msg len %d exceeds the seqpacket max %d, dropped",
+                    evinfo->nlaei_msglen, NLA_SEQPACKET_MAX_LEN);
+            nla_stats_write_failure(NLA_NLM_SERVER, 1);
+            break;
+        }
+
+        outevb = evbuffer_new();
+
         evbuffer_add(outevb, evinfo->nlaei_msg, evinfo->nlaei_msglen);
 
         if (bufferevent_write_buffer(nla_nlm_server_ctx.nlac_bev, outevb) < 0) {
@@ -303,6 +408,11 @@ nla_nlm_server_notify (nla_module_id_t from UNUSED, nla_event_info_t *evinfo)
 
         evbuffer_free(outevb);
 
+        nla_stats_module_out(NLA_NLM_SERVER, evinfo->nlaei_msglen);
+        nla_stats_latency(from, NLA_NLM_SERVER, evinfo->nlaei_time);
+        nla_stats_queue(NLA_NLM_SERVER,
+                        evbuffer_get_length(bufferevent_get_output(nla_nlm_server_ctx.nlac_bev)));
+
         break;
 
     default:
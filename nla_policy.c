@@ -90,7 +90,7 @@ nla_policy_get_cfg (nla_module_id_t module)
  *  +-------------------+- - -+-------------------+- - -+--------+---+--------+---+
  */
 static void
-nla_policy_strip_attr (nla_event_info_t *evinfo, int attr_type)
+nla_policy_strip_attr (int from, int module, nla_event_info_t *evinfo, int attr_type)
 {
     struct nlmsghdr *nlh;
     struct nlattr *attr;
@@ -117,6 +117,8 @@ nla_policy_strip_attr (nla_event_info_t *evinfo, int attr_type)
         nlh->nlmsg_len -= attr_size;
         evinfo->nlaei_msglen -= attr_size;
 
+        nla_stats_edge_strip((nla_module_id_t)from, (nla_module_id_t)module);
+
         nla_log(LOG_INFO, "stripped attr_type [%d] from msg", attr_type);
     }
 
@@ -125,7 +127,8 @@ nla_policy_strip_attr (nla_event_info_t *evinfo, int attr_type)
 
 
 static bool
-nla_policy_match_filter (int module,
+nla_policy_match_filter (int from,
+                         int module,
                          nla_policy_type_t policy_type,
                          const char *match_str,
                          int   match_value)
@@ -152,6 +155,8 @@ nla_policy_match_filter (int module,
     nla_log(LOG_INFO, "[%s %d] didn't match any  filter policies",
                       match_str, match_value);
 
+    nla_stats_edge_drop((nla_module_id_t)from, (nla_module_id_t)module, policy_type);
+
     return false;
 }
 
@@ -163,7 +168,7 @@ nla_policy_match_filter (int module,
  * @return TRUE if the evinfo from module is acceptable
  */
 nla_event_info_t *
-nla_policy_evaluate (int module, nla_event_info_t *in_evinfo)
+nla_policy_evaluate (int from, int module, nla_event_info_t *in_evinfo)
 {
     nla_event_info_t *out_evinfo;
     nla_policy_t *policy;
@@ -180,15 +185,15 @@ nla_policy_evaluate (int module, nla_event_info_t *in_evinfo)
     /*
      * handle filter policies
      */
-    if (!nla_policy_match_filter(module, NLAP_FILTER_FAMILY, "rtm_family", rtm->rtm_family)) {
+    if (!nla_policy_match_filter(from, module, NLAP_FILTER_FAMILY, "rtm_family", rtm->rtm_family)) {
         goto fail;
     }
 
-    if (!nla_policy_match_filter(module, NLAP_FILTER_TABLE, "rtm_table", rtm->rtm_table)) {
+    if (!nla_policy_match_filter(from, module, NLAP_FILTER_TABLE, "rtm_table", rtm->rtm_table)) {
         goto fail;
     }
 
-    if (!nla_policy_match_filter(module, NLAP_FILTER_PROTOCOL, "rtm_protocol", rtm->rtm_protocol)) {
+    if (!nla_policy_match_filter(from, module, NLAP_FILTER_PROTOCOL, "rtm_protocol", rtm->rtm_protocol)) {
         goto fail;
     }
 
@@ -215,7 +220,7 @@ nla_policy_evaluate (int module, nla_event_info_t *in_evinfo)
      */
     if (policy[NLAP_STRIP_RTATTR].nlap_entries) {
         for (i = 0; i < policy[NLAP_STRIP_RTATTR].nlap_entries; i++) {
-            nla_policy_strip_attr(out_evinfo, policy[NLAP_STRIP_RTATTR].nlap_value[i]);
+            nla_policy_strip_attr(from, module, out_evinfo, policy[NLAP_STRIP_RTATTR].nlap_value[i]);
         }
     }
 
@@ -68,6 +68,7 @@ nla_prpdc_trigger_event (nla_event_t event, const void *msg, unsigned int msglen
     evinfo.nlaei_type = event;
     evinfo.nlaei_msglen = msglen;
     evinfo.nlaei_msg = msg;
+    evinfo.nlaei_time = msg ? nla_clock_ns() : 0;
 
     nla_log(LOG_INFO, "from %s trigger event %s ", MODULE(NLA_PRPD_CLIENT), EVENT(event));
     nla_log(LOG_INFO, "msg %p, len %d", msg, msglen);
@@ -94,6 +95,16 @@ nla_prpdc_event_cb (nla_event_t event)
 }
 
 
+/*
+ * A route streamed from a monitored RIB table
+ */
+void
+nla_prpdc_write_cb (const void *msg, unsigned int msg_len)
+{
+    nla_prpdc_trigger_event(nla_nlmsg_event(msg), msg, msg_len);
+}
+
+
 static void
 nla_prpdc_server_connect (evutil_socket_t fd UNUSED,
                         short what UNUSED,
@@ -105,7 +116,15 @@ nla_prpdc_server_connect (evutil_socket_t fd UNUSED,
              nla_prpdc_ctx.nlac_infravec->nlaiv_get_addr_str(NLA_PRPD_CLIENT),
              nla_prpdc_ctx.nlac_infravec->nlaiv_get_port(NLA_PRPD_CLIENT));
 
-    if (RibClientInit(ribServerAddr) < 0) {
+    if (RibClientInit(ribServerAddr,
+            nla_prpdc_ctx.nlac_infravec->nlaiv_get_max_outstanding_rpcs(NLA_PRPD_CLIENT),
+            nla_prpdc_ctx.nlac_infravec->nlaiv_get_retry_spill_file(NLA_PRPD_CLIENT),
+            nla_prpdc_ctx.nlac_infravec->nlaiv_get_channels(NLA_PRPD_CLIENT),
+            nla_prpdc_ctx.nlac_infravec->nlaiv_get_channel_shard(NLA_PRPD_CLIENT) ==
+                NLA_CHANNEL_SHARD_TABLE,
+            nla_prpdc_ctx.nlac_infravec->nlaiv_get_grpcopt(NLA_PRPD_CLIENT),
+            nla_prpdc_ctx.nlac_infravec->nlaiv_get_compression(NLA_PRPD_CLIENT) ==
+                NLA_COMPRESSION_ZLIB) < 0) {
         nla_log(LOG_INFO, "nla_prpdc_server_connect failure");
         goto retry;
     }
@@ -156,10 +175,25 @@ nla_prpdc_server_connect_timer_start ()
 static void
 nla_prpdc_init ()
 {
+    uint32_t kernel_tables[NLA_TABLE_MAPS_MAX];
+    char *tables[NLA_TABLE_MAPS_MAX];
+    int count;
+
     nla_log(LOG_INFO, " ");
 
     nla_prpdc_ctx.nlac_infravec = nla_infra_get_vec();
 
+    for (count = 0; count < NLA_TABLE_MAPS_MAX; count++) {
+        tables[count] = nla_prpdc_ctx.nlac_infravec->nlaiv_get_table_map(NLA_PRPD_CLIENT, count,
+                                                                         &kernel_tables[count]);
+        if (!tables[count]) {
+            break;
+        }
+    }
+
+    /* Rebuilt on every init, once the RIB client and its monitor are reset */
+    RibClientTableMap(kernel_tables, tables, count);
+
     nla_prpdc_server_connect_timer_start();
 }
 
@@ -167,12 +201,27 @@ nla_prpdc_init ()
 static void
 nla_prpdc_init_flash (void)
 {
+    char *tables[NLA_MONITOR_TABLES_MAX];
+    int count;
+
     nla_log(LOG_INFO, " ");
+
+    for (count = 0; count < NLA_MONITOR_TABLES_MAX; count++) {
+        tables[count] = nla_prpdc_ctx.nlac_infravec->nlaiv_get_monitor_table(NLA_PRPD_CLIENT,
+                                                                             count);
+        if (!tables[count]) {
+            break;
+        }
+    }
+
+    if (count && RibClientMonitor(tables, count) < 0) {
+        nla_log(LOG_WARN, "failed to monitor the RIB tables");
+    }
 }
 
 
 static void
-nla_prpdc_notify (nla_module_id_t from UNUSED, nla_event_info_t *evinfo)
+nla_prpdc_notify (nla_module_id_t from, nla_event_info_t *evinfo)
 {
     struct rtnl_route *route = NULL;
     int err;
@@ -191,20 +240,29 @@ nla_prpdc_notify (nla_module_id_t from UNUSED, nla_event_info_t *evinfo)
 
         switch (nl_object_get_msgtype(OBJ_CAST(route))) {
         case RTM_NEWROUTE:
-            retVal = RibClientAddRoute(route);
+            retVal = RibClientAddRoute(route, from, evinfo->nlaei_time);
             break;
 
         case RTM_DELROUTE:
-            retVal = RibClientRemoveRoute(route);
+            retVal = RibClientRemoveRoute(route, from, evinfo->nlaei_time);
             break;
         }
 
         if (retVal < 0) {
             nla_log(LOG_INFO, "RibClient write operation failed ");
+            nla_stats_write_failure(NLA_PRPD_CLIENT, 1);
+        } else {
+            nla_stats_module_out(NLA_PRPD_CLIENT, evinfo->nlaei_msglen);
         }
 
-        nl_object_free(OBJ_CAST(route));
+        rtnl_route_put(route);
+
+        break;
+
+    case NLA_END_OF_DUMP:
+        nla_log(LOG_INFO, "%s : flush to prpd server", EVENT(evinfo->nlaei_type));
 
+        RibClientFlush();
         break;
 
     default:
@@ -0,0 +1,407 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * shivakumar channalli
+ *
+ * This SOFTWARE is licensed to you under the Apache License 2.0 .
+ * You may not use this code except in compliance with the License.
+ * This code is not an official Juniper product.
+ * You can obtain a copy of the License at http://spdx.org/licenses/Apache-2.0.html
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/*
+ * Route cache: the last netlink message sent for every route, so that the
+ * routes can be replayed to a peer without asking the kernel for them
+ * again. Routes are identified like the kernel does, by family, table,
+ * destination, tos and priority, and are replayed in insertion order.
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/queue.h>
+
+/* Libevent. */
+#include <event.h>
+
+/* Netlink */
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <netlink/netlink.h>
+#include <netlink/msg.h>
+#include <netlink/attr.h>
+
+/* nla header files. */
+#include <nla_fpm.h>
+#include <nla_defs.h>
+#include <nla_externs.h>
+
+
+#define NLA_RTCACHE_BUCKETS_MIN 1024
+
+
+typedef struct nla_rtcache_key_s {
+    uint32_t nlrck_table;
+    uint32_t nlrck_priority;
+    uint8_t  nlrck_family;
+    uint8_t  nlrck_dst_len;
+    uint8_t  nlrck_tos;
+    uint8_t  nlrck_pad;
+    uint8_t  nlrck_dst[16];
+} nla_rtcache_key_t;
+
+
+typedef struct nla_rtcache_entry_s {
+    LIST_ENTRY(nla_rtcache_entry_s)  nlrce_hash;
+    TAILQ_ENTRY(nla_rtcache_entry_s) nlrce_list;
+    nla_rtcache_key_t                nlrce_key;
+    uint32_t                         nlrce_hashval;
+    unsigned int                     nlrce_msglen;
+    unsigned char                    nlrce_msg[];
+} nla_rtcache_entry_t;
+
+
+LIST_HEAD(nla_rtcache_bucket_s, nla_rtcache_entry_s);
+TAILQ_HEAD(nla_rtcache_list_s, nla_rtcache_entry_s);
+
+
+struct nla_rtcache_s {
+    struct nla_rtcache_bucket_s *nlrc_buckets;
+    size_t                       nlrc_nbuckets;  /* power of 2 */
+    size_t                       nlrc_count;
+    struct nla_rtcache_list_s    nlrc_list;
+    nla_rtcache_entry_t         *nlrc_replay;    /* next entry to replay */
+    bool                         nlrc_replaying;
+};
+
+
+static uint32_t
+nla_rtcache_hash (const nla_rtcache_key_t *key)
+{
+    const uint8_t *p = (const uint8_t *)key;
+    uint32_t hash = 2166136261u;
+    size_t i;
+
+    /* FNV-1a */
+    for (i = 0; i < sizeof(nla_rtcache_key_t); i++) {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+
+/*
+ * @return -1 if nlh isn't a route message.
+ */
+static int
+nla_rtcache_get_key (const struct nlmsghdr *nlh, nla_rtcache_key_t *key)
+{
+    struct nlmsghdr *hdr = (struct nlmsghdr *)nlh;
+    struct rtmsg *rtm;
+    struct nlattr *attr;
+    int len;
+
+    if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct rtmsg))) {
+        return -1;
+    }
+
+    rtm = (struct rtmsg *)nlmsg_data(hdr);
+
+    memset(key, 0, sizeof(nla_rtcache_key_t));
+    key->nlrck_family  = rtm->rtm_family;
+    key->nlrck_dst_len = rtm->rtm_dst_len;
+    key->nlrck_tos     = rtm->rtm_tos;
+    key->nlrck_table   = rtm->rtm_table;
+
+    attr = nlmsg_find_attr(hdr, sizeof(struct rtmsg), RTA_TABLE);
+    if (attr) {
+        key->nlrck_table = nla_get_u32(attr);
+    }
+
+    attr = nlmsg_find_attr(hdr, sizeof(struct rtmsg), RTA_PRIORITY);
+    if (attr) {
+        key->nlrck_priority = nla_get_u32(attr);
+    }
+
+    attr = nlmsg_find_attr(hdr, sizeof(struct rtmsg), RTA_DST);
+    if (attr) {
+        len = nla_len(attr);
+        if (len > (int)sizeof(key->nlrck_dst)) {
+            len = sizeof(key->nlrck_dst);
+        }
+        memcpy(key->nlrck_dst, nla_data(attr), len);
+    }
+
+    return 0;
+}
+
+
+static struct nla_rtcache_bucket_s *
+nla_rtcache_bucket (nla_rtcache_t *cache, uint32_t hashval)
+{
+    return &cache->nlrc_buckets[hashval & (cache->nlrc_nbuckets - 1)];
+}
+
+
+static nla_rtcache_entry_t *
+nla_rtcache_lookup (nla_rtcache_t *cache, const nla_rtcache_key_t *key, uint32_t hashval)
+{
+    nla_rtcache_entry_t *entry;
+
+    LIST_FOREACH(entry, nla_rtcache_bucket(cache, hashval), nlrce_hash) {
+        if (entry->nlrce_hashval == hashval &&
+            !memcmp(&entry->nlrce_key, key, sizeof(nla_rtcache_key_t))) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+
+static void
+nla_rtcache_grow (nla_rtcache_t *cache)
+{
+    struct nla_rtcache_bucket_s *buckets;
+    nla_rtcache_entry_t *entry;
+    size_t nbuckets = cache->nlrc_nbuckets * 2;
+    size_t i;
+
+    buckets = (struct nla_rtcache_bucket_s *)calloc(nbuckets, sizeof(*buckets));
+    if (!buckets) {
+        /* Keep going with longer chains */
+        return;
+    }
+
+    free(cache->nlrc_buckets);
+    cache->nlrc_buckets = buckets;
+    cache->nlrc_nbuckets = nbuckets;
+
+    for (i = 0; i < nbuckets; i++) {
+        LIST_INIT(&buckets[i]);
+    }
+
+    TAILQ_FOREACH(entry, &cache->nlrc_list, nlrce_list) {
+        LIST_INSERT_HEAD(nla_rtcache_bucket(cache, entry->nlrce_hashval),
+                         entry, nlrce_hash);
+    }
+}
+
+
+static void
+nla_rtcache_remove (nla_rtcache_t *cache, nla_rtcache_entry_t *entry)
+{
+    if (cache->nlrc_replay == entry) {
+        cache->nlrc_replay = TAILQ_NEXT(entry, nlrce_list);
+    }
+
+    LIST_REMOVE(entry, nlrce_hash);
+    TAILQ_REMOVE(&cache->nlrc_list, entry, nlrce_list);
+    cache->nlrc_count--;
+
+    free(entry);
+}
+
+
+nla_rtcache_t *
+nla_rtcache_new (void)
+{
+    nla_rtcache_t *cache;
+    size_t i;
+
+    cache = (nla_rtcache_t *)calloc(1, sizeof(nla_rtcache_t));
+    if (!cache) {
+        return NULL;
+    }
+
+    cache->nlrc_nbuckets = NLA_RTCACHE_BUCKETS_MIN;
+    cache->nlrc_buckets = (struct nla_rtcache_bucket_s *)calloc(cache->nlrc_nbuckets,
+                                                                sizeof(*cache->nlrc_buckets));
+    if (!cache->nlrc_buckets) {
+        free(cache);
+        return NULL;
+    }
+
+    for (i = 0; i < cache->nlrc_nbuckets; i++) {
+        LIST_INIT(&cache->nlrc_buckets[i]);
+    }
+    TAILQ_INIT(&cache->nlrc_list);
+
+    return cache;
+}
+
+
+void
+nla_rtcache_flush (nla_rtcache_t *cache)
+{
+    nla_rtcache_entry_t *entry;
+
+    while ((entry = TAILQ_FIRST(&cache->nlrc_list))) {
+        nla_rtcache_remove(cache, entry);
+    }
+
+    cache->nlrc_replay = NULL;
+    cache->nlrc_replaying = false;
+}
+
+
+void
+nla_rtcache_free (nla_rtcache_t *cache)
+{
+    if (!cache) {
+        return;
+    }
+
+    nla_rtcache_flush(cache);
+    free(cache->nlrc_buckets);
+    free(cache);
+}
+
+
+size_t
+nla_rtcache_count (nla_rtcache_t *cache)
+{
+    return cache->nlrc_count;
+}
+
+
+/*
+ * Record one netlink message: RTM_NEWROUTE replaces the cached route,
+ * RTM_DELROUTE removes it. Anything else is ignored.
+ */
+static void
+nla_rtcache_update_one (nla_rtcache_t *cache, const struct nlmsghdr *nlh)
+{
+    nla_rtcache_entry_t *entry, *old;
+    nla_rtcache_key_t key;
+    uint32_t hashval;
+
+    if (nlh->nlmsg_type != RTM_NEWROUTE && nlh->nlmsg_type != RTM_DELROUTE) {
+        return;
+    }
+
+    if (nla_rtcache_get_key(nlh, &key) < 0) {
+        return;
+    }
+
+    hashval = nla_rtcache_hash(&key);
+    old = nla_rtcache_lookup(cache, &key, hashval);
+
+    if (nlh->nlmsg_type == RTM_DELROUTE) {
+        if (old) {
+            nla_rtcache_remove(cache, old);
+        }
+        return;
+    }
+
+    if (old && old->nlrce_msglen == nlh->nlmsg_len) {
+        memcpy(old->nlrce_msg, nlh, nlh->nlmsg_len);
+        return;
+    }
+
+    entry = (nla_rtcache_entry_t *)calloc(1, sizeof(nla_rtcache_entry_t) +
+                                             NLMSG_ALIGN(nlh->nlmsg_len));
+    if (!entry) {
+        nla_log(LOG_WARN, "failed to cache route, msg len %u", nlh->nlmsg_len);
+        return;
+    }
+
+    entry->nlrce_key = key;
+    entry->nlrce_hashval = hashval;
+    entry->nlrce_msglen = nlh->nlmsg_len;
+    memcpy(entry->nlrce_msg, nlh, nlh->nlmsg_len);
+
+    LIST_INSERT_HEAD(nla_rtcache_bucket(cache, hashval), entry, nlrce_hash);
+    if (old) {
+        /* Keep the replay order */
+        TAILQ_INSERT_AFTER(&cache->nlrc_list, old, entry, nlrce_list);
+        cache->nlrc_count++;
+        if (cache->nlrc_replay == old) {
+            cache->nlrc_replay = entry;
+        }
+        nla_rtcache_remove(cache, old);
+        return;
+    }
+
+    TAILQ_INSERT_TAIL(&cache->nlrc_list, entry, nlrce_list);
+    cache->nlrc_count++;
+
+    if (cache->nlrc_count > cache->nlrc_nbuckets) {
+        nla_rtcache_grow(cache);
+    }
+}
+
+
+void
+nla_rtcache_update (nla_rtcache_t *cache, const void *msg, int msg_len)
+{
+    struct nlmsghdr *nlh = (struct nlmsghdr *)msg;
+    int remaining = msg_len;
+
+    while (nlmsg_ok(nlh, remaining)) {
+        nla_rtcache_update_one(cache, nlh);
+        nlh = nlmsg_next(nlh, &remaining);
+    }
+}
+
+
+/*
+ * Start replaying the cached routes from the oldest one.
+ */
+void
+nla_rtcache_replay_start (nla_rtcache_t *cache)
+{
+    cache->nlrc_replay = TAILQ_FIRST(&cache->nlrc_list);
+    cache->nlrc_replaying = true;
+}
+
+
+bool
+nla_rtcache_replay_pending (nla_rtcache_t *cache)
+{
+    return cache->nlrc_replaying;
+}
+
+
+/*
+ * Append up to max_routes cached routes to outevb.
+ *
+ * @return number of routes appended. nla_rtcache_replay_pending() tells
+ *         whether there are more.
+ */
+int
+nla_rtcache_replay_next (nla_rtcache_t *cache, struct evbuffer *outevb, int max_routes)
+{
+    nla_rtcache_entry_t *entry;
+    int n = 0;
+
+    if (!cache->nlrc_replaying) {
+        return 0;
+    }
+
+    while (n < max_routes && (entry = cache->nlrc_replay)) {
+        evbuffer_add(outevb, entry->nlrce_msg, NLMSG_ALIGN(entry->nlrce_msglen));
+        cache->nlrc_replay = TAILQ_NEXT(entry, nlrce_list);
+        n++;
+    }
+
+    if (!cache->nlrc_replay) {
+        cache->nlrc_replaying = false;
+    }
+
+    return n;
+}
@@ -0,0 +1,305 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * shivakumar channalli
+ *
+ * This SOFTWARE is licensed to you under the Apache License 2.0 .
+ * You may not use this code except in compliance with the License.
+ * This code is not an official Juniper product.
+ * You can obtain a copy of the License at http://spdx.org/licenses/Apache-2.0.html
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+#ifndef _NLA_SHM_H
+#define _NLA_SHM_H
+
+/*
+ * Shared memory ring published by the NLA_SHM_SERVER module.
+ *
+ * The ring is a file (server-address) mapped by nlagent, the single
+ * producer, and by any number of readers. It holds a header page followed
+ * by nlsh_size bytes of records. A record is a nla_shm_rec_t followed by a
+ * batch of netlink messages, padded to NLA_SHM_ALIGNTO. A record never
+ * wraps, the end of the ring is filled with a NLA_SHM_REC_PAD record
+ * instead.
+ *
+ * Positions are byte offsets which only ever grow; the offset in the ring
+ * is (pos & (nlsh_size - 1)). Records in [nlsh_tail, nlsh_head) are valid.
+ * The producer moves nlsh_tail past the records it is about to overwrite
+ * before touching them, so a reader detects an overrun by checking that
+ * its record is still at or after nlsh_tail once it is done with it.
+ *
+ * Readers keep their own cursor and never write to the ring, apart from
+ * nlsh_waiters while they sleep on the nlsh_doorbell futex.
+ *
+ * This header is self-contained so that readers can include it as is.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NLA_SHM_MAGIC      0x4e4c4152  /* "NLAR" */
+#define NLA_SHM_VERSION    1
+#define NLA_SHM_HDR_LEN    4096
+#define NLA_SHM_ALIGNTO    8
+#define NLA_SHM_ALIGN(len) (((len) + NLA_SHM_ALIGNTO - 1) & ~(NLA_SHM_ALIGNTO - 1))
+
+#define NLA_SHM_CACHELINE  64
+
+/* ring-size, a power of 2 */
+#define NLA_SHM_RING_SIZE_MIN     (64 << 10)
+#define NLA_SHM_RING_SIZE_DEFAULT (4 << 20)
+
+
+typedef struct nla_shm_hdr_s {
+    uint32_t nlsh_magic;
+    uint32_t nlsh_version;
+    uint64_t nlsh_size;       /* size of the record area, a power of 2 */
+    uint64_t nlsh_epoch;      /* bumped whenever the producer (re)starts */
+    uint64_t nlsh_epoch_pos;  /* position of the first record of the epoch */
+    uint8_t  nlsh_pad0[NLA_SHM_CACHELINE - 32];
+
+    /* written by the producer */
+    uint64_t nlsh_head;       /* end of the last published record */
+    uint64_t nlsh_tail;       /* start of the oldest valid record */
+    uint8_t  nlsh_pad1[NLA_SHM_CACHELINE - 16];
+
+    uint32_t nlsh_doorbell;   /* futex, bumped on every publish */
+    uint32_t nlsh_waiters;    /* readers sleeping on nlsh_doorbell */
+} nla_shm_hdr_t;
+
+
+typedef enum nla_shm_rec_type_e {
+    NLA_SHM_REC_MSG = 1,      /* netlink messages */
+    NLA_SHM_REC_PAD,          /* skip to the start of the ring */
+} nla_shm_rec_type_t;
+
+
+typedef struct nla_shm_rec_s {
+    uint32_t nlsr_len;        /* length of the data following the record header */
+    uint32_t nlsr_type;
+} nla_shm_rec_t;
+
+
+#define NLA_SHM_REC_LEN(data_len) NLA_SHM_ALIGN(sizeof(nla_shm_rec_t) + (data_len))
+
+
+static inline uint8_t *
+nla_shm_data (nla_shm_hdr_t *hdr)
+{
+    return (uint8_t *)hdr + NLA_SHM_HDR_LEN;
+}
+
+
+static inline nla_shm_rec_t *
+nla_shm_rec (nla_shm_hdr_t *hdr, uint64_t pos)
+{
+    return (nla_shm_rec_t *)(nla_shm_data(hdr) + (pos & (hdr->nlsh_size - 1)));
+}
+
+
+/*
+ * Reader side.
+ */
+
+typedef enum nla_shm_read_e {
+    NLA_SHM_REOPEN  = -2,     /* ring was recreated, close and open it again */
+    NLA_SHM_OVERRUN = -1,     /* records were overwritten before being read */
+    NLA_SHM_EMPTY   = 0,      /* nothing new */
+    NLA_SHM_MSG     = 1,      /* a record is returned */
+    NLA_SHM_RESTART = 2,      /* producer restarted, full table replay follows */
+} nla_shm_read_t;
+
+
+typedef struct nla_shm_reader_s {
+    nla_shm_hdr_t *nlsrd_hdr;
+    size_t         nlsrd_map_len;
+    uint64_t       nlsrd_epoch;
+    uint64_t       nlsrd_cursor;  /* next record to read */
+    uint64_t       nlsrd_rec;     /* record returned by nla_shm_reader_next */
+} nla_shm_reader_t;
+
+
+/*
+ * Map the ring at path. The reader starts with the records published
+ * from now on.
+ *
+ * @return -1 on failure, 0 otherwise.
+ */
+static inline int
+nla_shm_reader_open (nla_shm_reader_t *reader, const char *path)
+{
+    nla_shm_hdr_t *hdr;
+    struct stat st;
+    int fd;
+
+    memset(reader, 0, sizeof(nla_shm_reader_t));
+
+    fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (fstat(fd, &st) < 0 || st.st_size < NLA_SHM_HDR_LEN) {
+        close(fd);
+        return -1;
+    }
+
+    hdr = (nla_shm_hdr_t *)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+                                MAP_SHARED, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED) {
+        return -1;
+    }
+
+    if (__atomic_load_n(&hdr->nlsh_magic, __ATOMIC_ACQUIRE) != NLA_SHM_MAGIC ||
+        hdr->nlsh_version != NLA_SHM_VERSION ||
+        hdr->nlsh_size + NLA_SHM_HDR_LEN > (uint64_t)st.st_size) {
+        munmap(hdr, st.st_size);
+        return -1;
+    }
+
+    reader->nlsrd_hdr = hdr;
+    reader->nlsrd_map_len = st.st_size;
+    reader->nlsrd_epoch = __atomic_load_n(&hdr->nlsh_epoch, __ATOMIC_ACQUIRE);
+    reader->nlsrd_cursor = __atomic_load_n(&hdr->nlsh_head, __ATOMIC_ACQUIRE);
+    reader->nlsrd_rec = reader->nlsrd_cursor;
+
+    return 0;
+}
+
+
+static inline void
+nla_shm_reader_close (nla_shm_reader_t *reader)
+{
+    if (reader->nlsrd_hdr) {
+        munmap(reader->nlsrd_hdr, reader->nlsrd_map_len);
+    }
+    memset(reader, 0, sizeof(nla_shm_reader_t));
+}
+
+
+/*
+ * Get the next record. On NLA_SHM_MSG, msg points to the netlink messages
+ * in the ring, and must be released with nla_shm_reader_release() once
+ * consumed. On NLA_SHM_OVERRUN the cursor is moved to the oldest valid
+ * record.
+ */
+static inline nla_shm_read_t
+nla_shm_reader_next (nla_shm_reader_t *reader, const void **msg, uint32_t *msg_len)
+{
+    nla_shm_hdr_t *hdr = reader->nlsrd_hdr;
+    nla_shm_rec_t *rec;
+    uint64_t head, tail, epoch;
+    uint32_t len, type;
+
+    if (__atomic_load_n(&hdr->nlsh_magic, __ATOMIC_ACQUIRE) != NLA_SHM_MAGIC) {
+        return NLA_SHM_REOPEN;
+    }
+
+    epoch = __atomic_load_n(&hdr->nlsh_epoch, __ATOMIC_ACQUIRE);
+    if (epoch != reader->nlsrd_epoch) {
+        reader->nlsrd_epoch = epoch;
+        reader->nlsrd_cursor = __atomic_load_n(&hdr->nlsh_epoch_pos, __ATOMIC_ACQUIRE);
+        return NLA_SHM_RESTART;
+    }
+
+    for (;;) {
+        head = __atomic_load_n(&hdr->nlsh_head, __ATOMIC_ACQUIRE);
+        if (reader->nlsrd_cursor == head) {
+            return NLA_SHM_EMPTY;
+        }
+
+        rec = nla_shm_rec(hdr, reader->nlsrd_cursor);
+        len = rec->nlsr_len;
+        type = rec->nlsr_type;
+
+        /* The record header must still be valid after reading it */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        tail = __atomic_load_n(&hdr->nlsh_tail, __ATOMIC_RELAXED);
+        if (reader->nlsrd_cursor < tail) {
+            reader->nlsrd_cursor = tail;
+            return NLA_SHM_OVERRUN;
+        }
+
+        if (type == NLA_SHM_REC_PAD) {
+            reader->nlsrd_cursor += NLA_SHM_REC_LEN(len);
+            continue;
+        }
+
+        reader->nlsrd_rec = reader->nlsrd_cursor;
+        reader->nlsrd_cursor += NLA_SHM_REC_LEN(len);
+
+        *msg = rec + 1;
+        *msg_len = len;
+        return NLA_SHM_MSG;
+    }
+}
+
+
+/*
+ * Release the record returned by nla_shm_reader_next().
+ *
+ * @return NLA_SHM_OVERRUN if the record was overwritten while it was being
+ *         consumed, in which case its contents must be discarded.
+ */
+static inline nla_shm_read_t
+nla_shm_reader_release (nla_shm_reader_t *reader)
+{
+    uint64_t tail;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    tail = __atomic_load_n(&reader->nlsrd_hdr->nlsh_tail, __ATOMIC_RELAXED);
+    if (reader->nlsrd_rec < tail) {
+        if (reader->nlsrd_cursor < tail) {
+            reader->nlsrd_cursor = tail;
+        }
+        return NLA_SHM_OVERRUN;
+    }
+
+    return NLA_SHM_MSG;
+}
+
+
+/*
+ * Sleep until the producer publishes a record or timeout expires.
+ * timeout NULL waits forever.
+ */
+static inline void
+nla_shm_reader_wait (nla_shm_reader_t *reader, const struct timespec *timeout)
+{
+    nla_shm_hdr_t *hdr = reader->nlsrd_hdr;
+    uint32_t doorbell;
+
+    doorbell = __atomic_load_n(&hdr->nlsh_doorbell, __ATOMIC_ACQUIRE);
+    __atomic_add_fetch(&hdr->nlsh_waiters, 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&hdr->nlsh_head, __ATOMIC_SEQ_CST) == reader->nlsrd_cursor) {
+        syscall(SYS_futex, &hdr->nlsh_doorbell, FUTEX_WAIT, doorbell, timeout, NULL, 0);
+    }
+
+    __atomic_sub_fetch(&hdr->nlsh_waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _NLA_SHM_H */
@@ -0,0 +1,373 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * shivakumar channalli
+ *
+ * This SOFTWARE is licensed to you under the Apache License 2.0 .
+ * You may not use this code except in compliance with the License.
+ * This code is not an official Juniper product.
+ * You can obtain a copy of the License at http://spdx.org/licenses/Apache-2.0.html
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <assert.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/* Libevent. */
+#include <event.h>
+
+/* Netlink */
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+/* nla header files. */
+#include <nla_fpm.h>
+#include <nla_shm.h>
+#include <nla_defs.h>
+#include <nla_externs.h>
+
+
+
+nla_context_t       nla_shm_server_ctx;
+nla_module_vector_t nla_shm_server_vector;
+
+
+/* Mapped ring */
+static nla_shm_hdr_t *nla_shm_ring;
+static size_t         nla_shm_ring_map_len;
+
+
+static void nla_shm_server_open_timer_start(void);
+
+
+static void
+nla_shm_server_trigger_event (nla_event_t event, const void *msg, unsigned int msglen)
+{
+    nla_event_info_t evinfo;
+
+    evinfo.nlaei_type = event;
+    evinfo.nlaei_msglen  = msglen;
+    evinfo.nlaei_msg = msg;
+    evinfo.nlaei_time = msg ? nla_clock_ns() : 0;
+
+    nla_log(LOG_INFO, "from %s trigger event %s ", MODULE(NLA_SHM_SERVER), EVENT(event));
+    nla_log(LOG_INFO, "msg %p, len %d", msg, msglen);
+    nla_shm_server_ctx.nlac_infravec->nlaiv_notify_cb(NLA_SHM_SERVER, &evinfo);
+}
+
+
+/*
+ * Invalidate the ring at path, so that the readers still mapping it know
+ * they have to open it again, and remove it.
+ */
+static void
+nla_shm_server_unlink (int fd, const char *path)
+{
+    nla_shm_hdr_t *hdr;
+
+    hdr = (nla_shm_hdr_t *)mmap(NULL, NLA_SHM_HDR_LEN, PROT_READ | PROT_WRITE,
+                                MAP_SHARED, fd, 0);
+    if (hdr != MAP_FAILED) {
+        __atomic_store_n(&hdr->nlsh_magic, 0, __ATOMIC_RELEASE);
+        munmap(hdr, NLA_SHM_HDR_LEN);
+    }
+
+    unlink(path);
+}
+
+
+/*
+ * Map the ring file, creating it if needed. An existing ring of the same
+ * size is reused, and only starts a new epoch, so that readers don't have
+ * to open it again.
+ *
+ * @return -1 on failure, 0 otherwise.
+ */
+static int
+nla_shm_server_open (const char *path, size_t ring_size)
+{
+    nla_shm_hdr_t *hdr;
+    size_t map_len = NLA_SHM_HDR_LEN + ring_size;
+    struct stat st;
+    bool reuse;
+    int fd;
+
+    fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        nla_log(LOG_ERR, "failed to open %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    reuse = ((size_t)st.st_size == map_len);
+    if (!reuse && st.st_size >= NLA_SHM_HDR_LEN) {
+        nla_log(LOG_NOTICE, "ring size changed, recreate %s", path);
+        nla_shm_server_unlink(fd, path);
+        close(fd);
+        fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            nla_log(LOG_ERR, "failed to create %s: %s", path, strerror(errno));
+            return -1;
+        }
+    }
+
+    if (!reuse && ftruncate(fd, map_len) < 0) {
+        nla_log(LOG_ERR, "failed to size %s: %s", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    hdr = (nla_shm_hdr_t *)mmap(NULL, map_len, PROT_READ | PROT_WRITE,
+                                MAP_SHARED, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED) {
+        nla_log(LOG_ERR, "failed to map %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    if (reuse && (hdr->nlsh_magic != NLA_SHM_MAGIC ||
+                  hdr->nlsh_version != NLA_SHM_VERSION ||
+                  hdr->nlsh_size != ring_size)) {
+        reuse = false;
+    }
+
+    if (reuse) {
+        hdr->nlsh_epoch_pos = hdr->nlsh_head;
+        __atomic_add_fetch(&hdr->nlsh_epoch, 1, __ATOMIC_RELEASE);
+    } else {
+        __atomic_store_n(&hdr->nlsh_magic, 0, __ATOMIC_RELEASE);
+        hdr->nlsh_version = NLA_SHM_VERSION;
+        hdr->nlsh_size = ring_size;
+        hdr->nlsh_epoch = 1;
+        hdr->nlsh_epoch_pos = 0;
+        hdr->nlsh_head = 0;
+        hdr->nlsh_tail = 0;
+        hdr->nlsh_doorbell = 0;
+        hdr->nlsh_waiters = 0;
+        __atomic_store_n(&hdr->nlsh_magic, NLA_SHM_MAGIC, __ATOMIC_RELEASE);
+    }
+
+    nla_shm_ring = hdr;
+    nla_shm_ring_map_len = map_len;
+
+    nla_log(LOG_NOTICE, "ring %s size %zu epoch %lu head %lu", path, ring_size,
+            (unsigned long)hdr->nlsh_epoch, (unsigned long)hdr->nlsh_head);
+
+    return 0;
+}
+
+
+/*
+ * Append msg to the ring as one record, and wake up the sleeping readers.
+ * The oldest records are dropped to make room.
+ *
+ * @return -1 if msg is too large for the ring, 0 otherwise.
+ */
+static int
+nla_shm_server_publish (const void *msg, unsigned int msg_len)
+{
+    nla_shm_hdr_t *hdr = nla_shm_ring;
+    nla_shm_rec_t *rec;
+    uint64_t head, tail, end;
+    size_t rec_len, pad = 0, off;
+
+    rec_len = NLA_SHM_REC_LEN(msg_len);
+    if (rec_len > hdr->nlsh_size / 2) {
+        nla_log(LOG_WARN, "msg len %u exceeds half the ring size, dropped", msg_len);
+        nla_stats_write_failure(NLA_SHM_SERVER, 1);
+        return -1;
+    }
+
+    head = hdr->nlsh_head;
+    off = head & (hdr->nlsh_size - 1);
+    if (off + rec_len > hdr->nlsh_size) {
+        pad = hdr->nlsh_size - off;
+    }
+    end = head + pad + rec_len;
+
+    /* Retire the records which are about to be overwritten */
+    tail = hdr->nlsh_tail;
+    if (end - tail > hdr->nlsh_size) {
+        while (end - tail > hdr->nlsh_size) {
+            rec = nla_shm_rec(hdr, tail);
+            tail += NLA_SHM_REC_LEN(rec->nlsr_len);
+        }
+        __atomic_store_n(&hdr->nlsh_tail, tail, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+
+    if (pad) {
+        rec = nla_shm_rec(hdr, head);
+        rec->nlsr_len = pad - sizeof(nla_shm_rec_t);
+        rec->nlsr_type = NLA_SHM_REC_PAD;
+        head += pad;
+    }
+
+    rec = nla_shm_rec(hdr, head);
+    rec->nlsr_len = msg_len;
+    rec->nlsr_type = NLA_SHM_REC_MSG;
+    memcpy(rec + 1, msg, msg_len);
+
+    /* Publish */
+    __atomic_store_n(&hdr->nlsh_head, end, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&hdr->nlsh_doorbell, 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&hdr->nlsh_waiters, __ATOMIC_SEQ_CST)) {
+        syscall(SYS_futex, &hdr->nlsh_doorbell, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+
+    nla_stats_module_out(NLA_SHM_SERVER, msg_len);
+
+    return 0;
+}
+
+
+static void
+nla_shm_server_connect (evutil_socket_t fd UNUSED, short what UNUSED, void *arg UNUSED)
+{
+    char *path;
+
+    nla_log(LOG_INFO, " ");
+
+    path = nla_shm_server_ctx.nlac_infravec->nlaiv_get_addr_str(NLA_SHM_SERVER);
+    if (!path) {
+        nla_log(LOG_ERR, "%s : server-address not configured", MODULE(NLA_SHM_SERVER));
+        goto retry;
+    }
+
+    if (nla_shm_server_open(path,
+            nla_shm_server_ctx.nlac_infravec->nlaiv_get_ring_size(NLA_SHM_SERVER)) < 0) {
+        goto retry;
+    }
+
+    nla_shm_server_trigger_event(NLA_CONNECTION_UP, NULL, 0);
+
+    return;
+
+retry:
+
+    nla_shm_server_trigger_event(NLA_CONNECTION_DOWN, NULL, 0);
+    nla_shm_server_open_timer_start();
+}
+
+
+static void
+nla_shm_server_reset (void)
+{
+    nla_log(LOG_INFO, " ");
+
+    if (nla_shm_ring) {
+        munmap(nla_shm_ring, nla_shm_ring_map_len);
+        nla_shm_ring = NULL;
+        nla_shm_ring_map_len = 0;
+    }
+
+    nla_context_cleanup(&nla_shm_server_ctx);
+}
+
+
+static void
+nla_shm_server_open_timer_start ()
+{
+    struct timeval retry_timer = {2,0};
+
+    nla_log(LOG_INFO, " ");
+
+    /* Always start from fresh */
+    nla_shm_server_reset();
+
+    if (!nla_gl.nlag_base) {
+        nla_log(LOG_INFO, "nla_shm_server_open_timer_start failure");
+        return;
+    }
+
+    /* Create a dispatcher event */
+    assert(!nla_shm_server_ctx.nlac_start_timer);
+    nla_shm_server_ctx.nlac_start_timer = evtimer_new(nla_gl.nlag_base,
+                                                      nla_shm_server_connect,
+                                                      NULL);
+
+    evtimer_add(nla_shm_server_ctx.nlac_start_timer, &retry_timer);
+}
+
+
+static void
+nla_shm_server_init ()
+{
+    nla_log(LOG_INFO, " ");
+
+    nla_shm_server_ctx.nlac_infravec = nla_infra_get_vec();
+
+    nla_shm_server_open_timer_start();
+}
+
+
+static void
+nla_shm_server_init_flash (void)
+{
+    nla_log(LOG_INFO, " ");
+}
+
+
+static void
+nla_shm_server_notify (nla_module_id_t from, nla_event_info_t *evinfo)
+{
+    switch(evinfo->nlaei_type) {
+    case NLA_WRITE:
+    case NLA_END_OF_DUMP:
+        nla_log(LOG_INFO, "%s : write to ring, msg %p len %d",
+                EVENT(evinfo->nlaei_type), evinfo->nlaei_msg, evinfo->nlaei_msglen);
+
+        if (nla_shm_ring &&
+            nla_shm_server_publish(evinfo->nlaei_msg, evinfo->nlaei_msglen) == 0) {
+            nla_stats_latency(from, NLA_SHM_SERVER, evinfo->nlaei_time);
+        }
+        break;
+
+    default:
+        nla_log(LOG_INFO, "%s : ok", EVENT(evinfo->nlaei_type));
+        break;
+    }
+}
+
+
+nla_module_vector_t*
+nla_shm_server_get_vec (void)
+{
+    nla_log(LOG_INFO, " ");
+
+    memset(&nla_shm_server_ctx, 0, sizeof(nla_shm_server_ctx));
+    memset(&nla_shm_server_vector, 0, sizeof(nla_shm_server_vector));
+
+    nla_shm_server_vector.nlamv_module           = NLA_SHM_SERVER;
+    nla_shm_server_vector.nlamv_init_cb          = nla_shm_server_init;
+    nla_shm_server_vector.nlamv_reset_cb         = nla_shm_server_reset;
+    nla_shm_server_vector.nlamv_init_flash_cb    = nla_shm_server_init_flash;
+    nla_shm_server_vector.nlamv_notify_cb        = nla_shm_server_notify;
+
+    return &nla_shm_server_vector;
+}
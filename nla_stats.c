@@ -0,0 +1,369 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * shivakumar channalli
+ *
+ * This SOFTWARE is licensed to you under the Apache License 2.0 .
+ * You may not use this code except in compliance with the License.
+ * This code is not an official Juniper product.
+ * You can obtain a copy of the License at http://spdx.org/licenses/Apache-2.0.html
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/*
+ * Traffic counters, published in the stats page of nla_stats.h.
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <assert.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Libevent. */
+#include <event.h>
+
+/* Netlink */
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+/* nla header files. */
+#include <nla_fpm.h>
+#include <nla_stats.h>
+#include <nla_defs.h>
+#include <nla_externs.h>
+
+
+static_assert(NLA_MODULE_ALL <= NLA_STATS_MODULES_MAX, "stats page too small");
+static_assert((int)NLAP_FILTER_FAMILY == (int)NLA_STATS_DROP_FAMILY &&
+              (int)NLAP_FILTER_TABLE == (int)NLA_STATS_DROP_TABLE &&
+              (int)NLAP_FILTER_PROTOCOL == (int)NLA_STATS_DROP_PROTOCOL,
+              "drop reasons out of sync");
+
+
+/* Mapped stats page, or a private copy if the file can't be created */
+static nla_stats_hdr_t *nla_stats;
+static bool             nla_stats_mapped;
+
+/* Histogram of a source and sink pair, 1 + its index in nlst_latency */
+static uint8_t          nla_stats_latency_slot[NLA_MODULE_ALL][NLA_MODULE_ALL];
+
+
+/*
+ * The event loop is the only writer, a plain store is enough for the
+ * readers to never see a torn counter.
+ */
+static inline void
+nla_stats_add (uint64_t *counter, uint64_t n)
+{
+    __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * Invalidate the stats page at path, so that the readers still mapping it
+ * know they have to open it again, and remove it.
+ */
+static void
+nla_stats_unlink (const char *path)
+{
+    nla_stats_hdr_t *hdr;
+    struct stat st;
+    int fd;
+
+    fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(uint32_t)) {
+        hdr = (nla_stats_hdr_t *)mmap(NULL, sizeof(uint32_t), PROT_READ | PROT_WRITE,
+                                      MAP_SHARED, fd, 0);
+        if (hdr != MAP_FAILED) {
+            __atomic_store_n(&hdr->nlst_magic, 0, __ATOMIC_RELEASE);
+            munmap(hdr, sizeof(uint32_t));
+        }
+    }
+
+    close(fd);
+    unlink(path);
+}
+
+
+static nla_stats_hdr_t *
+nla_stats_open (const char *path)
+{
+    nla_stats_hdr_t *hdr;
+    int fd;
+
+    nla_stats_unlink(path);
+
+    fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        nla_log(LOG_WARN, "failed to create %s: %s", path, strerror(errno));
+        return NULL;
+    }
+
+    if (ftruncate(fd, sizeof(nla_stats_hdr_t)) < 0) {
+        nla_log(LOG_WARN, "failed to size %s: %s", path, strerror(errno));
+        close(fd);
+        unlink(path);
+        return NULL;
+    }
+
+    hdr = (nla_stats_hdr_t *)mmap(NULL, sizeof(nla_stats_hdr_t), PROT_READ | PROT_WRITE,
+                                  MAP_SHARED, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED) {
+        nla_log(LOG_WARN, "failed to map %s: %s", path, strerror(errno));
+        unlink(path);
+        return NULL;
+    }
+
+    return hdr;
+}
+
+
+/*
+ * Create the stats page at path. The counters are still kept, though not
+ * published, if it can't be created.
+ */
+void
+nla_stats_start (const char *path)
+{
+    nla_stats_hdr_t *hdr;
+    int i;
+
+    assert(!nla_stats);
+
+    hdr = nla_stats_open(path);
+    nla_stats_mapped = (hdr != NULL);
+    if (!hdr) {
+        hdr = (nla_stats_hdr_t *)calloc(1, sizeof(nla_stats_hdr_t));
+    }
+
+    hdr->nlst_version = NLA_STATS_VERSION;
+    hdr->nlst_modules = NLA_MODULE_ALL;
+    hdr->nlst_drop_reasons = NLA_STATS_DROP_MAX;
+    hdr->nlst_start_time = time(NULL);
+    hdr->nlst_hist_buckets = NLA_STATS_HIST_BUCKETS;
+
+    for (i = 0; i < NLA_MODULE_ALL; i++) {
+        strncpy(hdr->nlst_module_name[i], nla_trace_state(nla_modules, i),
+                NLA_STATS_NAME_LEN - 1);
+    }
+
+    __atomic_store_n(&hdr->nlst_magic, NLA_STATS_MAGIC, __ATOMIC_RELEASE);
+
+    nla_stats = hdr;
+}
+
+
+/*
+ * Unmap the stats page. The file is left behind with the last counters.
+ */
+void
+nla_stats_stop (void)
+{
+    if (!nla_stats) {
+        return;
+    }
+
+    if (nla_stats_mapped) {
+        munmap(nla_stats, sizeof(nla_stats_hdr_t));
+    } else {
+        free(nla_stats);
+    }
+
+    nla_stats = NULL;
+    nla_stats_mapped = false;
+    memset(nla_stats_latency_slot, 0, sizeof(nla_stats_latency_slot));
+}
+
+
+/*
+ * An event from module, to be dispatched.
+ */
+void
+nla_stats_module_in (nla_module_id_t module, int len)
+{
+    if (!nla_stats) {
+        return;
+    }
+
+    nla_stats_add(&nla_stats->nlst_module[module].nlsm_msgs_in, 1);
+    nla_stats_add(&nla_stats->nlst_module[module].nlsm_bytes_in, len);
+}
+
+
+/*
+ * A msg of len bytes handed over by module to its peer.
+ */
+void
+nla_stats_module_out (nla_module_id_t module, int len)
+{
+    if (!nla_stats) {
+        return;
+    }
+
+    nla_stats_add(&nla_stats->nlst_module[module].nlsm_msgs_out, 1);
+    nla_stats_add(&nla_stats->nlst_module[module].nlsm_bytes_out, len);
+}
+
+
+void
+nla_stats_write_failure (nla_module_id_t module, int count)
+{
+    if (!nla_stats) {
+        return;
+    }
+
+    nla_stats_add(&nla_stats->nlst_module[module].nlsm_write_failures, count);
+}
+
+
+void
+nla_stats_reconnect (nla_module_id_t module)
+{
+    if (!nla_stats) {
+        return;
+    }
+
+    nla_stats_add(&nla_stats->nlst_module[module].nlsm_reconnects, 1);
+}
+
+
+/*
+ * Sample the output queue of module, in bytes or routes.
+ */
+void
+nla_stats_queue (nla_module_id_t module, uint64_t depth)
+{
+    nla_stats_module_t *stats;
+
+    if (!nla_stats) {
+        return;
+    }
+
+    stats = &nla_stats->nlst_module[module];
+
+    __atomic_store_n(&stats->nlsm_queue, depth, __ATOMIC_RELAXED);
+    if (depth > stats->nlsm_queue_hiwat) {
+        __atomic_store_n(&stats->nlsm_queue_hiwat, depth, __ATOMIC_RELAXED);
+    }
+}
+
+
+/*
+ * An event of from notified to module to, len bytes after the policy of to.
+ */
+void
+nla_stats_edge (nla_module_id_t from, nla_module_id_t to, int len)
+{
+    if (!nla_stats) {
+        return;
+    }
+
+    nla_stats_add(&nla_stats->nlst_edge[from][to].nlse_msgs, 1);
+    nla_stats_add(&nla_stats->nlst_edge[from][to].nlse_bytes, len);
+}
+
+
+void
+nla_stats_edge_strip (nla_module_id_t from, nla_module_id_t to)
+{
+    if (!nla_stats) {
+        return;
+    }
+
+    nla_stats_add(&nla_stats->nlst_edge[from][to].nlse_strips, 1);
+}
+
+
+/*
+ * An event of from dropped by the policy of to, reason is the filter
+ * (nla_policy_type_t) it didn't match.
+ */
+void
+nla_stats_edge_drop (nla_module_id_t from, nla_module_id_t to, int reason)
+{
+    if (!nla_stats || reason >= NLA_STATS_DROP_MAX) {
+        return;
+    }
+
+    nla_stats_add(&nla_stats->nlst_edge[from][to].nlse_drops[reason], 1);
+}
+
+
+/*
+ * @return the histogram of the source and sink pair, NULL once they are
+ *         all in use.
+ */
+static nla_stats_latency_t *
+nla_stats_latency_get (nla_module_id_t from, nla_module_id_t to)
+{
+    nla_stats_latency_t *hist;
+    uint32_t latencies;
+
+    if (nla_stats_latency_slot[from][to]) {
+        return &nla_stats->nlst_latency[nla_stats_latency_slot[from][to] - 1];
+    }
+
+    latencies = nla_stats->nlst_latencies;
+    if (latencies >= NLA_STATS_LATENCY_MAX) {
+        return NULL;
+    }
+
+    hist = &nla_stats->nlst_latency[latencies];
+    hist->nlsl_from = from;
+    hist->nlsl_to = to;
+
+    /* Published with its pair */
+    __atomic_store_n(&nla_stats->nlst_latencies, latencies + 1, __ATOMIC_RELEASE);
+    nla_stats_latency_slot[from][to] = latencies + 1;
+
+    return hist;
+}
+
+
+/*
+ * An event of from, received at ingress (nla_clock_ns()), written by the
+ * sink module to now.
+ */
+void
+nla_stats_latency (nla_module_id_t from, nla_module_id_t to, uint64_t ingress)
+{
+    nla_stats_latency_t *hist;
+    uint64_t latency;
+
+    if (!nla_stats || !ingress) {
+        return;
+    }
+
+    hist = nla_stats_latency_get(from, to);
+    if (!hist) {
+        return;
+    }
+
+    latency = nla_clock_ns() - ingress;
+
+    nla_stats_add(&hist->nlsl_bucket[nla_stats_hist_bucket(latency)], 1);
+    nla_stats_add(&hist->nlsl_sum, latency);
+    if (latency > hist->nlsl_max) {
+        __atomic_store_n(&hist->nlsl_max, latency, __ATOMIC_RELAXED);
+    }
+    nla_stats_add(&hist->nlsl_count, 1);
+}
@@ -0,0 +1,218 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * shivakumar channalli
+ *
+ * This SOFTWARE is licensed to you under the Apache License 2.0 .
+ * You may not use this code except in compliance with the License.
+ * This code is not an official Juniper product.
+ * You can obtain a copy of the License at http://spdx.org/licenses/Apache-2.0.html
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+#ifndef _NLA_STATS_H
+#define _NLA_STATS_H
+
+/*
+ * Stats page, see -s stats-file.
+ *
+ * The counters live in a file mapped by nlagent, so that any number of
+ * readers can map it and read them without asking the agent. They are
+ * kept per module, and per dispatch edge: edge [from][to] counts the
+ * events of module from notified to module to.
+ *
+ * The latency from the ingress of an event (e.g. its receipt from the
+ * kernel) to its write by a sink module is recorded in a histogram per
+ * source and sink pair, see nla_stats_latency_t.
+ *
+ * The counters are 64 bit, and only ever grow, but for nlsm_queue. They
+ * are updated by the event loop only, the gRPC threads hand their results
+ * over to it, so a reader loads them one by one without any lock. A set of
+ * counters is not a snapshot, two loads may be apart by a few events.
+ *
+ * The file is recreated on every start of the agent. The old one is
+ * invalidated first (nlst_magic 0), a reader finding it so has to open the
+ * file again.
+ *
+ * This header is self-contained so that readers can include it as is.
+ */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NLA_STATS_MAGIC        0x4e4c4153  /* "NLAS" */
+#define NLA_STATS_VERSION      2
+
+#define NLA_STATS_MODULES_MAX  16
+#define NLA_STATS_NAME_LEN     32
+
+/* Latency histograms, one per source and sink pair in use */
+#define NLA_STATS_LATENCY_MAX  16
+
+/*
+ * The histograms are log-bucketed, in nsecs: every power of 2 is split in
+ * NLA_STATS_HIST_SUB buckets, so a bucket is within 1/NLA_STATS_HIST_SUB
+ * of the value. The last bucket takes anything from 2^NLA_STATS_HIST_MAX_BITS
+ * nsecs (18 mins) on.
+ */
+#define NLA_STATS_HIST_SUB_BITS  3
+#define NLA_STATS_HIST_SUB       (1 << NLA_STATS_HIST_SUB_BITS)
+#define NLA_STATS_HIST_MAX_BITS  40
+#define NLA_STATS_HIST_BUCKETS   ((NLA_STATS_HIST_MAX_BITS - NLA_STATS_HIST_SUB_BITS + 1) *\
+                                  NLA_STATS_HIST_SUB)
+
+
+/* Why the policy of the destination module dropped an event */
+typedef enum nla_stats_drop_e {
+    NLA_STATS_DROP_FAMILY,    /* filter-family */
+    NLA_STATS_DROP_TABLE,     /* filter-table */
+    NLA_STATS_DROP_PROTOCOL,  /* filter-protocol */
+    NLA_STATS_DROP_MAX,
+} nla_stats_drop_t;
+
+
+typedef struct nla_stats_module_s {
+    uint64_t nlsm_msgs_in;         /* events from the module */
+    uint64_t nlsm_bytes_in;
+    uint64_t nlsm_msgs_out;        /* msgs sent to its peer */
+    uint64_t nlsm_bytes_out;
+    uint64_t nlsm_write_failures;  /* msgs its peer never got */
+    uint64_t nlsm_reconnects;      /* connections lost */
+    uint64_t nlsm_queue;           /* output queue, bytes or routes */
+    uint64_t nlsm_queue_hiwat;
+} nla_stats_module_t;
+
+
+typedef struct nla_stats_edge_s {
+    uint64_t nlse_msgs;            /* notified, after the policy */
+    uint64_t nlse_bytes;
+    uint64_t nlse_strips;          /* attributes stripped by strip-rtattr */
+    uint64_t nlse_drops[NLA_STATS_DROP_MAX];
+    uint64_t nlse_pad[8 - 3 - NLA_STATS_DROP_MAX];
+} nla_stats_edge_t;
+
+
+typedef struct nla_stats_latency_s {
+    uint32_t nlsl_from;            /* source module */
+    uint32_t nlsl_to;              /* sink module */
+    uint64_t nlsl_count;
+    uint64_t nlsl_sum;             /* nsecs */
+    uint64_t nlsl_max;
+    uint64_t nlsl_bucket[NLA_STATS_HIST_BUCKETS];
+} nla_stats_latency_t;
+
+
+typedef struct nla_stats_hdr_s {
+    uint32_t nlst_magic;
+    uint32_t nlst_version;
+    uint32_t nlst_modules;         /* modules in use in nlst_module */
+    uint32_t nlst_drop_reasons;    /* NLA_STATS_DROP_MAX */
+    uint64_t nlst_start_time;      /* CLOCK_REALTIME, secs */
+    uint32_t nlst_latencies;       /* histograms in use in nlst_latency */
+    uint32_t nlst_hist_buckets;    /* NLA_STATS_HIST_BUCKETS */
+    uint8_t  nlst_pad[64 - 32];
+
+    char               nlst_module_name[NLA_STATS_MODULES_MAX][NLA_STATS_NAME_LEN];
+    nla_stats_module_t nlst_module[NLA_STATS_MODULES_MAX];
+    nla_stats_edge_t   nlst_edge[NLA_STATS_MODULES_MAX][NLA_STATS_MODULES_MAX];  /* [from][to] */
+    nla_stats_latency_t nlst_latency[NLA_STATS_LATENCY_MAX];
+} nla_stats_hdr_t;
+
+
+/*
+ * Load a counter of a mapped stats page.
+ */
+static inline uint64_t
+nla_stats_load (const uint64_t *counter)
+{
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * @return the histogram bucket of nsecs.
+ */
+static inline unsigned int
+nla_stats_hist_bucket (uint64_t nsecs)
+{
+    unsigned int msb;
+    unsigned int bucket;
+
+    if (nsecs < NLA_STATS_HIST_SUB) {
+        return nsecs;
+    }
+
+    msb = 63 - __builtin_clzll(nsecs);
+    bucket = (msb - NLA_STATS_HIST_SUB_BITS + 1) * NLA_STATS_HIST_SUB +
+             ((nsecs >> (msb - NLA_STATS_HIST_SUB_BITS)) & (NLA_STATS_HIST_SUB - 1));
+
+    return (bucket < NLA_STATS_HIST_BUCKETS) ? bucket : NLA_STATS_HIST_BUCKETS - 1;
+}
+
+
+/*
+ * @return the largest nsecs of bucket.
+ */
+static inline uint64_t
+nla_stats_hist_value (unsigned int bucket)
+{
+    unsigned int shift;
+
+    if (bucket < NLA_STATS_HIST_SUB) {
+        return bucket;
+    }
+
+    shift = bucket / NLA_STATS_HIST_SUB - 1;
+
+    return ((uint64_t)(NLA_STATS_HIST_SUB + bucket % NLA_STATS_HIST_SUB + 1) << shift) - 1;
+}
+
+
+/*
+ * @return the percentile (0 to 100) of the latencies of hist, in nsecs.
+ */
+static inline uint64_t
+nla_stats_hist_percentile (const nla_stats_latency_t *hist, double percentile)
+{
+    uint64_t count, max, seen = 0, rank;
+    unsigned int i;
+
+    count = nla_stats_load(&hist->nlsl_count);
+    max = nla_stats_load(&hist->nlsl_max);
+    if (!count) {
+        return 0;
+    }
+
+    rank = (uint64_t)(percentile * count / 100);
+    if (rank >= count) {
+        rank = count - 1;
+    }
+
+    for (i = 0; i < NLA_STATS_HIST_BUCKETS; i++) {
+        seen += nla_stats_load(&hist->nlsl_bucket[i]);
+        if (seen > rank) {
+            break;
+        }
+    }
+
+    /* The buckets may be a few events ahead of max */
+    if (i >= NLA_STATS_HIST_BUCKETS - 1 || nla_stats_hist_value(i) > max) {
+        return max;
+    }
+
+    return nla_stats_hist_value(i);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _NLA_STATS_H */
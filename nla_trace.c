@@ -0,0 +1,518 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * shivakumar channalli
+ *
+ * This SOFTWARE is licensed to you under the Apache License 2.0 .
+ * You may not use this code except in compliance with the License.
+ * This code is not an official Juniper product.
+ * You can obtain a copy of the License at http://spdx.org/licenses/Apache-2.0.html
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/*
+ * Binary trace rings, see nla_trace.h.
+ *
+ * Every tracing thread owns a ring, of which it is the only producer. The
+ * drain thread is the only consumer of all the rings: a record costs the
+ * thread a copy into its ring, and never a lock or a syscall. A record
+ * which doesn't fit the ring is dropped and counted.
+ *
+ * The rings belong to nla_trace_rings: the drain thread frees them once
+ * their thread exited, and nla_trace_stop() frees the others. A thread only
+ * keeps a slot, which survives its thread_local destructors, so a thread
+ * tracing past them or past nla_trace_stop() logs text instead.
+ */
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+#include <sys/syscall.h>
+
+/* Libevent. */
+#include <event.h>
+
+/* Netlink */
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+/* nla header files. */
+#include <nla_fpm.h>
+#include <nla_defs.h>
+#include <nla_externs.h>
+
+
+/* Per thread ring, a power of 2 */
+#define NLA_TRACE_RING_SIZE   (1 << 20)
+
+/* How often the rings are drained */
+#define NLA_TRACE_DRAIN_MS    20
+
+/* Bytes of a netlink message kept by a snapshot */
+#define NLA_TRACE_SNAPSHOT_MAX (NLA_TRACE_REC_MAX - sizeof(nla_trace_rec_t))
+
+
+typedef struct nla_trace_ring_s {
+    unsigned char          *nltr_buf;
+    uint32_t                nltr_num;
+    std::atomic<bool>      *nltr_busy;     /* of the thread slot, until exited */
+    std::atomic<uint64_t>   nltr_head;     /* written by the thread */
+    std::atomic<uint64_t>   nltr_tail;     /* written by the drain thread */
+    std::atomic<uint32_t>   nltr_drops;
+    std::atomic<bool>       nltr_exited;   /* nla_trace_lock, freed once drained */
+} nla_trace_ring_t;
+
+
+/*
+ * Per thread state. Trivially destructible, it stays usable until the
+ * thread is gone.
+ */
+typedef struct nla_trace_slot_s {
+    nla_trace_ring_t   *nlts_ring;     /* valid in nlts_session only */
+    uint32_t            nlts_session;
+    bool                nlts_dead;     /* thread exiting, no more ring */
+    std::atomic<bool>   nlts_busy;     /* pushing to nlts_ring */
+} nla_trace_slot_t;
+
+
+static thread_local nla_trace_slot_t    nla_trace_slot;
+
+static std::mutex                       nla_trace_lock;
+static std::condition_variable          nla_trace_cond;
+static std::vector<nla_trace_ring_t *>  nla_trace_rings;    /* nla_trace_lock */
+static std::vector<unsigned char>       nla_trace_formats;  /* nla_trace_lock, not written yet */
+static uint32_t                         nla_trace_ids;      /* nla_trace_lock */
+static uint32_t                         nla_trace_ring_nums; /* nla_trace_lock */
+static uint32_t                         nla_trace_sessions; /* nla_trace_lock */
+static std::atomic<uint32_t>            nla_trace_session;  /* 0 once stopped */
+static std::thread                     *nla_trace_drainer;
+static bool                             nla_trace_stopping;
+static FILE                            *nla_trace_file;
+
+
+/* Marks the slot dead, and the ring exited, once the thread exits */
+struct nla_trace_thread_s {
+    bool nltt_armed;
+
+    ~nla_trace_thread_s ()
+    {
+        std::lock_guard<std::mutex> lock(nla_trace_lock);
+        nla_trace_slot_t *slot = &nla_trace_slot;
+
+        slot->nlts_dead = true;
+
+        /* Freed already by nla_trace_stop() otherwise */
+        if (slot->nlts_ring &&
+            slot->nlts_session == nla_trace_session.load(std::memory_order_relaxed)) {
+            slot->nlts_ring->nltr_exited.store(true, std::memory_order_release);
+        }
+    }
+};
+
+
+static thread_local nla_trace_thread_s  nla_trace_thread;
+
+
+static uint64_t
+nla_trace_now (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static void
+nla_trace_rec_init (nla_trace_rec_t *rec, int type, int level, uint32_t id,
+                    nla_trace_ring_t *ring)
+{
+    memset(rec, 0, sizeof(*rec));
+    rec->nltr_type = type;
+    rec->nltr_level = level;
+    rec->nltr_id = id;
+    rec->nltr_ring = ring->nltr_num;
+    rec->nltr_time = nla_trace_now();
+}
+
+
+/*
+ * Number the call site fmt, and queue its FORMAT record.
+ */
+uint32_t
+nla_trace_register (nla_trace_fmt_t *fmt, const char *format)
+{
+    std::lock_guard<std::mutex> lock(nla_trace_lock);
+    nla_trace_rec_t rec;
+    uint32_t line, id;
+    size_t func_len, format_len, off;
+    uint8_t more_info;
+
+    id = fmt->nltf_id.load(std::memory_order_relaxed);
+    if (id) {
+        return id;
+    }
+
+    id = ++nla_trace_ids;
+
+    func_len = strlen(fmt->nltf_func) + 1;
+    format_len = strnlen(format, NLA_TRACE_REC_MAX / 2) + 1;
+    line = fmt->nltf_line;
+    more_info = fmt->nltf_more_info;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.nltr_type = NLA_TRACE_REC_FORMAT;
+    rec.nltr_level = fmt->nltf_level;
+    rec.nltr_id = id;
+    rec.nltr_len = NLA_TRACE_ALIGN(sizeof(rec) + sizeof(line) + sizeof(more_info) +
+                                   func_len + format_len);
+
+    off = nla_trace_formats.size();
+    nla_trace_formats.resize(off + rec.nltr_len);
+    memcpy(&nla_trace_formats[off], &rec, sizeof(rec));
+    off += sizeof(rec);
+    memcpy(&nla_trace_formats[off], &line, sizeof(line));
+    off += sizeof(line);
+    nla_trace_formats[off++] = more_info;
+    memcpy(&nla_trace_formats[off], fmt->nltf_func, func_len);
+    off += func_len;
+    memcpy(&nla_trace_formats[off], format, format_len - 1);
+
+    fmt->nltf_id.store(id, std::memory_order_release);
+
+    return id;
+}
+
+
+static void
+nla_trace_push (nla_trace_ring_t *ring, const void *data, size_t len)
+{
+    uint64_t head, tail;
+    size_t off, first;
+
+    head = ring->nltr_head.load(std::memory_order_relaxed);
+    tail = ring->nltr_tail.load(std::memory_order_acquire);
+
+    if (NLA_TRACE_RING_SIZE - (head - tail) < len) {
+        ring->nltr_drops.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    off = head & (NLA_TRACE_RING_SIZE - 1);
+    first = std::min(len, (size_t)(NLA_TRACE_RING_SIZE - off));
+    memcpy(ring->nltr_buf + off, data, first);
+    memcpy(ring->nltr_buf, (const unsigned char *)data + first, len - first);
+
+    ring->nltr_head.store(head + len, std::memory_order_release);
+}
+
+
+/*
+ * The ring of the calling thread, created on its first record.
+ *
+ * @return NULL once the traces are stopped.
+ */
+static nla_trace_ring_t *
+nla_trace_ring (void)
+{
+    nla_trace_slot_t *slot = &nla_trace_slot;
+    nla_trace_ring_t *ring;
+    nla_trace_rec_t rec;
+    uint32_t session;
+
+    session = nla_trace_session.load(std::memory_order_acquire);
+    if (slot->nlts_ring && slot->nlts_session == session) {
+        return slot->nlts_ring;
+    }
+
+    if (!session) {
+        return NULL;
+    }
+
+    ring = new nla_trace_ring_t();
+    ring->nltr_buf = (unsigned char *)malloc(NLA_TRACE_RING_SIZE);
+    if (!ring->nltr_buf) {
+        delete ring;
+        return NULL;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(nla_trace_lock);
+
+        if (session != nla_trace_session.load(std::memory_order_relaxed)) {
+            free(ring->nltr_buf);
+            delete ring;
+            return NULL;
+        }
+
+        ring->nltr_num = ++nla_trace_ring_nums;
+        ring->nltr_busy = &slot->nlts_busy;
+        nla_trace_rings.push_back(ring);
+
+        slot->nlts_ring = ring;
+        slot->nlts_session = session;
+
+        /* The THREAD record comes first */
+        nla_trace_rec_init(&rec, NLA_TRACE_REC_THREAD, LOG_DEFAULT, syscall(SYS_gettid), ring);
+        rec.nltr_len = sizeof(rec);
+        nla_trace_push(ring, &rec, sizeof(rec));
+    }
+
+    /* Retire the ring when the thread exits */
+    nla_trace_thread.nltt_armed = true;
+
+    return ring;
+}
+
+
+/*
+ * Start a record of the calling thread. nla_trace_commit() must follow.
+ *
+ * @return false if the thread can't trace anymore.
+ */
+bool
+nla_trace_begin (nla_trace_buf_t *buf, int type, int level, uint32_t id)
+{
+    nla_trace_slot_t *slot = &nla_trace_slot;
+    nla_trace_ring_t *ring;
+
+    if (slot->nlts_dead) {
+        return false;
+    }
+
+    ring = nla_trace_ring();
+    if (!ring) {
+        return false;
+    }
+
+    /* Either nla_trace_stop() waits for this record, or we see it stopped */
+    slot->nlts_busy.store(true, std::memory_order_seq_cst);
+    if (slot->nlts_session != nla_trace_session.load(std::memory_order_seq_cst)) {
+        slot->nlts_busy.store(false, std::memory_order_release);
+        return false;
+    }
+
+    nla_trace_rec_init((nla_trace_rec_t *)buf->nltb_data, type, level, id, ring);
+    buf->nltb_len = sizeof(nla_trace_rec_t);
+
+    return true;
+}
+
+
+void
+nla_trace_commit (nla_trace_buf_t *buf)
+{
+    nla_trace_rec_t *rec = (nla_trace_rec_t *)buf->nltb_data;
+    nla_trace_slot_t *slot = &nla_trace_slot;
+    size_t len;
+
+    len = NLA_TRACE_ALIGN(buf->nltb_len);
+    memset(buf->nltb_data + buf->nltb_len, 0, len - buf->nltb_len);
+    rec->nltr_len = len;
+
+    nla_trace_push(slot->nlts_ring, buf->nltb_data, len);
+
+    slot->nlts_busy.store(false, std::memory_order_release);
+}
+
+
+/*
+ * Record the first bytes of the netlink message data, instead of dumping it.
+ *
+ * @return false if the thread can't trace anymore.
+ */
+bool
+nla_trace_snapshot (int level, const void *data, size_t len)
+{
+    nla_trace_buf_t buf;
+    size_t snap_len;
+
+    snap_len = std::min(len, (size_t)NLA_TRACE_SNAPSHOT_MAX);
+
+    if (!nla_trace_begin(&buf, NLA_TRACE_REC_SNAPSHOT, level, len)) {
+        return false;
+    }
+
+    memcpy(buf.nltb_data + buf.nltb_len, data, snap_len);
+    buf.nltb_len += snap_len;
+    nla_trace_commit(&buf);
+
+    return true;
+}
+
+
+/*
+ * Copy the new formats and records to the trace file. The exited threads
+ * rings are freed once empty.
+ */
+static void
+nla_trace_drain (void)
+{
+    std::lock_guard<std::mutex> lock(nla_trace_lock);
+    nla_trace_rec_t rec;
+    uint64_t head, tail;
+    size_t off, len, first;
+    uint32_t drops;
+    bool exited;
+
+    if (!nla_trace_formats.empty()) {
+        fwrite(nla_trace_formats.data(), 1, nla_trace_formats.size(), nla_trace_file);
+        nla_trace_formats.clear();
+    }
+
+    for (auto it = nla_trace_rings.begin(); it != nla_trace_rings.end(); ) {
+        nla_trace_ring_t *ring = *it;
+
+        /* Read before the head, no record can follow */
+        exited = ring->nltr_exited.load(std::memory_order_acquire);
+
+        head = ring->nltr_head.load(std::memory_order_acquire);
+        tail = ring->nltr_tail.load(std::memory_order_relaxed);
+
+        len = head - tail;
+        off = tail & (NLA_TRACE_RING_SIZE - 1);
+        first = std::min(len, (size_t)(NLA_TRACE_RING_SIZE - off));
+        fwrite(ring->nltr_buf + off, 1, first, nla_trace_file);
+        fwrite(ring->nltr_buf, 1, len - first, nla_trace_file);
+
+        ring->nltr_tail.store(head, std::memory_order_release);
+
+        drops = ring->nltr_drops.exchange(0, std::memory_order_relaxed);
+        if (drops) {
+            memset(&rec, 0, sizeof(rec));
+            rec.nltr_len = sizeof(rec);
+            rec.nltr_type = NLA_TRACE_REC_DROP;
+            rec.nltr_level = LOG_ERR;
+            rec.nltr_id = drops;
+            rec.nltr_ring = ring->nltr_num;
+            rec.nltr_time = nla_trace_now();
+            fwrite(&rec, 1, sizeof(rec), nla_trace_file);
+        }
+
+        if (exited) {
+            free(ring->nltr_buf);
+            delete ring;
+            it = nla_trace_rings.erase(it);
+        } else {
+            it++;
+        }
+    }
+
+    fflush(nla_trace_file);
+}
+
+
+static void
+nla_trace_drainer_run (void)
+{
+    std::unique_lock<std::mutex> lock(nla_trace_lock);
+
+    while (!nla_trace_stopping) {
+        nla_trace_cond.wait_for(lock, std::chrono::milliseconds(NLA_TRACE_DRAIN_MS));
+
+        lock.unlock();
+        nla_trace_drain();
+        lock.lock();
+    }
+}
+
+
+/*
+ * Send the traces to the binary trace file path.
+ *
+ * @return -1 if the file can't be created, 0 otherwise.
+ */
+int
+nla_trace_start (const char *path)
+{
+    uint32_t magic[2] = { NLA_TRACE_MAGIC, NLA_TRACE_VERSION };
+
+    nla_trace_file = fopen(path, "w");
+    if (!nla_trace_file) {
+        return -1;
+    }
+
+    fwrite(magic, 1, sizeof(magic), nla_trace_file);
+
+    {
+        std::lock_guard<std::mutex> lock(nla_trace_lock);
+        nla_trace_session.store(++nla_trace_sessions, std::memory_order_release);
+    }
+
+    nla_trace_stopping = false;
+    nla_trace_drainer = new std::thread(nla_trace_drainer_run);
+
+    return 0;
+}
+
+
+/*
+ * Drain the rings one last time, free them and close the trace file. The
+ * running threads log text from then on.
+ */
+void
+nla_trace_stop (void)
+{
+    if (!nla_trace_drainer) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(nla_trace_lock);
+        nla_trace_stopping = true;
+    }
+    nla_trace_cond.notify_one();
+
+    nla_trace_drainer->join();
+    delete nla_trace_drainer;
+    nla_trace_drainer = NULL;
+
+    /* No new record, wait for those being pushed */
+    nla_trace_session.store(0, std::memory_order_seq_cst);
+    {
+        std::lock_guard<std::mutex> lock(nla_trace_lock);
+
+        for (nla_trace_ring_t *ring : nla_trace_rings) {
+            /* The slot of an exited thread is gone */
+            if (ring->nltr_exited.load(std::memory_order_relaxed)) {
+                continue;
+            }
+            while (ring->nltr_busy->load(std::memory_order_seq_cst)) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    nla_trace_drain();
+
+    {
+        std::lock_guard<std::mutex> lock(nla_trace_lock);
+
+        for (nla_trace_ring_t *ring : nla_trace_rings) {
+            free(ring->nltr_buf);
+            delete ring;
+        }
+        nla_trace_rings.clear();
+    }
+
+    fclose(nla_trace_file);
+    nla_trace_file = NULL;
+}
@@ -0,0 +1,244 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * shivakumar channalli
+ *
+ * This SOFTWARE is licensed to you under the Apache License 2.0 .
+ * You may not use this code except in compliance with the License.
+ * This code is not an official Juniper product.
+ * You can obtain a copy of the License at http://spdx.org/licenses/Apache-2.0.html
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+#ifndef _NLA_TRACE_H
+#define _NLA_TRACE_H
+
+/*
+ * Binary traces, enabled with -f trace-file.
+ *
+ * nla_log() then appends a record with the id of its call site, a
+ * timestamp and the raw arguments to a ring of the calling thread, instead
+ * of formatting it. A drain thread copies the rings to the trace file, and
+ * utils/nla_trace_decode.py renders it offline.
+ *
+ * The trace file starts with NLA_TRACE_MAGIC and NLA_TRACE_VERSION (32 bit
+ * each), followed by records padded to NLA_TRACE_ALIGNTO:
+ *  FORMAT   : a call site, written before its first use. The payload is
+ *             the line (32 bit), more_info (8 bit), the function and the
+ *             format, both nul terminated.
+ *  LOG      : the arguments of a call site, each a NLA_TRACE_ARG_* tag
+ *             followed by a 64 bit value, or a 16 bit length and the bytes
+ *             of a string.
+ *  SNAPSHOT : the first bytes of a netlink message, nltr_id is its length.
+ *  THREAD   : a new ring, nltr_id is the thread id.
+ *  DROP     : nltr_id records lost to a full ring.
+ * Every record but FORMAT carries the ring number in nltr_ring.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <type_traits>
+
+
+#define NLA_TRACE_MAGIC      0x4e4c4154  /* "NLAT" */
+#define NLA_TRACE_VERSION    1
+#define NLA_TRACE_ALIGNTO    8
+#define NLA_TRACE_ALIGN(len) (((len) + NLA_TRACE_ALIGNTO - 1) & ~(NLA_TRACE_ALIGNTO - 1))
+
+/* Largest record, and string argument */
+#define NLA_TRACE_REC_MAX    2048
+#define NLA_TRACE_STR_MAX    255
+
+
+typedef enum nla_trace_rec_type_e {
+    NLA_TRACE_REC_FORMAT = 1,
+    NLA_TRACE_REC_LOG,
+    NLA_TRACE_REC_SNAPSHOT,
+    NLA_TRACE_REC_THREAD,
+    NLA_TRACE_REC_DROP,
+} nla_trace_rec_type_t;
+
+
+#define NLA_TRACE_ARG_INT    'i'
+#define NLA_TRACE_ARG_UINT   'u'
+#define NLA_TRACE_ARG_DOUBLE 'd'
+#define NLA_TRACE_ARG_PTR    'p'
+#define NLA_TRACE_ARG_STR    's'
+
+
+typedef struct nla_trace_rec_s {
+    uint16_t nltr_len;        /* of the record, header included */
+    uint8_t  nltr_type;       /* nla_trace_rec_type_t */
+    uint8_t  nltr_level;
+    uint32_t nltr_id;         /* call site */
+    uint32_t nltr_ring;
+    uint32_t nltr_pad;
+    uint64_t nltr_time;       /* CLOCK_REALTIME, nsecs */
+} nla_trace_rec_t;
+
+
+/* A nla_log() call site, numbered on its first binary trace */
+typedef struct nla_trace_fmt_s {
+    const char            *nltf_func;
+    int                    nltf_line;
+    int                    nltf_level;
+    bool                   nltf_more_info;
+    std::atomic<uint32_t>  nltf_id;
+} nla_trace_fmt_t;
+
+
+typedef struct nla_trace_buf_s {
+    size_t        nltb_len;
+    unsigned char nltb_data[NLA_TRACE_REC_MAX];
+} nla_trace_buf_t;
+
+
+uint32_t nla_trace_register(nla_trace_fmt_t *fmt, const char *format);
+
+bool nla_trace_begin(nla_trace_buf_t *buf, int type, int level, uint32_t id);
+
+void nla_trace_commit(nla_trace_buf_t *buf);
+
+bool nla_trace_snapshot(int level, const void *data, size_t len);
+
+int nla_trace_start(const char *path);
+
+void nla_trace_stop(void);
+
+
+static inline void
+nla_trace_put (nla_trace_buf_t *buf, char tag, const void *value, size_t len)
+{
+    if (buf->nltb_len + 1 + len > sizeof(buf->nltb_data)) {
+        return;
+    }
+
+    buf->nltb_data[buf->nltb_len] = tag;
+    memcpy(&buf->nltb_data[buf->nltb_len + 1], value, len);
+    buf->nltb_len += 1 + len;
+}
+
+
+static inline void
+nla_trace_arg (nla_trace_buf_t *buf, const char *value)
+{
+    unsigned char str[sizeof(uint16_t) + NLA_TRACE_STR_MAX];
+    uint16_t len;
+
+    if (!value) {
+        value = "(null)";
+    }
+
+    len = strnlen(value, NLA_TRACE_STR_MAX);
+    memcpy(str, &len, sizeof(len));
+    memcpy(str + sizeof(len), value, len);
+    nla_trace_put(buf, NLA_TRACE_ARG_STR, str, sizeof(len) + len);
+}
+
+
+static inline void
+nla_trace_arg (nla_trace_buf_t *buf, char *value)
+{
+    nla_trace_arg(buf, (const char *)value);
+}
+
+
+template <typename T>
+static inline typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+nla_trace_arg (nla_trace_buf_t *buf, T value)
+{
+    int64_t v = value;
+
+    nla_trace_put(buf, NLA_TRACE_ARG_INT, &v, sizeof(v));
+}
+
+
+template <typename T>
+static inline typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type
+nla_trace_arg (nla_trace_buf_t *buf, T value)
+{
+    uint64_t v = value;
+
+    nla_trace_put(buf, NLA_TRACE_ARG_UINT, &v, sizeof(v));
+}
+
+
+template <typename T>
+static inline typename std::enable_if<std::is_enum<T>::value>::type
+nla_trace_arg (nla_trace_buf_t *buf, T value)
+{
+    int64_t v = value;
+
+    nla_trace_put(buf, NLA_TRACE_ARG_INT, &v, sizeof(v));
+}
+
+
+template <typename T>
+static inline typename std::enable_if<std::is_floating_point<T>::value>::type
+nla_trace_arg (nla_trace_buf_t *buf, T value)
+{
+    double v = value;
+
+    nla_trace_put(buf, NLA_TRACE_ARG_DOUBLE, &v, sizeof(v));
+}
+
+
+template <typename T>
+static inline void
+nla_trace_arg (nla_trace_buf_t *buf, T *value)
+{
+    uint64_t v = (uintptr_t)value;
+
+    nla_trace_put(buf, NLA_TRACE_ARG_PTR, &v, sizeof(v));
+}
+
+
+static inline void
+nla_trace_args (nla_trace_buf_t *buf __attribute__ ((__unused__)))
+{
+}
+
+
+template <typename T, typename... Args>
+static inline void
+nla_trace_args (nla_trace_buf_t *buf, T value, Args... args)
+{
+    nla_trace_arg(buf, value);
+    nla_trace_args(buf, args...);
+}
+
+
+/*
+ * Record a nla_log() of the call site fmt.
+ *
+ * @return false if the thread can't trace anymore, the caller logs text.
+ */
+template <typename... Args>
+static inline bool
+nla_trace (nla_trace_fmt_t *fmt, const char *format, Args... args)
+{
+    nla_trace_buf_t buf;
+    uint32_t id;
+
+    id = fmt->nltf_id.load(std::memory_order_acquire);
+    if (!id) {
+        id = nla_trace_register(fmt, format);
+    }
+
+    if (!nla_trace_begin(&buf, NLA_TRACE_REC_LOG, fmt->nltf_level, id)) {
+        return false;
+    }
+
+    nla_trace_args(&buf, args...);
+    nla_trace_commit(&buf);
+
+    return true;
+}
+
+#endif /* _NLA_TRACE_H */
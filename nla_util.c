@@ -30,8 +30,14 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/queue.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <net/if.h>
+#include <atomic>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 
 /* Libevent. */
@@ -58,6 +64,7 @@ const bits nla_events[] = {
     {NLA_CONNECTION_UP,   "CONNECTION_UP"},
     {NLA_WRITE,           "WRITE"},
     {NLA_GET_ALL,         "NLA_GET_ALL"},
+    {NLA_END_OF_DUMP,     "END_OF_DUMP"},
     {NLA_EVENT_MAX,       "EVENT_MAX"},
     {0, NULL}
 };
@@ -70,6 +77,7 @@ const bits nla_modules[] = {
     {NLA_FPM_CLIENT,  "NLA_FPM_CLIENT"},
     {NLA_NLM_SERVER,  "NLA_NLM_SERVER"},
     {NLA_NLM_CLIENT,  "NLA_NLM_CLIENT"},
+    {NLA_SHM_SERVER,  "NLA_SHM_SERVER"},
     {NLA_MODULE_ALL,  "NLA_MODULE_ALL"},
     {0, NULL}
 };
@@ -103,14 +111,163 @@ nla_trace_bit (const bits *types, const char *name)
 }
 
 
-fpm_msg_hdr_t*
-nla_build_fpm_hdr (size_t data_len)
+/*
+ * Build the fpm header for a payload of data_len bytes. The large header
+ * is used only when the message doesn't fit in a version 1 header.
+ *
+ * @return length of the header written to hdr.
+ */
+size_t
+nla_build_fpm_hdr (fpm_msg_hdr_large_t *hdr, int msg_type, size_t data_len)
 {
-    static fpm_msg_hdr_t fpm_hdr;
-    fpm_hdr.version  = FPM_PROTO_VERSION;
-    fpm_hdr.msg_type = FPM_MSG_TYPE_NETLINK;
-    fpm_hdr.msg_len  = htons(fpm_data_len_to_msg_len(data_len));
-    return &fpm_hdr;
+    fpm_msg_hdr_t *fpm_hdr = (fpm_msg_hdr_t *)hdr;
+
+    if (fpm_data_len_to_msg_len(data_len) <= FPM_MAX_MSG_LEN_V1) {
+        fpm_hdr->version  = FPM_PROTO_VERSION;
+        fpm_hdr->msg_type = msg_type;
+        fpm_hdr->msg_len  = htons(fpm_data_len_to_msg_len(data_len));
+        return FPM_MSG_HDR_LEN;
+    }
+
+    hdr->version  = FPM_PROTO_VERSION_LARGE;
+    hdr->msg_type = msg_type;
+    hdr->reserved = 0;
+    hdr->msg_len  = htonl(data_len + FPM_MSG_HDR_LARGE_LEN);
+    return FPM_MSG_HDR_LARGE_LEN;
+}
+
+
+/*
+ * Length of the fpm message carrying a payload of data_len bytes.
+ */
+static size_t
+nla_fpm_msg_len (size_t data_len)
+{
+    if (fpm_data_len_to_msg_len(data_len) <= FPM_MAX_MSG_LEN_V1) {
+        return fpm_data_len_to_msg_len(data_len);
+    }
+    return data_len + FPM_MSG_HDR_LARGE_LEN;
+}
+
+
+static void
+nla_fpm_msg_add (struct evbuffer *outevb, int msg_type,
+                 const void *data, size_t data_len)
+{
+    fpm_msg_hdr_large_t hdr;
+    size_t hdr_len;
+
+    hdr_len = nla_build_fpm_hdr(&hdr, msg_type, data_len);
+
+    evbuffer_add(outevb, &hdr, hdr_len);
+    evbuffer_add(outevb, data, data_len);
+}
+
+
+/*
+ * Translate the netlink message into a fpm.Message and queue it on outevb
+ * as a fpm message of its own.
+ *
+ * @return 1 if the message is dropped, 0 otherwise.
+ */
+static int
+nla_fpm_msg_add_protobuf (struct evbuffer *outevb, struct nlmsghdr *nlmsghdr,
+                          size_t max_msg_len)
+{
+    const void *data;
+    size_t len;
+
+    data = nla_fpm_pb_encode(nlmsghdr, &len);
+    if (!data) {
+        nla_log(LOG_INFO, "nlmsg type %d has no protobuf encoding, dropped",
+                nlmsghdr->nlmsg_type);
+        return 1;
+    }
+
+    if (nla_fpm_msg_len(len) > max_msg_len) {
+        nla_log(LOG_WARN, "nlmsg type %d protobuf len %zu exceeds max fpm msg len %zu, dropped",
+                nlmsghdr->nlmsg_type, len, max_msg_len);
+        return 1;
+    }
+
+    nla_fpm_msg_add(outevb, FPM_MSG_TYPE_PROTOBUF, data, len);
+
+    return 0;
+}
+
+
+/*
+ * Wrap the netlink messages in msg into fpm messages of type msg_type and
+ * queue them on bev.
+ *
+ * Consecutive netlink messages are packed into the same fpm message as
+ * long as it stays within max_msg_len. A netlink message which doesn't
+ * fit in a fpm message by itself is dropped. With FPM_MSG_TYPE_PROTOBUF
+ * every netlink message is translated and sent in a fpm message of its own.
+ *
+ * @return number of netlink messages dropped, -1 if the write failed.
+ */
+int
+nla_fpm_msg_write (struct bufferevent *bev, int msg_type,
+                   const void *msg, int msg_len, size_t max_msg_len)
+{
+    struct evbuffer *outevb;
+    struct nlmsghdr *nlmsghdr;
+    const char *frame = NULL;
+    size_t frame_len = 0;
+    size_t len;
+    int remaining;
+    int dropped = 0;
+    int ret;
+
+    outevb = evbuffer_new();
+    if (!outevb) {
+        return -1;
+    }
+
+    remaining = msg_len;
+    nlmsghdr = (struct nlmsghdr *)msg;
+    while (nlmsg_ok(nlmsghdr, remaining)) {
+        len = NLMSG_ALIGN(nlmsghdr->nlmsg_len);
+        if (len > (size_t)remaining) {
+            len = remaining;
+        }
+
+        if (msg_type == FPM_MSG_TYPE_PROTOBUF) {
+            dropped += nla_fpm_msg_add_protobuf(outevb, nlmsghdr, max_msg_len);
+            nlmsghdr = nlmsg_next(nlmsghdr, &remaining);
+            continue;
+        }
+
+        if (frame && nla_fpm_msg_len(frame_len + len) > max_msg_len) {
+            nla_fpm_msg_add(outevb, msg_type, frame, frame_len);
+            frame = NULL;
+            frame_len = 0;
+        }
+
+        if (nla_fpm_msg_len(len) > max_msg_len) {
+            nla_log(LOG_WARN, "nlmsg type %d len %zu exceeds max fpm msg len %zu, dropped",
+                    nlmsghdr->nlmsg_type, len, max_msg_len);
+            dropped++;
+        } else {
+            if (!frame) {
+                frame = (const char *)nlmsghdr;
+            }
+            frame_len += len;
+        }
+
+        nlmsghdr = nlmsg_next(nlmsghdr, &remaining);
+    }
+
+    if (frame) {
+        nla_fpm_msg_add(outevb, msg_type, frame, frame_len);
+    }
+
+    ret = bufferevent_write_buffer(bev, outevb);
+
+    evbuffer_free(outevb);
+
+    return (ret < 0) ? -1 : dropped;
 }
 
 
@@ -130,7 +287,7 @@ nla_fpmmsg_dump (const void *msg, unsigned int msglen UNUSED)
     fpm_msg_hdr_t *fpmmsg = (fpm_msg_hdr_t *)msg;
 
     nla_log0(LOG_INFO, "--<FPM MESSAGE>");
-    nla_log0(LOG_INFO, "  [FPM HEADER] %zu octets", FPM_MSG_HDR_LEN);
+    nla_log0(LOG_INFO, "  [FPM HEADER] %zu octets", fpm_msg_hdr_len(fpmmsg));
     nla_log0(LOG_INFO, "    .version = %d", fpmmsg->version);
     nla_log0(LOG_INFO, "    .msg_type = %d", fpmmsg->msg_type);
     nla_log0(LOG_INFO, "    .msg_len = %zu", fpm_msg_len(fpmmsg));
@@ -165,6 +322,7 @@ nla_nlmsg_dump_detail (const void *msg, unsigned int msglen UNUSED)
     }
 
     nla_nl_object_dump(route);
+    rtnl_route_put(route);
 }
 
 
@@ -180,19 +338,186 @@ nla_nlmsg_dump_extensive (const void *msg, unsigned int msglen UNUSED)
 }
 
 
+/*
+ * Parsing and dumping every message is expensive, the callers check
+ * nla_log_enabled(LOG_INFO) before walking the messages. Binary traces
+ * keep a snapshot of the message instead, decoded offline.
+ */
 void
 nla_nlmsg_dump (const void *msg, unsigned int msglen)
 {
-    if (nla_gl.nlag_trace_level >= LOG_DEBUG) {
+    if (nla_gl.nlag_trace_bin && nla_trace_snapshot(LOG_INFO, msg, msglen)) {
+        return;
+    }
+
+    if (nla_log_enabled(LOG_DEBUG)) {
        nla_nlmsg_dump_extensive(msg, msglen);
     }
 
-    if (nla_gl.nlag_trace_level >= LOG_INFO) {
+    if (nla_log_enabled(LOG_INFO)) {
         nla_nlmsg_dump_detail(msg, msglen);
     }
 }
 
 
+/*
+ * Event to trigger for a netlink message received from a peer. NLMSG_DONE
+ * is the end of dump marker.
+ */
+nla_event_t
+nla_nlmsg_event (const void *msg)
+{
+    if (((const struct nlmsghdr *)msg)->nlmsg_type == NLMSG_DONE) {
+        return NLA_END_OF_DUMP;
+    }
+    return NLA_WRITE;
+}
+
+
+/*
+ * The address family of the JUNOS RIB table named table, e.g. inet.0,
+ * inet6.0 or vrf.inet.0.
+ *
+ * @return AF_INET, AF_INET6, or AF_UNSPEC for the other tables.
+ */
+int
+nla_table_family (const char *table)
+{
+    const char *last, *family;
+    size_t len;
+
+    last = strrchr(table, '.');
+    if (!last) {
+        return AF_UNSPEC;
+    }
+
+    /* The name component before the table number */
+    for (family = last; family > table && family[-1] != '.'; family--) {
+        continue;
+    }
+    len = last - family;
+
+    if (len == strlen("inet") && !strncmp(family, "inet", len)) {
+        return AF_INET;
+    }
+
+    if (len == strlen("inet6") && !strncmp(family, "inet6", len)) {
+        return AF_INET6;
+    }
+
+    return AF_UNSPEC;
+}
+
+
+/*
+ * Interface names by ifindex, kept up to date from the kernel link
+ * messages. The names are looked up for every gateway sent to RPD, a flat
+ * table keeps that down to an index, without if_indextoname() syscalls.
+ */
+static char   (*nla_ifnames)[IFNAMSIZ];
+static size_t   nla_ifnames_size;
+
+/* Bumped whenever a name changes, for the caches of other threads */
+static std::atomic<unsigned int> nla_ifnames_generation;
+
+
+/*
+ * Learn or forget the interface name of the RTM_NEWLINK or RTM_DELLINK
+ * message nlmsghdr.
+ */
+void
+nla_ifname_update (const struct nlmsghdr *nlmsghdr)
+{
+    char (*ifnames)[IFNAMSIZ];
+    char name[IFNAMSIZ];
+    struct ifinfomsg *ifi;
+    struct nlattr *attr;
+    size_t size;
+    int ifindex;
+
+    if (nlmsghdr->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi))) {
+        return;
+    }
+
+    ifi = (struct ifinfomsg *)nlmsg_data(nlmsghdr);
+    ifindex = ifi->ifi_index;
+    if (ifindex <= 0 || ifindex >= NLA_IFINDEX_MAX) {
+        nla_log(LOG_INFO, "ifindex %d not cached", ifindex);
+        return;
+    }
+
+    if (nlmsghdr->nlmsg_type == RTM_DELLINK) {
+        if ((size_t)ifindex < nla_ifnames_size && nla_ifnames[ifindex][0]) {
+            nla_ifnames[ifindex][0] = '\0';
+            nla_ifnames_generation++;
+        }
+        return;
+    }
+
+    attr = nlmsg_find_attr((struct nlmsghdr *)nlmsghdr, sizeof(*ifi), IFLA_IFNAME);
+    if (!attr) {
+        return;
+    }
+
+    if ((size_t)ifindex >= nla_ifnames_size) {
+        size = nla_ifnames_size ? nla_ifnames_size : 64;
+        while (size <= (size_t)ifindex) {
+            size *= 2;
+        }
+
+        ifnames = (char (*)[IFNAMSIZ])realloc(nla_ifnames, size * IFNAMSIZ);
+        if (!ifnames) {
+            nla_log(LOG_WARN, "failed to allocate %zu bytes", size * IFNAMSIZ);
+            return;
+        }
+        nla_ifnames = ifnames;
+        memset(nla_ifnames[nla_ifnames_size], 0, (size - nla_ifnames_size) * IFNAMSIZ);
+        nla_ifnames_size = size;
+    }
+
+    nla_strlcpy(name, attr, IFNAMSIZ);
+    if (strcmp(nla_ifnames[ifindex], name)) {
+        memcpy(nla_ifnames[ifindex], name, IFNAMSIZ);
+        nla_ifnames_generation++;
+    }
+}
+
+
+/*
+ * @return the name of interface ifindex, or NULL if it isn't known.
+ */
+const char *
+nla_ifname (int ifindex)
+{
+    if (ifindex <= 0 || (size_t)ifindex >= nla_ifnames_size || !nla_ifnames[ifindex][0]) {
+        return NULL;
+    }
+
+    return nla_ifnames[ifindex];
+}
+
+
+/*
+ * @return a number which changes with the interface names. It may be read
+ * from any thread.
+ */
+unsigned int
+nla_ifname_generation (void)
+{
+    return nla_ifnames_generation.load(std::memory_order_relaxed);
+}
+
+
+void
+nla_ifname_flush (void)
+{
+    free(nla_ifnames);
+    nla_ifnames = NULL;
+    nla_ifnames_size = 0;
+    nla_ifnames_generation++;
+}
+
+
 void
 nla_nlmsg_walk (const void *msg, int msg_len,
                 void (*nlmsg_cb)(const void *msg, unsigned int msg_len))
@@ -221,11 +546,16 @@ nla_fpm_msg_walk (const void *msg, int msg_len,
 
     fpm_msg_hdr = (fpm_msg_hdr_t *)msg;
     received_msg_len = msg_len;
-    while (fpm_msg_hdr_ok(fpm_msg_hdr)) {
+    while (fpm_msg_max_ok(fpm_msg_hdr, received_msg_len, received_msg_len)) {
         if (fpm_msg_cb) {
             fpm_msg_cb(fpm_msg_hdr, fpm_msg_len(fpm_msg_hdr));
         }
 
+        if (fpm_msg_hdr->msg_type != FPM_MSG_TYPE_NETLINK) {
+            fpm_msg_hdr = fpm_msg_next(fpm_msg_hdr, &received_msg_len);
+            continue;
+        }
+
         nla_nlmsg_walk(fpm_msg_data(fpm_msg_hdr),
                        fpm_msg_data_len(fpm_msg_hdr),
                        nlmsg_cb);
@@ -235,6 +565,520 @@ nla_fpm_msg_walk (const void *msg, int msg_len,
 }
 
 
+/*
+ * Read all the complete fpm messages queued in inevb, and hand over the
+ * netlink messages they carry to nlmsg_cb. Messages are processed in place
+ * whenever they are contiguous in inevb. Protobuf payloads are translated
+ * back to netlink first.
+ *
+ * @return -1 if a malformed fpm message is found, 0 otherwise.
+ */
+int
+nla_fpm_msg_read (struct evbuffer *inevb, size_t max_msg_len,
+                  void (*nlmsg_cb)(const void *msg, unsigned int msg_len))
+{
+    fpm_msg_hdr_large_t fpm_msg_hdr;
+    unsigned char *data;
+    size_t hdr_len;
+    size_t msg_len;
+    size_t n;
+
+    for (;;) {
+        n = evbuffer_get_length(inevb);
+        if (n < FPM_MSG_HDR_LEN) {
+            /* Done. */
+            break;
+        }
+
+        /* Take a look at the fpm header to find out the msg length */
+        evbuffer_copyout(inevb, &fpm_msg_hdr,
+                         (n < FPM_MSG_HDR_LARGE_LEN) ? n : FPM_MSG_HDR_LARGE_LEN);
+
+        hdr_len = fpm_msg_hdr_len((fpm_msg_hdr_t *)&fpm_msg_hdr);
+        if (n < hdr_len) {
+            break;
+        }
+
+        if (!fpm_msg_hdr_max_ok((fpm_msg_hdr_t *)&fpm_msg_hdr, max_msg_len)) {
+            nla_log(LOG_WARN, "fpm_msg_hdr_ok check failed, version %d type %d len %zu",
+                    fpm_msg_hdr.version, fpm_msg_hdr.msg_type,
+                    fpm_msg_len((fpm_msg_hdr_t *)&fpm_msg_hdr));
+            return -1;
+        }
+
+        msg_len = fpm_msg_len((fpm_msg_hdr_t *)&fpm_msg_hdr);
+        if (n < msg_len) {
+            nla_log(LOG_INFO, "[read bytes %zu, fpm msg len %zu] Not enough data to proceed",
+                    n, msg_len);
+            break;
+        }
+
+        data = evbuffer_pullup(inevb, msg_len);
+        if (!data) {
+            nla_log(LOG_WARN, "evbuffer_pullup failed, fpm msg len %zu", msg_len);
+            return -1;
+        }
+
+        nla_log(LOG_INFO, "read bytes, msg %p len %zu", data, msg_len);
+
+        if (fpm_msg_hdr.msg_type == FPM_MSG_TYPE_PROTOBUF) {
+            if (nla_log_enabled(LOG_INFO)) {
+                nla_fpmmsg_dump(data, msg_len);
+            }
+            if (nla_fpm_pb_decode(fpm_msg_data((fpm_msg_hdr_t *)data),
+                                  fpm_msg_data_len((fpm_msg_hdr_t *)data),
+                                  nlmsg_cb) < 0) {
+                return -1;
+            }
+        } else {
+            if (nla_log_enabled(LOG_INFO)) {
+                nla_fpm_msg_walk(data, msg_len, nla_fpmmsg_dump, nla_nlmsg_dump);
+            }
+            nla_fpm_msg_walk(data, msg_len, NULL, nlmsg_cb);
+        }
+
+        evbuffer_drain(inevb, msg_len);
+    }
+
+    return 0;
+}
+
+
+/*
+ * Send the compression negotiation message, see nla_nlm_hello_t.
+ */
+void
+nla_nlm_hello_write (struct bufferevent *bev, int compression)
+{
+    struct {
+        struct nlmsghdr nlmsghdr;
+        nla_nlm_hello_t hello;
+    } msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.nlmsghdr.nlmsg_len = NLMSG_LENGTH(sizeof(nla_nlm_hello_t));
+    msg.nlmsghdr.nlmsg_type = NLMSG_NOOP;
+    msg.hello.nlnh_magic = htonl(NLA_NLM_HELLO_MAGIC);
+    msg.hello.nlnh_compression = htonl(compression);
+
+    bufferevent_write(bev, &msg, NLMSG_ALIGN(msg.nlmsghdr.nlmsg_len));
+}
+
+
+/*
+ * @return true if msg is a compression negotiation message, whose
+ *         compression is returned.
+ */
+bool
+nla_nlm_hello_parse (const void *msg, unsigned int msg_len, int *compression)
+{
+    const struct nlmsghdr *nlmsghdr = (const struct nlmsghdr *)msg;
+    nla_nlm_hello_t hello;
+
+    if (msg_len < NLMSG_LENGTH(sizeof(nla_nlm_hello_t)) ||
+        nlmsghdr->nlmsg_type != NLMSG_NOOP ||
+        nlmsghdr->nlmsg_len < NLMSG_LENGTH(sizeof(nla_nlm_hello_t))) {
+        return false;
+    }
+
+    memcpy(&hello, NLMSG_DATA(nlmsghdr), sizeof(hello));
+    if (ntohl(hello.nlnh_magic) != NLA_NLM_HELLO_MAGIC) {
+        return false;
+    }
+
+    *compression = ntohl(hello.nlnh_compression);
+
+    return true;
+}
+
+
+/*
+ * Check the netlink message header at the head of a NLM stream.
+ *
+ * @return the aligned length of the message, 0 if the header is malformed.
+ */
+static size_t
+nla_nlmsg_stream_len (const struct nlmsghdr *nlmsghdr)
+{
+    if (nlmsghdr->nlmsg_len < NLMSG_HDRLEN ||
+        NLMSG_ALIGN(nlmsghdr->nlmsg_len) > NLA_NLMSG_MAX_LEN) {
+        nla_log(LOG_WARN, "invalid nlmsg type %d len %u",
+                nlmsghdr->nlmsg_type, nlmsghdr->nlmsg_len);
+        return 0;
+    }
+
+    return NLMSG_ALIGN(nlmsghdr->nlmsg_len);
+}
+
+
+/*
+ * Read all the complete netlink messages queued in inevb, and hand them
+ * over to nlmsg_cb.
+ *
+ * The messages are processed in place: every complete message in the
+ * first chunk of inevb is walked in one go, and drained at once. Only a
+ * message straddling two chunks is copied out, into a buffer which is
+ * kept for the next one.
+ *
+ * @return -1 if a malformed netlink message is found, 0 otherwise.
+ */
+int
+nla_nlmsg_read (struct evbuffer *inevb,
+                void (*nlmsg_cb)(const void *msg, unsigned int msg_len))
+{
+    static unsigned char *straddle_buf;
+    static size_t straddle_buf_len;
+    struct evbuffer_iovec vec;
+    struct nlmsghdr nlmsghdr;
+    unsigned char *chunk;
+    unsigned char *buf;
+    size_t chunk_len;
+    size_t msg_len;
+    size_t off;
+
+    for (;;) {
+        if (evbuffer_get_length(inevb) < NLMSG_HDRLEN) {
+            /* Done. */
+            break;
+        }
+
+        if (evbuffer_peek(inevb, -1, NULL, &vec, 1) < 1) {
+            break;
+        }
+
+        chunk = (unsigned char *)vec.iov_base;
+        chunk_len = vec.iov_len;
+
+        /* The complete messages at the head of the chunk */
+        off = 0;
+        while (chunk_len - off >= NLMSG_HDRLEN) {
+            memcpy(&nlmsghdr, chunk + off, NLMSG_HDRLEN);
+            msg_len = nla_nlmsg_stream_len(&nlmsghdr);
+            if (!msg_len) {
+                return -1;
+            }
+            if (chunk_len - off < msg_len) {
+                break;
+            }
+            off += msg_len;
+        }
+
+        if (off) {
+            nla_log(LOG_INFO, "read bytes, msg %p len %zu", chunk, off);
+
+            if (nla_log_enabled(LOG_INFO)) {
+                nla_nlmsg_walk(chunk, off, nla_nlmsg_dump);
+            }
+            nla_nlmsg_walk(chunk, off, nlmsg_cb);
+            evbuffer_drain(inevb, off);
+            continue;
+        }
+
+        /* The first message straddles two chunks */
+        evbuffer_copyout(inevb, &nlmsghdr, NLMSG_HDRLEN);
+        msg_len = nla_nlmsg_stream_len(&nlmsghdr);
+        if (!msg_len) {
+            return -1;
+        }
+
+        if (evbuffer_get_length(inevb) < msg_len) {
+            nla_log(LOG_INFO, "[read bytes %zu, nlmsg len %zu] Not enough data to proceed",
+                    evbuffer_get_length(inevb), msg_len);
+            break;
+        }
+
+        if (straddle_buf_len < msg_len) {
+            buf = (unsigned char *)realloc(straddle_buf, msg_len);
+            if (!buf) {
+                nla_log(LOG_WARN, "failed to allocate %zu bytes", msg_len);
+                return -1;
+            }
+            straddle_buf = buf;
+            straddle_buf_len = msg_len;
+        }
+
+        evbuffer_remove(inevb, straddle_buf, msg_len);
+
+        nla_log(LOG_INFO, "read bytes, msg %p len %zu", straddle_buf, msg_len);
+
+        if (nla_log_enabled(LOG_INFO)) {
+            nla_nlmsg_walk(straddle_buf, msg_len, nla_nlmsg_dump);
+        }
+        nla_nlmsg_walk(straddle_buf, msg_len, nlmsg_cb);
+    }
+
+    return 0;
+}
+
+
+/*
+ * Create a nonblocking socket for addr.
+ *
+ * @return the socket, -1 on failure.
+ */
+static evutil_socket_t
+nla_socket_new (const nla_sockaddr_t *addr)
+{
+    evutil_socket_t fd;
+
+    fd = socket(addr->nlasa_addr.ss_family, addr->nlasa_socktype, 0);
+    if (fd < 0) {
+        nla_log(LOG_INFO, "socket failure: %s", strerror(errno));
+        return -1;
+    }
+
+    if (evutil_make_socket_nonblocking(fd) < 0 ||
+        evutil_make_socket_closeonexec(fd) < 0) {
+        evutil_closesocket(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+/*
+ * Remove a socket file left behind by a previous instance, so that the
+ * unix domain address can be bound again. A socket still listened on, by
+ * another nlagent or any other daemon, is left alone.
+ *
+ * @return -1 if addr is in use, 0 otherwise.
+ */
+static int
+nla_socket_unlink_stale (const nla_sockaddr_t *addr)
+{
+    const struct sockaddr_un *un_addr = (const struct sockaddr_un *)&addr->nlasa_addr;
+    evutil_socket_t fd;
+    struct stat st;
+    int ret;
+
+    if (addr->nlasa_addr.ss_family != AF_UNIX || un_addr->sun_path[0] == '\0') {
+        return 0;
+    }
+
+    if (stat(un_addr->sun_path, &st) || !S_ISSOCK(st.st_mode)) {
+        return 0;
+    }
+
+    fd = nla_socket_new(addr);
+    if (fd < 0) {
+        return 0;
+    }
+
+    /* Only a socket nobody listens on refuses the connection */
+    ret = connect(fd, (const struct sockaddr *)&addr->nlasa_addr, addr->nlasa_len);
+    if (ret < 0 && errno == ECONNREFUSED) {
+        unlink(un_addr->sun_path);
+    } else if (ret == 0 || errno == EAGAIN) {
+        nla_log(LOG_WARN, "address %s in use", un_addr->sun_path);
+        evutil_closesocket(fd);
+        return -1;
+    }
+
+    evutil_closesocket(fd);
+
+    return 0;
+}
+
+
+/*
+ * Create a listener accepting connections on addr.
+ */
+struct evconnlistener *
+nla_listener_new (const nla_sockaddr_t *addr,
+                  void (*cb)(struct evconnlistener *listener, evutil_socket_t fd,
+                             struct sockaddr *sa, int socklen, void *arg))
+{
+    struct evconnlistener *listener;
+    evutil_socket_t fd;
+
+    fd = nla_socket_new(addr);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    if (addr->nlasa_addr.ss_family == AF_UNIX) {
+        if (nla_socket_unlink_stale(addr) < 0) {
+            evutil_closesocket(fd);
+            return NULL;
+        }
+    } else {
+        evutil_make_listen_socket_reuseable(fd);
+    }
+
+    if (bind(fd, (const struct sockaddr *)&addr->nlasa_addr, addr->nlasa_len) < 0) {
+        nla_log(LOG_INFO, "bind failure: %s", strerror(errno));
+        evutil_closesocket(fd);
+        return NULL;
+    }
+
+    listener = evconnlistener_new(nla_gl.nlag_base, cb, NULL,
+                                  LEV_OPT_CLOSE_ON_FREE, -1, fd);
+    if (!listener) {
+        evutil_closesocket(fd);
+    }
+
+    return listener;
+}
+
+
+static void
+nla_socket_set_opt (evutil_socket_t fd, int level, int optname,
+                    const char *name, int value)
+{
+    if (value == NLA_INVALID) {
+        return;
+    }
+
+    if (setsockopt(fd, level, optname, &value, sizeof(value)) < 0) {
+        nla_log(LOG_WARN, "setsockopt %s %d failure: %s", name, value, strerror(errno));
+    }
+}
+
+
+/*
+ * Apply the socket options opts to fd.
+ */
+static void
+nla_socket_set_opts (evutil_socket_t fd, int socktype, const nla_sockopt_t *opts)
+{
+    struct sockaddr_storage ss;
+    socklen_t sslen = sizeof(ss);
+    bool tcp;
+
+    if (!opts) {
+        return;
+    }
+
+    if (getsockname(fd, (struct sockaddr *)&ss, &sslen) < 0) {
+        return;
+    }
+
+    tcp = (socktype == SOCK_STREAM &&
+           (ss.ss_family == AF_INET || ss.ss_family == AF_INET6));
+
+    nla_socket_set_opt(fd, SOL_SOCKET, SO_SNDBUF, "SO_SNDBUF", opts->nlaso_sndbuf);
+    nla_socket_set_opt(fd, SOL_SOCKET, SO_RCVBUF, "SO_RCVBUF", opts->nlaso_rcvbuf);
+
+    if (!tcp) {
+        return;
+    }
+
+    nla_socket_set_opt(fd, SOL_SOCKET, SO_BUSY_POLL, "SO_BUSY_POLL", opts->nlaso_busy_poll);
+    nla_socket_set_opt(fd, SOL_SOCKET, SO_KEEPALIVE, "SO_KEEPALIVE", opts->nlaso_keepalive);
+    nla_socket_set_opt(fd, IPPROTO_TCP, TCP_KEEPIDLE, "TCP_KEEPIDLE", opts->nlaso_keepidle);
+    nla_socket_set_opt(fd, IPPROTO_TCP, TCP_KEEPINTVL, "TCP_KEEPINTVL", opts->nlaso_keepintvl);
+    nla_socket_set_opt(fd, IPPROTO_TCP, TCP_KEEPCNT, "TCP_KEEPCNT", opts->nlaso_keepcnt);
+    nla_socket_set_opt(fd, IPPROTO_TCP, TCP_NODELAY, "TCP_NODELAY", opts->nlaso_nodelay);
+    nla_socket_set_opt(fd, IPPROTO_TCP, TCP_CORK, "TCP_CORK", opts->nlaso_cork);
+    nla_socket_set_opt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, "TCP_NOTSENT_LOWAT",
+                       opts->nlaso_notsent_lowat);
+}
+
+
+/*
+ * Push out the partial segment held back by TCP_CORK. Called once the
+ * output buffer is drained, so that the messages queued in one go leave
+ * in full segments, like with MSG_MORE, without delaying the last one.
+ */
+void
+nla_bufferevent_uncork (struct bufferevent *bev, const nla_sockopt_t *opts)
+{
+    evutil_socket_t fd;
+    int off = 0, on = 1;
+
+    if (!bev || !opts || opts->nlaso_cork != 1) {
+        return;
+    }
+
+    fd = bufferevent_getfd(bev);
+    if (fd < 0) {
+        return;
+    }
+
+    if (setsockopt(fd, IPPROTO_TCP, TCP_CORK, &off, sizeof(off)) == 0) {
+        setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+    }
+}
+
+
+/*
+ * Create a bufferevent on fd, or on a new socket for addr if fd is -1,
+ * and apply the socket options opts (may be NULL).
+ *
+ * A SOCK_SEQPACKET socket truncates a packet read with a short buffer, so
+ * both directions are capped at NLA_SEQPACKET_MAX_LEN.
+ */
+struct bufferevent *
+nla_bufferevent_new (evutil_socket_t fd, const nla_sockaddr_t *addr,
+                     const nla_sockopt_t *opts)
+{
+    struct bufferevent *bev;
+    int socktype = SOCK_STREAM;
+    socklen_t optlen = sizeof(socktype);
+
+    if (fd < 0) {
+        fd = nla_socket_new(addr);
+        if (fd < 0) {
+            return NULL;
+        }
+    }
+
+    getsockopt(fd, SOL_SOCKET, SO_TYPE, &socktype, &optlen);
+
+    nla_socket_set_opts(fd, socktype, opts);
+
+    bev = bufferevent_socket_new(nla_gl.nlag_base, fd, BEV_OPT_CLOSE_ON_FREE);
+    if (!bev) {
+        evutil_closesocket(fd);
+        return NULL;
+    }
+
+    if (socktype == SOCK_SEQPACKET) {
+        bufferevent_set_max_single_read(bev, NLA_SEQPACKET_MAX_LEN);
+        bufferevent_set_max_single_write(bev, NLA_SEQPACKET_MAX_LEN);
+    }
+
+    return bev;
+}
+
+
+/*
+ * @return true if a msg of len bytes can be written to bev. A
+ *         SOCK_SEQPACKET link doesn't take msgs longer than
+ *         NLA_SEQPACKET_MAX_LEN, the peer would not read them whole.
+ */
+bool
+nla_bufferevent_msg_fits (struct bufferevent *bev, size_t len)
+{
+    int socktype = SOCK_STREAM;
+    socklen_t optlen = sizeof(socktype);
+
+    if (len <= NLA_SEQPACKET_MAX_LEN) {
+        return true;
+    }
+
+    /* Only the long msgs pay for the lookup */
+    getsockopt(bufferevent_getfd(bev), SOL_SOCKET, SO_TYPE, &socktype, &optlen);
+
+    return socktype != SOCK_SEQPACKET;
+}
+
+
+/*
+ * @return CLOCK_MONOTONIC, in nsecs.
+ */
+uint64_t
+nla_clock_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
 nla_event_info_t *
 nla_event_info_clone (nla_event_info_t *evinfo)
 {
@@ -243,6 +1087,7 @@ nla_event_info_clone (nla_event_info_t *evinfo)
     dup = (nla_event_info_t*)calloc(1, sizeof(nla_event_info_t));
     dup->nlaei_type = evinfo->nlaei_type;
     dup->nlaei_msglen = evinfo->nlaei_msglen;
+    dup->nlaei_time = evinfo->nlaei_time;
 
     dup->nlaei_msg = calloc(1, evinfo->nlaei_msglen);
     memcpy((void *)dup->nlaei_msg, evinfo->nlaei_msg, evinfo->nlaei_msglen);
@@ -0,0 +1,314 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * shivakumar channalli
+ *
+ * This SOFTWARE is licensed to you under the Apache License 2.0 .
+ * You may not use this code except in compliance with the License.
+ * This code is not an official Juniper product.
+ * You can obtain a copy of the License at http://spdx.org/licenses/Apache-2.0.html
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/*
+ * Compressed NLM stream.
+ *
+ * Once negotiated, the NLM client sends a single zlib stream to the NLM
+ * server, flushed (Z_SYNC_FLUSH) after every batch of netlink messages so
+ * that the server can decode it right away. The stream is never reset
+ * while connected, so the previous 32 KiB of messages act as a dictionary
+ * for the next batch; route messages mostly differ in a few bytes.
+ *
+ * (De)compression runs on a worker thread per stream. The event loop hands
+ * over the input and gets the output back through a pipe event.
+ */
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <assert.h>
+#include <zlib.h>
+
+/* Libevent. */
+#include <event.h>
+
+/* Netlink */
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+/* nla header files. */
+#include <nla_fpm.h>
+#include <nla_defs.h>
+#include <nla_externs.h>
+
+
+/* Output produced per deflate/inflate call */
+#define NLA_ZSTREAM_CHUNK 65536
+
+
+struct nla_zstream_s {
+    bool                        nlzs_deflate;
+    z_stream                    nlzs_zs;
+    void                      (*nlzs_out_cb)(const void *data, size_t len);
+
+    std::thread                *nlzs_thread;
+    std::mutex                  nlzs_lock;
+    std::condition_variable     nlzs_cond;
+    std::vector<unsigned char>  nlzs_in;     /* from the event loop */
+    std::vector<unsigned char>  nlzs_out;    /* to the event loop */
+    bool                        nlzs_stop;
+    bool                        nlzs_failed;
+
+    int                         nlzs_pipe_fd[2];
+    struct event               *nlzs_pipe_read_event;
+};
+
+
+/*
+ * (De)compress in into out.
+ *
+ * @return -1 on a zlib error, 0 otherwise.
+ */
+static int
+nla_zstream_process (nla_zstream_t *zstream, std::vector<unsigned char> &in,
+                     std::vector<unsigned char> &out)
+{
+    z_stream *zs = &zstream->nlzs_zs;
+    size_t len;
+    int ret;
+
+    zs->next_in = in.data();
+    zs->avail_in = in.size();
+
+    do {
+        len = out.size();
+        out.resize(len + NLA_ZSTREAM_CHUNK);
+        zs->next_out = out.data() + len;
+        zs->avail_out = NLA_ZSTREAM_CHUNK;
+
+        if (zstream->nlzs_deflate) {
+            ret = deflate(zs, Z_SYNC_FLUSH);
+        } else {
+            ret = inflate(zs, Z_SYNC_FLUSH);
+        }
+
+        out.resize(len + NLA_ZSTREAM_CHUNK - zs->avail_out);
+
+        if (ret == Z_BUF_ERROR) {
+            /* No progress possible, i.e. all the input is consumed */
+            break;
+        }
+
+        if (ret != Z_OK) {
+            nla_log(LOG_WARN, "%s failed: %d %s", zstream->nlzs_deflate ? "deflate" : "inflate",
+                    ret, zs->msg ? zs->msg : "");
+            return -1;
+        }
+    } while (zs->avail_in || !zs->avail_out);
+
+    return 0;
+}
+
+
+static void
+nla_zstream_worker (nla_zstream_t *zstream)
+{
+    std::vector<unsigned char> in, out;
+    char wakeup = 0;
+    int ret;
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(zstream->nlzs_lock);
+
+            zstream->nlzs_cond.wait(lock, [zstream] {
+                return zstream->nlzs_stop || !zstream->nlzs_in.empty();
+            });
+
+            if (zstream->nlzs_stop) {
+                break;
+            }
+
+            /* Everything queued so far is one batch */
+            in.swap(zstream->nlzs_in);
+        }
+
+        out.clear();
+        ret = nla_zstream_process(zstream, in, out);
+        in.clear();
+
+        {
+            std::lock_guard<std::mutex> lock(zstream->nlzs_lock);
+
+            zstream->nlzs_out.insert(zstream->nlzs_out.end(), out.begin(), out.end());
+            if (ret < 0) {
+                zstream->nlzs_failed = true;
+            }
+        }
+
+        /* A full pipe already has a wakeup pending */
+        while (write(zstream->nlzs_pipe_fd[1], &wakeup, sizeof(wakeup)) < 0 &&
+               errno == EINTR) {
+            continue;
+        }
+
+        if (ret < 0) {
+            break;
+        }
+    }
+}
+
+
+static void
+nla_zstream_pipe_read (evutil_socket_t fd, short event UNUSED, void *arg)
+{
+    nla_zstream_t *zstream = (nla_zstream_t *)arg;
+    std::vector<unsigned char> out;
+    char wakeup[64];
+    bool failed;
+
+    while (read(fd, wakeup, sizeof(wakeup)) > 0) {
+        continue;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(zstream->nlzs_lock);
+
+        out.swap(zstream->nlzs_out);
+        failed = zstream->nlzs_failed;
+    }
+
+    /* The stream may be freed by out_cb */
+    if (failed) {
+        zstream->nlzs_out_cb(NULL, 0);
+    } else if (!out.empty()) {
+        zstream->nlzs_out_cb(out.data(), out.size());
+    }
+}
+
+
+/*
+ * Create a compressing (deflate) or decompressing stream. out_cb is called
+ * from the event loop with the output of the worker thread, and with NULL
+ * once the stream fails.
+ */
+nla_zstream_t *
+nla_zstream_new (bool deflate, void (*out_cb)(const void *data, size_t len))
+{
+    nla_zstream_t *zstream;
+    int ret;
+
+    zstream = new nla_zstream_t();
+    zstream->nlzs_deflate = deflate;
+    zstream->nlzs_out_cb = out_cb;
+    zstream->nlzs_pipe_fd[0] = -1;
+    zstream->nlzs_pipe_fd[1] = -1;
+
+    if (deflate) {
+        ret = deflateInit(&zstream->nlzs_zs, Z_DEFAULT_COMPRESSION);
+    } else {
+        ret = inflateInit(&zstream->nlzs_zs);
+    }
+
+    if (ret != Z_OK) {
+        nla_log(LOG_WARN, "zlib init failed: %d", ret);
+        delete zstream;
+        return NULL;
+    }
+
+    if (pipe2(zstream->nlzs_pipe_fd, O_NONBLOCK|O_CLOEXEC) < 0) {
+        nla_log(LOG_INFO, "failed to create pipe");
+        goto failed;
+    }
+
+    zstream->nlzs_pipe_read_event = event_new(nla_gl.nlag_base,
+                                              zstream->nlzs_pipe_fd[0],
+                                              EV_READ|EV_PERSIST,
+                                              nla_zstream_pipe_read,
+                                              zstream);
+
+    if (!zstream->nlzs_pipe_read_event ||
+        event_add(zstream->nlzs_pipe_read_event, NULL) < 0) {
+        nla_log(LOG_INFO, "failed to add pipe read event");
+        goto failed;
+    }
+
+    zstream->nlzs_thread = new std::thread(nla_zstream_worker, zstream);
+
+    return zstream;
+
+failed:
+
+    nla_zstream_free(zstream);
+    return NULL;
+}
+
+
+void
+nla_zstream_free (nla_zstream_t *zstream)
+{
+    if (!zstream) {
+        return;
+    }
+
+    if (zstream->nlzs_thread) {
+        {
+            std::lock_guard<std::mutex> lock(zstream->nlzs_lock);
+            zstream->nlzs_stop = true;
+        }
+        zstream->nlzs_cond.notify_one();
+
+        zstream->nlzs_thread->join();
+        delete zstream->nlzs_thread;
+    }
+
+    if (zstream->nlzs_pipe_read_event) {
+        event_free(zstream->nlzs_pipe_read_event);
+    }
+
+    if (zstream->nlzs_pipe_fd[0] >= 0) {
+        close(zstream->nlzs_pipe_fd[0]);
+        close(zstream->nlzs_pipe_fd[1]);
+    }
+
+    if (zstream->nlzs_deflate) {
+        deflateEnd(&zstream->nlzs_zs);
+    } else {
+        inflateEnd(&zstream->nlzs_zs);
+    }
+
+    delete zstream;
+}
+
+
+/*
+ * Queue data to the worker thread. Whatever is queued while the worker is
+ * busy becomes the next batch.
+ */
+void
+nla_zstream_push (nla_zstream_t *zstream, const void *data, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)data;
+
+    {
+        std::lock_guard<std::mutex> lock(zstream->nlzs_lock);
+        zstream->nlzs_in.insert(zstream->nlzs_in.end(), p, p + len);
+    }
+
+    zstream->nlzs_cond.notify_one();
+}
@@ -0,0 +1,124 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * shivakumar channalli
+ *
+ * This SOFTWARE is licensed to you under the Apache License 2.0 .
+ * You may not use this code except in compliance with the License.
+ * This code is not an official Juniper product.
+ * You can obtain a copy of the License at http://spdx.org/licenses/Apache-2.0.html
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+
+/*
+ * Dispatch of an event to the modules which asked for it, through their
+ * policy.
+ */
+
+#include "nla_test.h"
+
+
+static int nla_test_notified[NLA_MODULE_ALL];
+
+
+static void
+nla_test_notify (nla_module_id_t module, nla_event_info_t *evinfo UNUSED)
+{
+    nla_test_notified[module]++;
+}
+
+
+static void
+nla_test_fpm_server_notify (nla_module_id_t from UNUSED, nla_event_info_t *evinfo)
+{
+    nla_test_notify(NLA_FPM_SERVER, evinfo);
+}
+
+
+static void
+nla_test_nlm_server_notify (nla_module_id_t from UNUSED, nla_event_info_t *evinfo)
+{
+    nla_test_notify(NLA_NLM_SERVER, evinfo);
+}
+
+
+static nla_module_vector_t nla_test_fpm_server_vector = {
+    NLA_FPM_SERVER, NULL, NULL, NULL, nla_test_fpm_server_notify,
+};
+
+static nla_module_vector_t nla_test_nlm_server_vector = {
+    NLA_NLM_SERVER, NULL, NULL, NULL, nla_test_nlm_server_notify,
+};
+
+
+/*
+ * A sink module, up and notified of the events of NLA_KNLM.
+ */
+static void
+nla_test_sink (nla_module_id_t module, nla_module_vector_t *vec)
+{
+    nla_infa_modules[module].nlam_config.nlamc_enable = true;
+    nla_infa_modules[module].nlam_config.nlamc_notify_me[NLA_KNLM] = true;
+    nla_infa_modules[module].nlam_connection_state = NLA_CONNECTION_UP;
+    nla_infa_modules[module].nlam_vec = vec;
+}
+
+
+/*
+ * Dispatch a route of protocol from the kernel.
+ */
+static void
+nla_test_dispatch_route (unsigned char protocol)
+{
+    struct {
+        struct nlmsghdr nlh;
+        struct rtmsg    rtm;
+    } msg;
+    nla_event_info_t evinfo;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.nlh.nlmsg_len = sizeof(msg);
+    msg.nlh.nlmsg_type = RTM_NEWROUTE;
+    msg.rtm.rtm_family = AF_INET;
+    msg.rtm.rtm_table = RT_TABLE_MAIN;
+    msg.rtm.rtm_protocol = protocol;
+
+    memset(&evinfo, 0, sizeof(evinfo));
+    evinfo.nlaei_type = NLA_WRITE;
+    evinfo.nlaei_msg = &msg;
+    evinfo.nlaei_msglen = sizeof(msg);
+
+    memset(nla_test_notified, 0, sizeof(nla_test_notified));
+    nla_infra_event_dispatcher(NLA_KNLM, &evinfo);
+}
+
+
+int
+main (int argc UNUSED, char **argv UNUSED)
+{
+    nla_policy_t *policy;
+
+    /* The FPM server, first in the dispatch order, takes BGP routes only */
+    nla_test_sink(NLA_FPM_SERVER, &nla_test_fpm_server_vector);
+    nla_test_sink(NLA_NLM_SERVER, &nla_test_nlm_server_vector);
+
+    policy = nla_infa_modules[NLA_FPM_SERVER].nlam_config.nlamc_policy;
+    policy[NLAP_FILTER_PROTOCOL].nlap_value[policy[NLAP_FILTER_PROTOCOL].nlap_entries++] = RTPROT_BGP;
+
+    /* Dropped by the policy of the FPM server, the NLM server still gets it */
+    nla_test_dispatch_route(RTPROT_STATIC);
+    NLA_TEST_CHECK(nla_test_notified[NLA_FPM_SERVER] == 0);
+    NLA_TEST_CHECK(nla_test_notified[NLA_NLM_SERVER] == 1);
+
+    nla_test_dispatch_route(RTPROT_BGP);
+    NLA_TEST_CHECK(nla_test_notified[NLA_FPM_SERVER] == 1);
+    NLA_TEST_CHECK(nla_test_notified[NLA_NLM_SERVER] == 1);
+
+    return NLA_TEST_EXIT();
+}
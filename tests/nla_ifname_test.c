@@ -0,0 +1,88 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * shivakumar channalli
+ *
+ * This SOFTWARE is licensed to you under the Apache License 2.0 .
+ * You may not use this code except in compliance with the License.
+ * This code is not an official Juniper product.
+ * You can obtain a copy of the License at http://spdx.org/licenses/Apache-2.0.html
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+/*
+ * Interface names learnt from the kernel link messages, and the generation
+ * which tells the other threads to drop what they resolved.
+ */
+
+#include "nla_test.h"
+
+
+/*
+ * Hand a link message of ifindex over to the table, named name for a
+ * RTM_NEWLINK.
+ */
+static void
+nla_test_link (int type, int ifindex, const char *name)
+{
+    struct {
+        struct nlmsghdr  nlh;
+        struct ifinfomsg ifi;
+        struct nlattr    nla;
+        char             name[IFNAMSIZ];
+    } msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(msg.ifi));
+    msg.nlh.nlmsg_type = type;
+    msg.ifi.ifi_index = ifindex;
+
+    if (name) {
+        msg.nla.nla_type = IFLA_IFNAME;
+        msg.nla.nla_len = NLA_HDRLEN + strlen(name) + 1;
+        strcpy(msg.name, name);
+        msg.nlh.nlmsg_len += NLA_ALIGN(msg.nla.nla_len);
+    }
+
+    nla_ifname_update(&msg.nlh);
+}
+
+
+int
+main (int argc UNUSED, char **argv UNUSED)
+{
+    unsigned int generation;
+
+    generation = nla_ifname_generation();
+    nla_test_link(RTM_NEWLINK, 200, "eth0");
+    NLA_TEST_CHECK(nla_ifname(200) && !strcmp(nla_ifname(200), "eth0"));
+    NLA_TEST_CHECK(nla_ifname_generation() != generation);
+
+    /* Link state changes keep the name */
+    generation = nla_ifname_generation();
+    nla_test_link(RTM_NEWLINK, 200, "eth0");
+    NLA_TEST_CHECK(nla_ifname_generation() == generation);
+
+    nla_test_link(RTM_NEWLINK, 200, "eth1");
+    NLA_TEST_CHECK(!strcmp(nla_ifname(200), "eth1"));
+    NLA_TEST_CHECK(nla_ifname_generation() != generation);
+
+    generation = nla_ifname_generation();
+    nla_test_link(RTM_DELLINK, 200, NULL);
+    NLA_TEST_CHECK(!nla_ifname(200));
+    NLA_TEST_CHECK(nla_ifname_generation() != generation);
+
+    /* Unknown already */
+    generation = nla_ifname_generation();
+    nla_test_link(RTM_DELLINK, 200, NULL);
+    NLA_TEST_CHECK(nla_ifname_generation() == generation);
+
+    nla_ifname_flush();
+    NLA_TEST_CHECK(nla_ifname_generation() != generation);
+
+    return NLA_TEST_EXIT();
+}
@@ -0,0 +1,196 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * shivakumar channalli
+ *
+ * This SOFTWARE is licensed to you under the Apache License 2.0 .
+ * You may not use this code except in compliance with the License.
+ * This code is not an official Juniper product.
+ * You can obtain a copy of the License at http://spdx.org/licenses/Apache-2.0.html
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+
+/*
+ * A SOCK_SEQPACKET link never carries a msg longer than
+ * NLA_SEQPACKET_MAX_LEN: the NLM server rejects it, rather than handing
+ * the peer a packet it can't read whole. Its unix socket file is only
+ * replaced once nobody listens on it.
+ */
+
+#include "nla_test.h"
+
+#include <event2/listener.h>
+
+
+extern nla_context_t nla_nlm_server_ctx;
+
+static nla_module_vector_t *nla_test_nlm_server;
+
+
+/*
+ * Notify the NLM server of a route msg of len bytes.
+ *
+ * @return the bytes queued on its link.
+ */
+static size_t
+nla_test_nlm_server_write (size_t len)
+{
+    struct nlmsghdr *nlh;
+    nla_event_info_t evinfo;
+    size_t queued;
+
+    nlh = (struct nlmsghdr *)calloc(1, len);
+    nlh->nlmsg_len = len;
+    nlh->nlmsg_type = RTM_NEWROUTE;
+
+    memset(&evinfo, 0, sizeof(evinfo));
+    evinfo.nlaei_type = NLA_WRITE;
+    evinfo.nlaei_msg = nlh;
+    evinfo.nlaei_msglen = len;
+
+    nla_test_nlm_server->nlamv_notify_cb(NLA_KNLM, &evinfo);
+    free(nlh);
+
+    queued = evbuffer_get_length(bufferevent_get_output(nla_nlm_server_ctx.nlac_bev));
+
+    /* Flush it to the peer */
+    event_base_loop(nla_gl.nlag_base, EVLOOP_NONBLOCK);
+    event_base_loop(nla_gl.nlag_base, EVLOOP_NONBLOCK);
+
+    return queued;
+}
+
+
+/*
+ * @return the bytes read from the peer end fd in reads recv() calls, -1 if
+ *         there are none.
+ */
+static ssize_t
+nla_test_peer_read (int fd, int *reads)
+{
+    static char buf[65536];
+    ssize_t total = -1;
+    ssize_t n;
+
+    *reads = 0;
+    while ((n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+        total = (total < 0) ? n : total + n;
+        (*reads)++;
+    }
+
+    return total;
+}
+
+
+/*
+ * Connect the NLM server to a peer over a socketpair of socktype.
+ *
+ * @return the peer end.
+ */
+static int
+nla_test_link (int socktype)
+{
+    int fds[2];
+
+    if (nla_nlm_server_ctx.nlac_bev) {
+        bufferevent_free(nla_nlm_server_ctx.nlac_bev);
+    }
+
+    if (socketpair(AF_UNIX, socktype, 0, fds) < 0) {
+        perror("socketpair");
+        exit(1);
+    }
+
+    evutil_make_socket_nonblocking(fds[0]);
+    nla_nlm_server_ctx.nlac_bev = nla_bufferevent_new(fds[0], NULL, NULL);
+    bufferevent_enable(nla_nlm_server_ctx.nlac_bev, EV_WRITE);
+
+    return fds[1];
+}
+
+
+static void
+nla_test_accept (struct evconnlistener *listener UNUSED, evutil_socket_t fd,
+                 struct sockaddr *sa UNUSED, int socklen UNUSED, void *arg UNUSED)
+{
+    evutil_closesocket(fd);
+}
+
+
+/*
+ * Listen on the unix seqpacket socket path.
+ */
+static struct evconnlistener *
+nla_test_listen (const char *path)
+{
+    struct sockaddr_un *un_addr;
+    nla_sockaddr_t addr;
+
+    memset(&addr, 0, sizeof(addr));
+    un_addr = (struct sockaddr_un *)&addr.nlasa_addr;
+    un_addr->sun_family = AF_UNIX;
+    strcpy(un_addr->sun_path, path);
+    addr.nlasa_len = sizeof(*un_addr);
+    addr.nlasa_socktype = SOCK_SEQPACKET;
+
+    return nla_listener_new(&addr, nla_test_accept);
+}
+
+
+int
+main (int argc UNUSED, char **argv UNUSED)
+{
+    struct evconnlistener *listener;
+    char path[64];
+    int peer, reads;
+
+    nla_gl.nlag_base = event_base_new();
+
+    /* Resets nla_nlm_server_ctx */
+    nla_test_nlm_server = nla_nlm_server_get_vec();
+
+    peer = nla_test_link(SOCK_SEQPACKET);
+
+    /* Over the limit: rejected, nothing reaches the peer */
+    NLA_TEST_CHECK(nla_test_nlm_server_write(6000) == 0);
+    NLA_TEST_CHECK(nla_test_peer_read(peer, &reads) == -1);
+
+    /* At the limit: a single packet */
+    NLA_TEST_CHECK(nla_test_nlm_server_write(NLA_SEQPACKET_MAX_LEN) == NLA_SEQPACKET_MAX_LEN);
+    NLA_TEST_CHECK(nla_test_peer_read(peer, &reads) == NLA_SEQPACKET_MAX_LEN);
+    NLA_TEST_CHECK(reads == 1);
+
+    close(peer);
+
+    /* A stream carries it */
+    peer = nla_test_link(SOCK_STREAM);
+
+    NLA_TEST_CHECK(nla_test_nlm_server_write(6000) == 6000);
+    NLA_TEST_CHECK(nla_test_peer_read(peer, &reads) == 6000);
+
+    close(peer);
+
+    /* In use: kept, left behind: replaced */
+    snprintf(path, sizeof(path), "/tmp/nla_seqpacket_test.%d", getpid());
+    listener = nla_test_listen(path);
+    NLA_TEST_CHECK(listener);
+    NLA_TEST_CHECK(!nla_test_listen(path));
+    evconnlistener_free(listener);
+
+    listener = nla_test_listen(path);
+    NLA_TEST_CHECK(listener);
+    evconnlistener_free(listener);
+    unlink(path);
+
+    bufferevent_free(nla_nlm_server_ctx.nlac_bev);
+    nla_nlm_server_ctx.nlac_bev = NULL;
+    event_base_free(nla_gl.nlag_base);
+
+    return NLA_TEST_EXIT();
+}
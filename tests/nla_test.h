@@ -0,0 +1,45 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * shivakumar channalli
+ *
+ * This SOFTWARE is licensed to you under the Apache License 2.0 .
+ * You may not use this code except in compliance with the License.
+ * This code is not an official Juniper product.
+ * You can obtain a copy of the License at http://spdx.org/licenses/Apache-2.0.html
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+
+/*
+ * Unit tests. A test includes this header, which pulls in the agent but for
+ * its main(), so that it reaches the statics of nla_main.c. It is linked
+ * with the other agent objects, see make test.
+ */
+
+#ifndef _NLA_TEST_H
+#define _NLA_TEST_H
+
+#define main nla_agent_main
+#include <nla_main.c>
+#undef main
+
+
+static int nla_test_failures;
+
+#define NLA_TEST_CHECK(cond)\
+{\
+    if (!(cond)) {\
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);\
+        nla_test_failures++;\
+    }\
+}
+
+#define NLA_TEST_EXIT() (nla_test_failures ? 1 : 0)
+
+#endif /* _NLA_TEST_H */
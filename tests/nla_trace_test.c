@@ -0,0 +1,131 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * shivakumar channalli
+ *
+ * This SOFTWARE is licensed to you under the Apache License 2.0 .
+ * You may not use this code except in compliance with the License.
+ * This code is not an official Juniper product.
+ * You can obtain a copy of the License at http://spdx.org/licenses/Apache-2.0.html
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+/*
+ * Binary trace rings of the threads which outlive nla_trace_stop(), or which
+ * trace from their thread_local destructors.
+ */
+
+#include "nla_test.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+
+static nla_trace_fmt_t nla_test_fmt = { __FUNCTION__, __LINE__, LOG_INFO, false, {0} };
+
+static std::mutex              nla_test_lock;
+static std::condition_variable nla_test_cond;
+static int                     nla_test_step;
+static bool                    nla_test_traced[4];
+
+
+static bool
+nla_test_trace (int value)
+{
+    return nla_trace(&nla_test_fmt, "value %d", value);
+}
+
+
+static void
+nla_test_wait_step (int step)
+{
+    std::unique_lock<std::mutex> lock(nla_test_lock);
+
+    nla_test_cond.wait(lock, [step] { return nla_test_step >= step; });
+}
+
+
+static void
+nla_test_set_step (int step)
+{
+    {
+        std::lock_guard<std::mutex> lock(nla_test_lock);
+        nla_test_step = step;
+    }
+    nla_test_cond.notify_all();
+}
+
+
+/* Traces once its thread has retired its ring */
+struct nla_test_late_s {
+    ~nla_test_late_s ()
+    {
+        nla_test_traced[3] = nla_test_trace(3);
+    }
+};
+
+static thread_local nla_test_late_s nla_test_late;
+
+
+/*
+ * Traces before and after nla_trace_stop(), then from a destructor which
+ * runs after the one of its ring.
+ */
+static void
+nla_test_thread (void)
+{
+    (void)&nla_test_late;
+
+    nla_test_traced[0] = nla_test_trace(0);
+    nla_test_set_step(1);
+
+    nla_test_wait_step(2);
+    nla_test_traced[1] = nla_test_trace(1);
+    nla_test_set_step(3);
+
+    nla_test_wait_step(4);
+    nla_test_traced[2] = nla_test_trace(2);
+}
+
+
+int
+main (int argc UNUSED, char **argv UNUSED)
+{
+    char path[] = "/tmp/nla_trace_test.XXXXXX";
+    std::thread *thread;
+    int fd;
+
+    fd = mkstemp(path);
+    NLA_TEST_CHECK(fd >= 0);
+    close(fd);
+
+    NLA_TEST_CHECK(nla_trace_start(path) == 0);
+    thread = new std::thread(nla_test_thread);
+
+    /* The thread is still up when its ring is freed */
+    nla_test_wait_step(1);
+    nla_trace_stop();
+    nla_test_set_step(2);
+    nla_test_wait_step(3);
+
+    /* A new session gets it a new ring */
+    NLA_TEST_CHECK(nla_trace_start(path) == 0);
+    nla_test_set_step(4);
+    thread->join();
+    delete thread;
+    nla_trace_stop();
+
+    NLA_TEST_CHECK(nla_test_traced[0]);
+    NLA_TEST_CHECK(!nla_test_traced[1]);
+    NLA_TEST_CHECK(nla_test_traced[2]);
+    NLA_TEST_CHECK(!nla_test_traced[3]);
+
+    unlink(path);
+
+    return NLA_TEST_EXIT();
+}
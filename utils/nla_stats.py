@@ -0,0 +1,172 @@
+#!/usr/bin/env python3
+#
+# Copyright(C) 2018, Juniper Networks, Inc.
+# All rights reserved
+#
+# This SOFTWARE is licensed to you under the Apache License 2.0 .
+# You may not use this code except in compliance with the License.
+# This code is not an official Juniper product.
+# You can obtain a copy of the License at http://spdx.org/licenses/Apache-2.0.html
+#
+
+"""
+Print the counters of the nlagent stats page, see nla_stats.h.
+
+usage: nla_stats.py [-i interval] [stats-file]
+
+  -i  print them again every interval secs
+"""
+
+import mmap
+import struct
+import sys
+import time
+
+NLA_STATS_FILE = "/var/tmp/nlagent.stats"
+NLA_STATS_MAGIC = 0x4e4c4153
+NLA_STATS_VERSION = 2
+
+NLA_STATS_MODULES_MAX = 16
+NLA_STATS_NAME_LEN = 32
+NLA_STATS_LATENCY_MAX = 16
+
+DROP_REASONS = ["family", "table", "protocol"]
+
+HDR = struct.Struct("=IIIIQII")
+HDR_LEN = 64
+COUNTERS = struct.Struct("=8Q")
+LATENCY = struct.Struct("=IIQQQ")
+
+PERCENTILES = [50, 90, 99, 99.9]
+
+MODULE_FIELDS = ["msgs_in", "bytes_in", "msgs_out", "bytes_out",
+                 "write_failures", "reconnects", "queue", "queue_hiwat"]
+
+NAMES_OFF = HDR_LEN
+MODULES_OFF = NAMES_OFF + NLA_STATS_MODULES_MAX * NLA_STATS_NAME_LEN
+EDGES_OFF = MODULES_OFF + NLA_STATS_MODULES_MAX * COUNTERS.size
+LATENCIES_OFF = EDGES_OFF + NLA_STATS_MODULES_MAX * NLA_STATS_MODULES_MAX * COUNTERS.size
+
+
+def stats_len(hist_buckets):
+    return LATENCIES_OFF + NLA_STATS_LATENCY_MAX * (LATENCY.size + 8 * hist_buckets)
+
+
+def hist_value(bucket, sub_bits=3):
+    """The largest nsecs of bucket, see nla_stats_hist_value()."""
+    sub = 1 << sub_bits
+    if bucket < sub:
+        return bucket
+    return ((sub + bucket % sub + 1) << (bucket // sub - 1)) - 1
+
+
+def hist_percentile(buckets, count, max_ns, percentile):
+    """See nla_stats_hist_percentile()."""
+    if not count:
+        return 0
+    rank = min(int(percentile * count / 100), count - 1)
+    seen = 0
+    for i, n in enumerate(buckets):
+        seen += n
+        if seen > rank:
+            break
+    if i >= len(buckets) - 1 or hist_value(i) > max_ns:
+        return max_ns
+    return hist_value(i)
+
+
+def open_stats(path):
+    with open(path, "rb") as f:
+        page = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+    if len(page) < HDR.size:
+        raise ValueError("%s: too short for a stats page" % path)
+    magic, version, _, _, _, _, hist_buckets = HDR.unpack_from(page)
+    if magic != NLA_STATS_MAGIC or version != NLA_STATS_VERSION:
+        raise ValueError("%s: not a nlagent stats page" % path)
+    if len(page) < stats_len(hist_buckets):
+        raise ValueError("%s: too short for a stats page" % path)
+    return page
+
+
+def dump(page):
+    magic, _, modules, drop_reasons, start_time, latencies, hist_buckets = HDR.unpack_from(page)
+    if magic != NLA_STATS_MAGIC:
+        return False
+
+    names = []
+    for i in range(modules):
+        off = NAMES_OFF + i * NLA_STATS_NAME_LEN
+        names.append(page[off:off + NLA_STATS_NAME_LEN].split(b"\0")[0].decode())
+
+    print("nlagent up since %s" % time.strftime("%Y-%m-%d %H:%M:%S", time.localtime(start_time)))
+    print()
+    print("%-16s" % "module" + "".join("%15s" % f for f in MODULE_FIELDS))
+    for i in range(modules):
+        counters = COUNTERS.unpack_from(page, MODULES_OFF + i * COUNTERS.size)
+        if any(counters):
+            print("%-16s" % names[i] + "".join("%15d" % c for c in counters))
+
+    reasons = DROP_REASONS[:drop_reasons]
+    print()
+    print("%-34s%15s%15s%15s" % ("edge", "msgs", "bytes", "strips") +
+          "".join("%15s" % ("drop-" + r) for r in reasons))
+    for src in range(modules):
+        for dst in range(modules):
+            off = EDGES_OFF + (src * NLA_STATS_MODULES_MAX + dst) * COUNTERS.size
+            counters = COUNTERS.unpack_from(page, off)
+            if any(counters):
+                print("%-34s" % (names[src] + " -> " + names[dst]) +
+                      "".join("%15d" % c for c in counters[:3 + drop_reasons]))
+
+    print()
+    print("%-34s%15s%12s" % ("latency (usecs)", "count", "mean") +
+          "".join("%12s" % ("p%g" % p) for p in PERCENTILES) + "%12s" % "max")
+    hist_len = LATENCY.size + 8 * hist_buckets
+    for i in range(min(latencies, NLA_STATS_LATENCY_MAX)):
+        off = LATENCIES_OFF + i * hist_len
+        src, dst, count, total, max_ns = LATENCY.unpack_from(page, off)
+        if not count:
+            continue
+        buckets = struct.unpack_from("=%dQ" % hist_buckets, page, off + LATENCY.size)
+        print("%-34s%15d%12.1f" % (names[src] + " -> " + names[dst], count, total / count / 1e3) +
+              "".join("%12.1f" % (hist_percentile(buckets, count, max_ns, p) / 1e3)
+                      for p in PERCENTILES) +
+              "%12.1f" % (max_ns / 1e3))
+    return True
+
+
+def main():
+    argv = sys.argv[1:]
+    interval = None
+    if len(argv) >= 2 and argv[0] == "-i":
+        interval = float(argv[1])
+        argv = argv[2:]
+    if len(argv) > 1 or (argv and argv[0].startswith("-")):
+        sys.stderr.write(__doc__)
+        return 1
+    path = argv[0] if argv else NLA_STATS_FILE
+
+    try:
+        page = open_stats(path)
+    except (OSError, ValueError) as e:
+        sys.stderr.write("%s\n" % e)
+        return 1
+
+    while True:
+        if not dump(page):
+            # Recreated by a restart of the agent
+            page.close()
+            try:
+                page = open_stats(path)
+            except (OSError, ValueError) as e:
+                sys.stderr.write("%s\n" % e)
+                return 1
+            continue
+        if interval is None:
+            return 0
+        time.sleep(interval)
+        print()
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,184 @@
+#!/usr/bin/env python3
+#
+# Copyright(C) 2018, Juniper Networks, Inc.
+# All rights reserved
+#
+# This SOFTWARE is licensed to you under the Apache License 2.0 .
+# You may not use this code except in compliance with the License.
+# This code is not an official Juniper product.
+# You can obtain a copy of the License at http://spdx.org/licenses/Apache-2.0.html
+#
+
+"""
+Render the binary trace file of nlagent -f, see nla_trace.h.
+
+usage: nla_trace_decode.py [-x] trace-file
+
+  -x  hex dump the netlink message snapshots
+"""
+
+import datetime
+import re
+import struct
+import sys
+
+NLA_TRACE_MAGIC = 0x4e4c4154
+NLA_TRACE_VERSION = 1
+
+REC_FORMAT, REC_LOG, REC_SNAPSHOT, REC_THREAD, REC_DROP = range(1, 6)
+
+REC_HDR = struct.Struct("=HBBIIIQ")
+NLMSG_HDR = struct.Struct("=IHHII")
+
+# printf conversion, see printf(3)
+CONVERSION = re.compile(r"%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d+))?(hh|h|ll|l|L|q|j|z|t)?([diouxXeEfFgGaAcspn%])")
+
+
+def read_args(payload):
+    args = []
+    off = 0
+    while off < len(payload):
+        tag = chr(payload[off])
+        off += 1
+        if tag == "s":
+            (slen,) = struct.unpack_from("=H", payload, off)
+            off += 2
+            args.append(payload[off:off + slen].decode(errors="replace"))
+            off += slen
+        elif tag == "i":
+            args.append(struct.unpack_from("=q", payload, off)[0])
+            off += 8
+        elif tag in "up":
+            args.append(struct.unpack_from("=Q", payload, off)[0])
+            off += 8
+        elif tag == "d":
+            args.append(struct.unpack_from("=d", payload, off)[0])
+            off += 8
+        else:
+            # Padding
+            break
+    return args
+
+
+def render(fmt, args):
+    """Apply the printf format fmt to args, as the agent would have."""
+    out = []
+    pos = 0
+    args = list(args)
+
+    def next_arg():
+        return args.pop(0) if args else None
+
+    for m in CONVERSION.finditer(fmt):
+        out.append(fmt[pos:m.start()])
+        pos = m.end()
+        flags, width, prec, _, conv = m.groups()
+        if conv == "%":
+            out.append("%")
+            continue
+        if width == "*":
+            width = str(next_arg())
+        if prec == "*":
+            prec = str(next_arg())
+        value = next_arg()
+        if value is None:
+            out.append("<missing>")
+            continue
+        spec = "%" + flags + (width or "") + ("." + prec if prec is not None else "")
+        try:
+            if conv == "p":
+                out.append((spec + "s") % hex(value))
+            elif conv == "c":
+                out.append((spec + "c") % value)
+            elif conv == "u":
+                out.append((spec + "d") % value)
+            elif conv in "dioxX":
+                out.append((spec + conv) % value)
+            elif conv == "s":
+                out.append((spec + "s") % value)
+            else:
+                out.append((spec + conv) % value)
+        except (TypeError, ValueError):
+            out.append(repr(value))
+    out.append(fmt[pos:])
+    return "".join(out)
+
+
+def timestamp(nsecs):
+    t = datetime.datetime.fromtimestamp(nsecs / 1e9)
+    return t.strftime("%H:%M:%S.") + "%06d" % (nsecs // 1000 % 1000000)
+
+
+def snapshot(payload, msglen, hexdump):
+    lines = []
+    if len(payload) >= NLMSG_HDR.size:
+        nlen, ntype, nflags, nseq, npid = NLMSG_HDR.unpack_from(payload)
+        lines.append("--<NLMSG len %u type %u flags 0x%x seq %u pid %u>%s"
+                     % (nlen, ntype, nflags, nseq, npid,
+                        " (%u bytes kept)" % len(payload) if len(payload) < msglen else ""))
+    if hexdump:
+        for off in range(0, len(payload), 16):
+            chunk = payload[off:off + 16]
+            lines.append("    %04x  %s" % (off, " ".join("%02x" % b for b in chunk)))
+    return lines
+
+
+def main():
+    argv = sys.argv[1:]
+    hexdump = "-x" in argv
+    argv = [a for a in argv if a != "-x"]
+    if len(argv) != 1:
+        sys.stderr.write(__doc__)
+        return 1
+
+    with open(argv[0], "rb") as f:
+        data = f.read()
+
+    if len(data) < 8 or struct.unpack_from("=II", data) != (NLA_TRACE_MAGIC, NLA_TRACE_VERSION):
+        sys.stderr.write("%s: not a nlagent trace file\n" % argv[0])
+        return 1
+
+    # The formats first, a record may be drained before its format
+    formats = {}
+    records = []
+    off = 8
+    while off + REC_HDR.size <= len(data):
+        rlen, rtype, level, rid, ring, _, rtime = REC_HDR.unpack_from(data, off)
+        if rlen < REC_HDR.size or off + rlen > len(data):
+            break
+        payload = data[off + REC_HDR.size:off + rlen]
+        if rtype == REC_FORMAT:
+            (line,) = struct.unpack_from("=I", payload)
+            more_info = payload[4]
+            func, fmt = payload[5:].split(b"\0")[:2]
+            formats[rid] = (line, more_info, func.decode(), fmt.decode(errors="replace"))
+        else:
+            records.append((rtype, level, rid, ring, rtime, payload))
+        off += rlen
+
+    # The rings are drained one after the other
+    records.sort(key=lambda rec: rec[4])
+
+    for rtype, level, rid, ring, rtime, payload in records:
+        prefix = "%s %3d " % (timestamp(rtime), ring)
+        if rtype == REC_THREAD:
+            print(prefix + "--<THREAD %d>" % rid)
+        elif rtype == REC_DROP:
+            print(prefix + "--<%d RECORDS DROPPED>" % rid)
+        elif rtype == REC_SNAPSHOT:
+            for line in snapshot(payload, rid, hexdump):
+                print(prefix + line)
+        elif rtype == REC_LOG:
+            if rid not in formats:
+                print(prefix + "<unknown format %d>" % rid)
+                continue
+            line, more_info, func, fmt = formats[rid]
+            text = render(fmt, read_args(payload))
+            if more_info:
+                text = "%-50s-%3d-  %s" % (func, line, text)
+            print(prefix + text)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())